@@ -0,0 +1,74 @@
+// Mark time against --gc-threads: builds a tree of procedures, each one
+// holding eight others on its stack, and times full collections of it.
+//
+//   vast_mark_bench [objects] [max-threads]
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHILDREN 8
+#define RUNS 5
+
+static double now_ms() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec * 1e3 + (double)time.tv_nsec / 1e6;
+}
+
+static void build_tree(size_t count) {
+  ObjProcedure **queue = malloc(sizeof(ObjProcedure *) * count);
+  size_t next = 0;
+  size_t made = 1;
+  queue[0] = new_procedure();
+  push(OBJ_VAL(queue[0]));
+  while (made < count) {
+    ObjProcedure *parent = queue[next++];
+    for (size_t i = 0; i < CHILDREN && made < count; ++i) {
+      ObjProcedure *child = new_procedure();
+      write_value_array(&parent->stack, OBJ_VAL(child));
+      queue[made++] = child;
+    }
+  }
+  free(queue);
+}
+
+static double best_collection(size_t threads, size_t count) {
+  gc_threads = threads;
+  init_VM();
+  // Only the collections timed here.
+  nursery_size = 0;
+  vm.next_gc = SIZE_MAX;
+  build_tree(count);
+  collect_garbage();
+  double best = 0;
+  for (size_t i = 0; i < RUNS; ++i) {
+    double start = now_ms();
+    collect_garbage();
+    double time = now_ms() - start;
+    if (i == 0 || time < best) {
+      best = time;
+    }
+  }
+  free_VM();
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? (size_t)atol(argv[1]) : 2000000;
+  size_t max_threads = argc > 2 ? (size_t)atol(argv[2]) : 8;
+  double base = 0;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    double time = best_collection(threads, count);
+    if (threads == 1) {
+      base = time;
+    }
+    printf("%2zu threads  %8.2f ms  %5.2fx\n", threads, time, base / time);
+  }
+  return 0;
+}
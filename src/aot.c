@@ -0,0 +1,40 @@
+#include "aot.h"
+#include "compiler.h"
+#include "optimizer.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const AotChunk *aot_chunks = NULL;
+static size_t aot_chunk_count = 0;
+
+AotFn aot_find(ObjString *name, ObjFunction *function) {
+  for (size_t i = 0; i < aot_chunk_count; ++i) {
+    const AotChunk *chunk = &aot_chunks[i];
+    bool same_name = name == NULL ? chunk->name == NULL
+                                  : chunk->name != NULL &&
+                                        strcmp(chunk->name, name->chars) == 0;
+    if (same_name && chunk->count == function->chunk.count &&
+        memcmp(chunk->code, function->chunk.code, chunk->count) == 0) {
+      return chunk->run;
+    }
+  }
+  return NULL;
+}
+
+int aot_main(const char *source, int level, int inline_limit,
+             const AotChunk *chunks, size_t count) {
+  optimization_level = level;
+  inline_threshold = inline_limit;
+  aot_chunks = chunks;
+  aot_chunk_count = count;
+  init_VM();
+  InterpretResult result = interpret(source);
+  free_VM();
+  if (result == INTERPRET_COMPILE_ERROR) {
+    return 65;
+  }
+  if (result == INTERPRET_RUNTIME_ERROR) {
+    return 70;
+  }
+  return EXIT_SUCCESS;
+}
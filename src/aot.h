@@ -0,0 +1,138 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// A chunk compiled ahead of time by `vast --emit-c`. The generated program
+// compiles its embedded source as usual and attaches run to every function
+// whose bytecode matches code, so anything built differently at run time is
+// simply interpreted.
+typedef struct AotChunk {
+  const char *name;
+  const uint8_t *code;
+  size_t count;
+  AotFn run;
+} AotChunk;
+
+// The compiled chunk for function, or NULL. name is NULL for the script.
+AotFn aot_find(ObjString *name, ObjFunction *function);
+// Entry point of generated programs, which compile their source with the
+// optimization level and inline threshold they were generated with. Returns
+// the process exit code.
+int aot_main(const char *source, int level, int inline_limit,
+             const AotChunk *chunks, size_t count);
+
+// Generated code works on a local copy of vm.stack_top and hands control
+// back to the interpreter, with the stack written back, at calls, returns,
+// and whenever an operand is not what its fast path expects.
+
+static inline Value aot_value(Value value) {
+  if (IS_VARIABLE(value)) {
+    return vm.global_values.value[AS_VARIABLE(value)];
+  }
+  return value;
+}
+
+static inline bool aot_falsey(Value value) {
+  return IS_NIL(value) || (IS_NUMBER(value) && AS_NUMBER(value) == 0.0) ||
+         (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+#define AOT_EXIT(offset)                                                       \
+  do {                                                                         \
+    vm.stack_top = sp;                                                         \
+    return code + (offset);                                                    \
+  } while (false)
+
+#define AOT_PUSH(value) (*sp++ = (value))
+
+// A stale guard is left to the interpreter, which applies the slot instead.
+#define AOT_INLINE(offset, slot, callee)                                       \
+  do {                                                                         \
+    if (!values_equal(vm.global_values.value[slot], (callee))) {               \
+      AOT_EXIT(offset);                                                        \
+    }                                                                          \
+  } while (false)
+
+#define AOT_BINARY(offset, operation)                                          \
+  do {                                                                         \
+    Value a = aot_value(sp[-2]);                                               \
+    Value b = aot_value(sp[-1]);                                               \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                                      \
+      AOT_EXIT(offset);                                                        \
+    }                                                                          \
+    sp--;                                                                      \
+    sp[-1] = operation(a, b);                                                  \
+  } while (false)
+
+#define AOT_BINARY_WITH(offset, operation, operand)                            \
+  do {                                                                         \
+    Value a = aot_value(sp[-1]);                                               \
+    Value b = (operand);                                                       \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                                      \
+      AOT_EXIT(offset);                                                        \
+    }                                                                          \
+    sp[-1] = operation(a, b);                                                  \
+  } while (false)
+
+#define AOT_EQUAL(negate)                                                      \
+  do {                                                                         \
+    Value b = aot_value(sp[-1]);                                               \
+    Value a = aot_value(sp[-2]);                                               \
+    sp--;                                                                      \
+    sp[-1] = BOOL_VAL(values_equal(a, b) != (negate));                         \
+  } while (false)
+
+#define AOT_TRUTHY(negate)                                                     \
+  (sp[-1] = BOOL_VAL(aot_falsey(aot_value(sp[-1])) == (negate)))
+
+#define AOT_SET_GLOBAL(slot)                                                   \
+  do {                                                                         \
+    vm.global_values.value[slot] = aot_value(sp[-1]);                          \
+    sp--;                                                                      \
+  } while (false)
+
+#define AOT_SET_LOCAL(slot)                                                    \
+  do {                                                                         \
+    slots[slot] = aot_value(sp[-1]);                                           \
+    sp--;                                                                      \
+  } while (false)
+
+#define AOT_SET_VARIABLE(offset)                                               \
+  do {                                                                         \
+    if (!IS_VARIABLE(sp[-1])) {                                                \
+      AOT_EXIT(offset);                                                        \
+    }                                                                          \
+    vm.global_values.value[AS_VARIABLE(sp[-1])] = aot_value(sp[-2]);          \
+    sp -= 2;                                                                   \
+  } while (false)
+
+#define AOT_PRINT()                                                            \
+  do {                                                                         \
+    sp--;                                                                      \
+    print_value(aot_value(*sp));                                               \
+  } while (false)
+
+#define AOT_DUP() (sp[0] = sp[-1], sp++)
+#define AOT_DROP() (sp--)
+#define AOT_OVER() (sp[0] = sp[-2], sp++)
+
+#define AOT_SWAP()                                                             \
+  do {                                                                         \
+    Value top = sp[-1];                                                        \
+    sp[-1] = sp[-2];                                                           \
+    sp[-2] = top;                                                              \
+  } while (false)
+
+#define AOT_ROT()                                                              \
+  do {                                                                         \
+    Value third = sp[-3];                                                      \
+    sp[-3] = sp[-2];                                                           \
+    sp[-2] = sp[-1];                                                           \
+    sp[-1] = third;                                                            \
+  } while (false)
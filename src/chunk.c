@@ -10,6 +10,8 @@ void init_chunk(Chunk *chunk) {
   chunk->code = NULL;
   chunk->lines = NULL;
   init_value_array(&chunk->constants);
+  chunk->segments = NULL;
+  chunk->segment_count = 0;
 }
 
 void write_chunk(Chunk *chunk, uint8_t byte, size_t line) {
@@ -29,6 +31,7 @@ void write_chunk(Chunk *chunk, uint8_t byte, size_t line) {
 void free_chunk(Chunk *chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
   FREE_ARRAY(size_t, chunk->lines, chunk->capacity);
+  FREE_ARRAY(Segment, chunk->segments, chunk->segment_count);
   free_value_array(&chunk->constants);
   init_chunk(chunk);
 }
@@ -39,3 +42,385 @@ size_t add_constant(Chunk *chunk, Value value) {
   pop();
   return chunk->constants.count - 1;
 }
+
+size_t instruction_length(uint8_t instruction) {
+  switch (instruction) {
+  case OP_CONSTANT:
+  case OP_PUSH_OPERATION:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_ADD_CONSTANT:
+  case OP_SUBTRACT_CONSTANT:
+  case OP_MULTIPLY_CONSTANT:
+  case OP_DIVIDE_CONSTANT:
+  case OP_GREATER_CONSTANT:
+  case OP_LESS_CONSTANT:
+  case OP_GREATER_EQUAL_CONSTANT:
+  case OP_LESS_EQUAL_CONSTANT:
+  case OP_ADD_CONSTANT_INT:
+  case OP_SUBTRACT_CONSTANT_INT:
+  case OP_MULTIPLY_CONSTANT_INT:
+  case OP_DIVIDE_CONSTANT_INT:
+  case OP_GREATER_CONSTANT_INT:
+  case OP_LESS_CONSTANT_INT:
+  case OP_GREATER_EQUAL_CONSTANT_INT:
+  case OP_LESS_EQUAL_CONSTANT_INT:
+  case OP_ADD_CONSTANT_DOUBLE:
+  case OP_SUBTRACT_CONSTANT_DOUBLE:
+  case OP_MULTIPLY_CONSTANT_DOUBLE:
+  case OP_DIVIDE_CONSTANT_DOUBLE:
+  case OP_GREATER_CONSTANT_DOUBLE:
+  case OP_LESS_CONSTANT_DOUBLE:
+  case OP_GREATER_EQUAL_CONSTANT_DOUBLE:
+  case OP_LESS_EQUAL_CONSTANT_DOUBLE:
+  case OP_ADD_CONSTANT_NUM:
+  case OP_SUBTRACT_CONSTANT_NUM:
+  case OP_MULTIPLY_CONSTANT_NUM:
+  case OP_DIVIDE_CONSTANT_NUM:
+  case OP_GREATER_CONSTANT_NUM:
+  case OP_LESS_CONSTANT_NUM:
+  case OP_GREATER_EQUAL_CONSTANT_NUM:
+  case OP_LESS_EQUAL_CONSTANT_NUM:
+  case OP_ADD_LOCAL:
+  case OP_SUBTRACT_LOCAL:
+  case OP_MULTIPLY_LOCAL:
+  case OP_DIVIDE_LOCAL:
+  case OP_GREATER_LOCAL:
+  case OP_LESS_LOCAL:
+  case OP_GREATER_EQUAL_LOCAL:
+  case OP_LESS_EQUAL_LOCAL:
+  case OP_ADD_LOCAL_INT:
+  case OP_SUBTRACT_LOCAL_INT:
+  case OP_MULTIPLY_LOCAL_INT:
+  case OP_DIVIDE_LOCAL_INT:
+  case OP_GREATER_LOCAL_INT:
+  case OP_LESS_LOCAL_INT:
+  case OP_GREATER_EQUAL_LOCAL_INT:
+  case OP_LESS_EQUAL_LOCAL_INT:
+  case OP_ADD_LOCAL_DOUBLE:
+  case OP_SUBTRACT_LOCAL_DOUBLE:
+  case OP_MULTIPLY_LOCAL_DOUBLE:
+  case OP_DIVIDE_LOCAL_DOUBLE:
+  case OP_GREATER_LOCAL_DOUBLE:
+  case OP_LESS_LOCAL_DOUBLE:
+  case OP_GREATER_EQUAL_LOCAL_DOUBLE:
+  case OP_LESS_EQUAL_LOCAL_DOUBLE:
+  case OP_ADD_LOCAL_NUM:
+  case OP_SUBTRACT_LOCAL_NUM:
+  case OP_MULTIPLY_LOCAL_NUM:
+  case OP_DIVIDE_LOCAL_NUM:
+  case OP_GREATER_LOCAL_NUM:
+  case OP_LESS_LOCAL_NUM:
+  case OP_GREATER_EQUAL_LOCAL_NUM:
+  case OP_LESS_EQUAL_LOCAL_NUM:
+    return 2;
+  case OP_VARIABLE:
+  case OP_DEFINE_FUNCTION:
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+  case OP_INVOKE:
+  case OP_TAIL_INVOKE:
+  case OP_ADD_VARIABLE:
+  case OP_SUBTRACT_VARIABLE:
+  case OP_MULTIPLY_VARIABLE:
+  case OP_DIVIDE_VARIABLE:
+  case OP_GREATER_VARIABLE:
+  case OP_LESS_VARIABLE:
+  case OP_GREATER_EQUAL_VARIABLE:
+  case OP_LESS_EQUAL_VARIABLE:
+  case OP_ADD_VARIABLE_INT:
+  case OP_SUBTRACT_VARIABLE_INT:
+  case OP_MULTIPLY_VARIABLE_INT:
+  case OP_DIVIDE_VARIABLE_INT:
+  case OP_GREATER_VARIABLE_INT:
+  case OP_LESS_VARIABLE_INT:
+  case OP_GREATER_EQUAL_VARIABLE_INT:
+  case OP_LESS_EQUAL_VARIABLE_INT:
+  case OP_ADD_VARIABLE_DOUBLE:
+  case OP_SUBTRACT_VARIABLE_DOUBLE:
+  case OP_MULTIPLY_VARIABLE_DOUBLE:
+  case OP_DIVIDE_VARIABLE_DOUBLE:
+  case OP_GREATER_VARIABLE_DOUBLE:
+  case OP_LESS_VARIABLE_DOUBLE:
+  case OP_GREATER_EQUAL_VARIABLE_DOUBLE:
+  case OP_LESS_EQUAL_VARIABLE_DOUBLE:
+  case OP_ADD_VARIABLE_NUM:
+  case OP_SUBTRACT_VARIABLE_NUM:
+  case OP_MULTIPLY_VARIABLE_NUM:
+  case OP_DIVIDE_VARIABLE_NUM:
+  case OP_GREATER_VARIABLE_NUM:
+  case OP_LESS_VARIABLE_NUM:
+  case OP_GREATER_EQUAL_VARIABLE_NUM:
+  case OP_LESS_EQUAL_VARIABLE_NUM:
+  case OP_SET_GLOBAL:
+    return 3;
+  // Slot, constant holding the inlined procedure, and the length of the
+  // inlined code.
+  case OP_INLINE:
+    return 6;
+  default:
+    return 1;
+  }
+}
+
+// How many values an instruction takes off the stack and leaves on it.
+// Returns false when that depends on runtime values (calls, definitions,
+// control flow).
+bool stack_effect(uint8_t instruction, int *pops, int *pushes) {
+  switch (instruction) {
+  case OP_CONSTANT:
+  case OP_PUSH_OPERATION:
+  case OP_VARIABLE:
+  case OP_GET_LOCAL:
+  case OP_SCAN:
+    *pops = 0;
+    *pushes = 1;
+    return true;
+  case OP_PRINT:
+  case OP_SET_GLOBAL:
+  case OP_SET_LOCAL:
+  case OP_DROP:
+    *pops = 1;
+    *pushes = 0;
+    return true;
+  case OP_DUP:
+    *pops = 1;
+    *pushes = 2;
+    return true;
+  case OP_SWAP:
+    *pops = 2;
+    *pushes = 2;
+    return true;
+  case OP_OVER:
+    *pops = 2;
+    *pushes = 3;
+    return true;
+  case OP_ROT:
+    *pops = 3;
+    *pushes = 3;
+    return true;
+  case OP_SET_VARIABLE:
+    *pops = 2;
+    *pushes = 0;
+    return true;
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_MOD:
+  case OP_EQUAL:
+  case OP_NOT_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_GREATER_EQUAL:
+  case OP_LESS_EQUAL:
+  case OP_ADD_INT:
+  case OP_SUBTRACT_INT:
+  case OP_MULTIPLY_INT:
+  case OP_DIVIDE_INT:
+  case OP_GREATER_INT:
+  case OP_LESS_INT:
+  case OP_GREATER_EQUAL_INT:
+  case OP_LESS_EQUAL_INT:
+  case OP_ADD_DOUBLE:
+  case OP_SUBTRACT_DOUBLE:
+  case OP_MULTIPLY_DOUBLE:
+  case OP_DIVIDE_DOUBLE:
+  case OP_GREATER_DOUBLE:
+  case OP_LESS_DOUBLE:
+  case OP_GREATER_EQUAL_DOUBLE:
+  case OP_LESS_EQUAL_DOUBLE:
+  case OP_ADD_NUM:
+  case OP_SUBTRACT_NUM:
+  case OP_MULTIPLY_NUM:
+  case OP_DIVIDE_NUM:
+  case OP_GREATER_NUM:
+  case OP_LESS_NUM:
+  case OP_GREATER_EQUAL_NUM:
+  case OP_LESS_EQUAL_NUM:
+  case OP_ADD_STR:
+    *pops = 2;
+    *pushes = 1;
+    return true;
+  case OP_NOT:
+  case OP_TRUTHY:
+  // 'n pick' reads deeper than it pops; run() checks that against the
+  // whole stack.
+  case OP_PICK:
+  case OP_ADD_CONSTANT:
+  case OP_SUBTRACT_CONSTANT:
+  case OP_MULTIPLY_CONSTANT:
+  case OP_DIVIDE_CONSTANT:
+  case OP_GREATER_CONSTANT:
+  case OP_LESS_CONSTANT:
+  case OP_GREATER_EQUAL_CONSTANT:
+  case OP_LESS_EQUAL_CONSTANT:
+  case OP_ADD_VARIABLE:
+  case OP_SUBTRACT_VARIABLE:
+  case OP_MULTIPLY_VARIABLE:
+  case OP_DIVIDE_VARIABLE:
+  case OP_GREATER_VARIABLE:
+  case OP_LESS_VARIABLE:
+  case OP_GREATER_EQUAL_VARIABLE:
+  case OP_LESS_EQUAL_VARIABLE:
+  case OP_ADD_CONSTANT_INT:
+  case OP_SUBTRACT_CONSTANT_INT:
+  case OP_MULTIPLY_CONSTANT_INT:
+  case OP_DIVIDE_CONSTANT_INT:
+  case OP_GREATER_CONSTANT_INT:
+  case OP_LESS_CONSTANT_INT:
+  case OP_GREATER_EQUAL_CONSTANT_INT:
+  case OP_LESS_EQUAL_CONSTANT_INT:
+  case OP_ADD_VARIABLE_INT:
+  case OP_SUBTRACT_VARIABLE_INT:
+  case OP_MULTIPLY_VARIABLE_INT:
+  case OP_DIVIDE_VARIABLE_INT:
+  case OP_GREATER_VARIABLE_INT:
+  case OP_LESS_VARIABLE_INT:
+  case OP_GREATER_EQUAL_VARIABLE_INT:
+  case OP_LESS_EQUAL_VARIABLE_INT:
+  case OP_ADD_CONSTANT_DOUBLE:
+  case OP_SUBTRACT_CONSTANT_DOUBLE:
+  case OP_MULTIPLY_CONSTANT_DOUBLE:
+  case OP_DIVIDE_CONSTANT_DOUBLE:
+  case OP_GREATER_CONSTANT_DOUBLE:
+  case OP_LESS_CONSTANT_DOUBLE:
+  case OP_GREATER_EQUAL_CONSTANT_DOUBLE:
+  case OP_LESS_EQUAL_CONSTANT_DOUBLE:
+  case OP_ADD_VARIABLE_DOUBLE:
+  case OP_SUBTRACT_VARIABLE_DOUBLE:
+  case OP_MULTIPLY_VARIABLE_DOUBLE:
+  case OP_DIVIDE_VARIABLE_DOUBLE:
+  case OP_GREATER_VARIABLE_DOUBLE:
+  case OP_LESS_VARIABLE_DOUBLE:
+  case OP_GREATER_EQUAL_VARIABLE_DOUBLE:
+  case OP_LESS_EQUAL_VARIABLE_DOUBLE:
+  case OP_ADD_CONSTANT_NUM:
+  case OP_SUBTRACT_CONSTANT_NUM:
+  case OP_MULTIPLY_CONSTANT_NUM:
+  case OP_DIVIDE_CONSTANT_NUM:
+  case OP_GREATER_CONSTANT_NUM:
+  case OP_LESS_CONSTANT_NUM:
+  case OP_GREATER_EQUAL_CONSTANT_NUM:
+  case OP_LESS_EQUAL_CONSTANT_NUM:
+  case OP_ADD_VARIABLE_NUM:
+  case OP_SUBTRACT_VARIABLE_NUM:
+  case OP_MULTIPLY_VARIABLE_NUM:
+  case OP_DIVIDE_VARIABLE_NUM:
+  case OP_GREATER_VARIABLE_NUM:
+  case OP_LESS_VARIABLE_NUM:
+  case OP_GREATER_EQUAL_VARIABLE_NUM:
+  case OP_LESS_EQUAL_VARIABLE_NUM:
+  case OP_ADD_LOCAL:
+  case OP_SUBTRACT_LOCAL:
+  case OP_MULTIPLY_LOCAL:
+  case OP_DIVIDE_LOCAL:
+  case OP_GREATER_LOCAL:
+  case OP_LESS_LOCAL:
+  case OP_GREATER_EQUAL_LOCAL:
+  case OP_LESS_EQUAL_LOCAL:
+  case OP_ADD_LOCAL_INT:
+  case OP_SUBTRACT_LOCAL_INT:
+  case OP_MULTIPLY_LOCAL_INT:
+  case OP_DIVIDE_LOCAL_INT:
+  case OP_GREATER_LOCAL_INT:
+  case OP_LESS_LOCAL_INT:
+  case OP_GREATER_EQUAL_LOCAL_INT:
+  case OP_LESS_EQUAL_LOCAL_INT:
+  case OP_ADD_LOCAL_DOUBLE:
+  case OP_SUBTRACT_LOCAL_DOUBLE:
+  case OP_MULTIPLY_LOCAL_DOUBLE:
+  case OP_DIVIDE_LOCAL_DOUBLE:
+  case OP_GREATER_LOCAL_DOUBLE:
+  case OP_LESS_LOCAL_DOUBLE:
+  case OP_GREATER_EQUAL_LOCAL_DOUBLE:
+  case OP_LESS_EQUAL_LOCAL_DOUBLE:
+  case OP_ADD_LOCAL_NUM:
+  case OP_SUBTRACT_LOCAL_NUM:
+  case OP_MULTIPLY_LOCAL_NUM:
+  case OP_DIVIDE_LOCAL_NUM:
+  case OP_GREATER_LOCAL_NUM:
+  case OP_LESS_LOCAL_NUM:
+  case OP_GREATER_EQUAL_LOCAL_NUM:
+  case OP_LESS_EQUAL_LOCAL_NUM:
+    *pops = 1;
+    *pushes = 1;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// The generic operator of each group of eight fused and quickened forms.
+static const uint8_t binary_operators[] = {
+    OP_ADD,     OP_SUBTRACT, OP_MULTIPLY,      OP_DIVIDE,
+    OP_GREATER, OP_LESS,     OP_GREATER_EQUAL, OP_LESS_EQUAL,
+};
+
+// Each group of eight fused and quickened forms, by its first instruction.
+static const struct {
+  uint8_t first;
+  Binary_Operand operand;
+  Binary_Form form;
+} binary_groups[] = {
+    {OP_ADD_INT, STACK_OPERAND, INT_FORM},
+    {OP_ADD_DOUBLE, STACK_OPERAND, DOUBLE_FORM},
+    {OP_ADD_NUM, STACK_OPERAND, NUMBER_FORM},
+    {OP_ADD_CONSTANT, CONSTANT_OPERAND, GENERIC_FORM},
+    {OP_ADD_CONSTANT_INT, CONSTANT_OPERAND, INT_FORM},
+    {OP_ADD_CONSTANT_DOUBLE, CONSTANT_OPERAND, DOUBLE_FORM},
+    {OP_ADD_CONSTANT_NUM, CONSTANT_OPERAND, NUMBER_FORM},
+    {OP_ADD_VARIABLE, VARIABLE_OPERAND, GENERIC_FORM},
+    {OP_ADD_VARIABLE_INT, VARIABLE_OPERAND, INT_FORM},
+    {OP_ADD_VARIABLE_DOUBLE, VARIABLE_OPERAND, DOUBLE_FORM},
+    {OP_ADD_VARIABLE_NUM, VARIABLE_OPERAND, NUMBER_FORM},
+    {OP_ADD_LOCAL, LOCAL_OPERAND, GENERIC_FORM},
+    {OP_ADD_LOCAL_INT, LOCAL_OPERAND, INT_FORM},
+    {OP_ADD_LOCAL_DOUBLE, LOCAL_OPERAND, DOUBLE_FORM},
+    {OP_ADD_LOCAL_NUM, LOCAL_OPERAND, NUMBER_FORM},
+};
+
+#define BINARY_GROUPS (sizeof(binary_groups) / sizeof(binary_groups[0]))
+
+// The generic operator, the operand and the operand types of an arithmetic
+// or comparison instruction in any of its fused or quickened forms.
+bool binary_instruction(uint8_t code, uint8_t *op, Binary_Operand *operand,
+                        Binary_Form *form) {
+  for (size_t i = 0; i < sizeof(binary_operators); ++i) {
+    if (code == binary_operators[i]) {
+      *op = code;
+      *operand = STACK_OPERAND;
+      *form = GENERIC_FORM;
+      return true;
+    }
+  }
+  for (size_t i = 0; i < BINARY_GROUPS; ++i) {
+    if (code >= binary_groups[i].first &&
+        code < binary_groups[i].first + sizeof(binary_operators)) {
+      *op = binary_operators[code - binary_groups[i].first];
+      *operand = binary_groups[i].operand;
+      *form = binary_groups[i].form;
+      return true;
+    }
+  }
+  return false;
+}
+
+// The instruction for op with the given operand and operand types; the
+// inverse of binary_instruction().
+uint8_t binary_code(uint8_t op, Binary_Operand operand, Binary_Form form) {
+  if (operand == STACK_OPERAND && form == GENERIC_FORM) {
+    return op;
+  }
+  size_t index = 0;
+  while (binary_operators[index] != op) {
+    ++index;
+  }
+  for (size_t i = 0; i < BINARY_GROUPS; ++i) {
+    if (binary_groups[i].operand == operand && binary_groups[i].form == form) {
+      return (uint8_t)(binary_groups[i].first + index);
+    }
+  }
+  return op;
+}
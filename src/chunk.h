@@ -17,31 +17,207 @@ typedef enum Op_Code {
   OP_GREATER_EQUAL,
   OP_LESS_EQUAL,
   OP_NOT,
+  OP_NOT_EQUAL,
+  OP_TRUTHY,
+
+  OP_DUP,
+  OP_SWAP,
+  OP_DROP,
+  OP_OVER,
+  OP_ROT,
+  OP_PICK,
+  OP_LET,
+  OP_NOMEMO,
 
-  OP_WHILE,
   OP_IF,
+  OP_JUMP,
+  OP_JUMP_IF_FALSE,
+  OP_LOOP,
+  OP_INVOKE,
 
   OP_PUSH_OPERATION,
 
   OP_VARIABLE,
   OP_SET_VARIABLE,
+  OP_GET_LOCAL,
+  OP_SET_LOCAL,
 
   OP_DEFINE_FUNCTION,
   OP_APPLY,
+  OP_TAIL_APPLY,
+  OP_TAIL_INVOKE,
+  OP_INLINE,
+
+  OP_ADD_CONSTANT,
+  OP_SUBTRACT_CONSTANT,
+  OP_MULTIPLY_CONSTANT,
+  OP_DIVIDE_CONSTANT,
+  OP_GREATER_CONSTANT,
+  OP_LESS_CONSTANT,
+  OP_GREATER_EQUAL_CONSTANT,
+  OP_LESS_EQUAL_CONSTANT,
+  OP_ADD_VARIABLE,
+  OP_SUBTRACT_VARIABLE,
+  OP_MULTIPLY_VARIABLE,
+  OP_DIVIDE_VARIABLE,
+  OP_GREATER_VARIABLE,
+  OP_LESS_VARIABLE,
+  OP_GREATER_EQUAL_VARIABLE,
+  OP_LESS_EQUAL_VARIABLE,
+  OP_ADD_LOCAL,
+  OP_SUBTRACT_LOCAL,
+  OP_MULTIPLY_LOCAL,
+  OP_DIVIDE_LOCAL,
+  OP_GREATER_LOCAL,
+  OP_LESS_LOCAL,
+  OP_GREATER_EQUAL_LOCAL,
+  OP_LESS_EQUAL_LOCAL,
+  OP_SET_GLOBAL,
+
+  OP_ADD_INT,
+  OP_SUBTRACT_INT,
+  OP_MULTIPLY_INT,
+  OP_DIVIDE_INT,
+  OP_GREATER_INT,
+  OP_LESS_INT,
+  OP_GREATER_EQUAL_INT,
+  OP_LESS_EQUAL_INT,
+  OP_ADD_CONSTANT_INT,
+  OP_SUBTRACT_CONSTANT_INT,
+  OP_MULTIPLY_CONSTANT_INT,
+  OP_DIVIDE_CONSTANT_INT,
+  OP_GREATER_CONSTANT_INT,
+  OP_LESS_CONSTANT_INT,
+  OP_GREATER_EQUAL_CONSTANT_INT,
+  OP_LESS_EQUAL_CONSTANT_INT,
+  OP_ADD_VARIABLE_INT,
+  OP_SUBTRACT_VARIABLE_INT,
+  OP_MULTIPLY_VARIABLE_INT,
+  OP_DIVIDE_VARIABLE_INT,
+  OP_GREATER_VARIABLE_INT,
+  OP_LESS_VARIABLE_INT,
+  OP_GREATER_EQUAL_VARIABLE_INT,
+  OP_LESS_EQUAL_VARIABLE_INT,
+  OP_ADD_LOCAL_INT,
+  OP_SUBTRACT_LOCAL_INT,
+  OP_MULTIPLY_LOCAL_INT,
+  OP_DIVIDE_LOCAL_INT,
+  OP_GREATER_LOCAL_INT,
+  OP_LESS_LOCAL_INT,
+  OP_GREATER_EQUAL_LOCAL_INT,
+  OP_LESS_EQUAL_LOCAL_INT,
+  OP_ADD_DOUBLE,
+  OP_SUBTRACT_DOUBLE,
+  OP_MULTIPLY_DOUBLE,
+  OP_DIVIDE_DOUBLE,
+  OP_GREATER_DOUBLE,
+  OP_LESS_DOUBLE,
+  OP_GREATER_EQUAL_DOUBLE,
+  OP_LESS_EQUAL_DOUBLE,
+  OP_ADD_CONSTANT_DOUBLE,
+  OP_SUBTRACT_CONSTANT_DOUBLE,
+  OP_MULTIPLY_CONSTANT_DOUBLE,
+  OP_DIVIDE_CONSTANT_DOUBLE,
+  OP_GREATER_CONSTANT_DOUBLE,
+  OP_LESS_CONSTANT_DOUBLE,
+  OP_GREATER_EQUAL_CONSTANT_DOUBLE,
+  OP_LESS_EQUAL_CONSTANT_DOUBLE,
+  OP_ADD_VARIABLE_DOUBLE,
+  OP_SUBTRACT_VARIABLE_DOUBLE,
+  OP_MULTIPLY_VARIABLE_DOUBLE,
+  OP_DIVIDE_VARIABLE_DOUBLE,
+  OP_GREATER_VARIABLE_DOUBLE,
+  OP_LESS_VARIABLE_DOUBLE,
+  OP_GREATER_EQUAL_VARIABLE_DOUBLE,
+  OP_LESS_EQUAL_VARIABLE_DOUBLE,
+  OP_ADD_LOCAL_DOUBLE,
+  OP_SUBTRACT_LOCAL_DOUBLE,
+  OP_MULTIPLY_LOCAL_DOUBLE,
+  OP_DIVIDE_LOCAL_DOUBLE,
+  OP_GREATER_LOCAL_DOUBLE,
+  OP_LESS_LOCAL_DOUBLE,
+  OP_GREATER_EQUAL_LOCAL_DOUBLE,
+  OP_LESS_EQUAL_LOCAL_DOUBLE,
+  OP_ADD_NUM,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_GREATER_NUM,
+  OP_LESS_NUM,
+  OP_GREATER_EQUAL_NUM,
+  OP_LESS_EQUAL_NUM,
+  OP_ADD_CONSTANT_NUM,
+  OP_SUBTRACT_CONSTANT_NUM,
+  OP_MULTIPLY_CONSTANT_NUM,
+  OP_DIVIDE_CONSTANT_NUM,
+  OP_GREATER_CONSTANT_NUM,
+  OP_LESS_CONSTANT_NUM,
+  OP_GREATER_EQUAL_CONSTANT_NUM,
+  OP_LESS_EQUAL_CONSTANT_NUM,
+  OP_ADD_VARIABLE_NUM,
+  OP_SUBTRACT_VARIABLE_NUM,
+  OP_MULTIPLY_VARIABLE_NUM,
+  OP_DIVIDE_VARIABLE_NUM,
+  OP_GREATER_VARIABLE_NUM,
+  OP_LESS_VARIABLE_NUM,
+  OP_GREATER_EQUAL_VARIABLE_NUM,
+  OP_LESS_EQUAL_VARIABLE_NUM,
+  OP_ADD_LOCAL_NUM,
+  OP_SUBTRACT_LOCAL_NUM,
+  OP_MULTIPLY_LOCAL_NUM,
+  OP_DIVIDE_LOCAL_NUM,
+  OP_GREATER_LOCAL_NUM,
+  OP_LESS_LOCAL_NUM,
+  OP_GREATER_EQUAL_LOCAL_NUM,
+  OP_LESS_EQUAL_LOCAL_NUM,
+  OP_ADD_STR,
 
   OP_CONSTANT,
   OP_RETURN
 } Op_Code;
 
+// Where the second operand of a binary instruction comes from.
+typedef enum Binary_Operand {
+  STACK_OPERAND,
+  CONSTANT_OPERAND,
+  VARIABLE_OPERAND,
+  LOCAL_OPERAND
+} Binary_Operand;
+
+// The operand types a quickened binary instruction was specialized for: two
+// ints, two doubles, or an int and a double. The double forms also take an
+// int constant, which converts exactly.
+typedef enum Binary_Form {
+  GENERIC_FORM,
+  INT_FORM,
+  DOUBLE_FORM,
+  NUMBER_FORM
+} Binary_Form;
+
+// A stretch of code entered at start and left at the next instruction whose
+// stack effect is only known at runtime. Filled in by verify_chunk().
+typedef struct Segment {
+  size_t start;
+  size_t consumes;
+  size_t grows;
+} Segment;
+
 typedef struct Chunk {
   size_t count;
   size_t capacity;
   uint8_t *code;
   size_t *lines;
   Value_Array constants;
+  Segment *segments;
+  size_t segment_count;
 } Chunk;
 
 void init_chunk(Chunk *chunk);
 void write_chunk(Chunk *chunk, uint8_t byte, size_t line);
 void free_chunk(Chunk *chunk);
 size_t add_constant(Chunk *chunk, Value value);
+size_t instruction_length(uint8_t instruction);
+bool stack_effect(uint8_t instruction, int *pops, int *pushes);
+bool binary_instruction(uint8_t code, uint8_t *op, Binary_Operand *operand,
+                        Binary_Form *form);
+uint8_t binary_code(uint8_t op, Binary_Operand operand, Binary_Form form);
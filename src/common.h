@@ -7,6 +7,7 @@
 #define NAN_BOXING
 #define DEBUG_PRINT_CODE
 #define _DEBUG_TRACE_EXECUTION
+#define _DEBUG_PROFILE_OPCODES
 
 #define _DEBUG_STRESS_GC
 #define _DEBUG_LOG_GC
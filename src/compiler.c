@@ -4,9 +4,12 @@
 #include "common.h"
 #include "memory.h"
 #include "object.h"
+#include "optimizer.h"
 #include "scanner.h"
 #include "value.h"
+#include "verifier.h"
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
@@ -26,16 +29,41 @@ typedef struct Parser {
   bool panic_mode;
 } Parser;
 
-typedef enum FunctionType { TYPE_SCRIPT } FunctionType;
+typedef enum FunctionType { TYPE_SCRIPT, TYPE_PROCEDURE } FunctionType;
+
+// Where a ':' pushed its nil, and the instruction emitted just before it.
+typedef struct Marker {
+  size_t offset;
+  size_t previous;
+} Marker;
+
+// How deeply inlined procedures may inline others in turn.
+#define INLINE_DEPTH_MAX 16
 
 typedef struct Compiler {
+  struct Compiler *enclosing;
   ObjFunction *function;
   FunctionType type;
-
+  size_t last_instruction;
+  // Code before this offset may be jumped into, so it is never rewritten.
+  size_t barrier;
+  Marker markers[UINT8_COUNT];
+  size_t marker_count;
+  // Procedures being spliced into this one, innermost last, and how many
+  // more values the outermost of them may still pull in.
+  ObjProcedure *inlining[INLINE_DEPTH_MAX];
+  size_t inline_depth;
+  size_t inline_budget;
+  // The globals 'let' rebinds in this procedure, by frame slot. Inlined
+  // bodies only see the ones from local_floor on.
+  uint16_t locals[UINT8_COUNT];
+  size_t local_count;
+  size_t local_floor;
 } Compiler;
 
 Parser parser;
 Compiler *current = NULL;
+int inline_threshold = 12;
 
 static Chunk *current_chunk() { return &current->function->chunk; }
 
@@ -107,14 +135,36 @@ static void emit_byte(uint8_t byte) {
 }
 
 static void emit_bytes(uint8_t byte1, int8_t byte2) {
+  current->last_instruction = current_chunk()->count;
   emit_byte(byte1);
   emit_byte(byte2);
 }
 
-static void emit_return() { emit_byte(OP_RETURN); }
+static void emit_short(uint8_t instruction, uint16_t operand) {
+  current->last_instruction = current_chunk()->count;
+  emit_byte(instruction);
+  emit_byte((operand >> 8) & 0xff);
+  emit_byte(operand & 0xff);
+}
+
+static void emit_op(uint8_t instruction) {
+  if (optimization_level > 0 && current->last_instruction != SIZE_MAX) {
+    uint8_t *previous = &current_chunk()->code[current->last_instruction];
+    uint8_t fused = fused_instruction(*previous, instruction);
+    if (fused != instruction) {
+      *previous = fused;
+      return;
+    }
+  }
+  current->last_instruction = current_chunk()->count;
+  emit_byte(instruction);
+}
+
+static void emit_return() { emit_op(OP_RETURN); }
 
 static uint8_t make_constant(Value value) {
   int constant = add_constant(current_chunk(), value);
+  write_barrier((Obj *)current->function);
   if (constant > UINT8_MAX) {
     error("Too many constants in one chunk.");
     return 0;
@@ -127,6 +177,27 @@ static void emit_constant(Value value) {
   emit_bytes(OP_CONSTANT, make_constant(value));
 }
 
+static size_t emit_jump(uint8_t instruction) {
+  emit_short(instruction, 0xffff);
+  return current_chunk()->count - 2;
+}
+
+// The forward offset ending an instruction, patched by patch_jump().
+static size_t emit_jump_operand() {
+  emit_byte(0xff);
+  emit_byte(0xff);
+  return current_chunk()->count - 2;
+}
+
+static void emit_loop(size_t loop_start) {
+  size_t offset = current_chunk()->count - loop_start + 3;
+  if (offset > UINT16_MAX) {
+    error("Loop body too large.");
+  }
+
+  emit_short(OP_LOOP, (uint16_t)offset);
+}
+
 static void patch_jump(size_t offset) {
   size_t jump = current_chunk()->count - offset - 2;
   if (jump > UINT16_MAX) {
@@ -137,19 +208,67 @@ static void patch_jump(size_t offset) {
   current_chunk()->code[offset + 1] = jump & 0xff;
 }
 
+// Marks the end of the chunk as a jump target: nothing emitted after it may
+// fuse with, or be folded into, the code before it.
+static void mark_jump_target() {
+  current->barrier = current_chunk()->count;
+  current->last_instruction = SIZE_MAX;
+}
+
 static void init_compiler(Compiler *compiler, FunctionType type) {
+  compiler->enclosing = current;
   compiler->function = NULL;
   compiler->type = type;
+  compiler->last_instruction = SIZE_MAX;
+  compiler->barrier = 0;
+  compiler->marker_count = 0;
+  compiler->inline_depth = 0;
+  compiler->inline_budget = 0;
+  compiler->local_count = 0;
+  compiler->local_floor = 0;
   compiler->function = new_function();
   current = compiler;
-  if (type != TYPE_SCRIPT) {
-    current->function->name =
-        copy_string(parser.previous.start, parser.previous.length, false);
+}
+
+static uint16_t read_short(uint8_t *code) {
+  return (uint16_t)(code[0] << 8 | code[1]);
+}
+
+// A procedure applied right before its caller returns, possibly through
+// forward jumps, takes over the caller's frame instead of pushing its own.
+static void mark_tail_calls() {
+  Chunk *chunk = current_chunk();
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    uint8_t *code = &chunk->code[offset];
+    if (*code != OP_APPLY && *code != OP_INVOKE) {
+      continue;
+    }
+    size_t next = offset + instruction_length(*code);
+    while (chunk->code[next] == OP_JUMP) {
+      next += 3 + read_short(&chunk->code[next + 1]);
+    }
+    if (chunk->code[next] == OP_RETURN) {
+      *code = *code == OP_APPLY ? OP_TAIL_APPLY : OP_TAIL_INVOKE;
+    }
   }
 }
 
 static ObjFunction *end_compiler() {
   emit_return();
+  optimize_chunk(current_chunk());
+  // Folding may have added constants.
+  write_barrier((Obj *)current->function);
+  if (current->type == TYPE_PROCEDURE) {
+    mark_tail_calls();
+  }
+  const char *message = verify_chunk(current_chunk());
+  if (message != NULL) {
+    error(message);
+  } else if (current->type == TYPE_SCRIPT &&
+             current_chunk()->segments[0].consumes > 0) {
+    error("Stack underflow.");
+  }
   ObjFunction *function = current->function;
 #ifdef DEBUG_PRINT_CODE
   if (!parser.had_error) {
@@ -162,11 +281,21 @@ static ObjFunction *end_compiler() {
   if (!parser.had_error) {                                                     \
     disassemble_chunk(current_chunk(), "code");                                \
   } */
+  current = current->enclosing;
   return function;
 }
 
-static uint8_t identifier_constant(Token *name) {
-  return make_constant(OBJ_VAL(copy_string(name->start, name->length, false)));
+static uint16_t global_slot(ObjString *name) {
+  size_t slot = resolve_global(name);
+  if (slot > UINT16_MAX) {
+    error("Too many global variables.");
+    return 0;
+  }
+  return (uint16_t)slot;
+}
+
+static uint16_t identifier_slot(Token *name) {
+  return global_slot(copy_string(name->start, name->length, false));
 }
 
 static bool is_function(Token *token) {
@@ -187,49 +316,256 @@ static bool identifiers_equal(Token *a, Token *b) {
 
 static void io() {
   if (match(TOKEN_DOT)) {
-    emit_byte(OP_PRINT);
+    emit_op(OP_PRINT);
   } else if (match(TOKEN_CARROT)) {
-    emit_byte(OP_SCAN);
+    emit_op(OP_SCAN);
   }
 }
 
 static void operator() {
   if (match(TOKEN_PLUS)) {
-    emit_byte(OP_ADD);
+    emit_op(OP_ADD);
   } else if (match(TOKEN_MINUS)) {
-    emit_byte(OP_SUBTRACT);
+    emit_op(OP_SUBTRACT);
   } else if (match(TOKEN_STAR)) {
-    emit_byte(OP_MULTIPLY);
+    emit_op(OP_MULTIPLY);
   } else if (match(TOKEN_SLASH)) {
-    emit_byte(OP_DIVIDE);
+    emit_op(OP_DIVIDE);
   } else if (match(TOKEN_EQUAL_EQUAL)) {
-    emit_byte(OP_EQUAL);
+    emit_op(OP_EQUAL);
   } else if (match(TOKEN_BANG)) {
-    emit_byte(OP_NOT);
+    emit_op(OP_NOT);
   } else if (match(TOKEN_BANG_EQUAL)) {
-    emit_bytes(OP_EQUAL, OP_NOT);
+    emit_op(OP_EQUAL);
+    emit_op(OP_NOT);
   } else if (match(TOKEN_LESS)) {
-    emit_byte(OP_LESS);
+    emit_op(OP_LESS);
   } else if (match(TOKEN_GREATER)) {
-    emit_byte(OP_GREATER);
+    emit_op(OP_GREATER);
   } else if (match(TOKEN_LESS_EQUAL)) {
-    emit_byte(OP_LESS_EQUAL);
+    emit_op(OP_LESS_EQUAL);
   } else if (match(TOKEN_GREATER_EQUAL)) {
-    emit_byte(OP_GREATER_EQUAL);
+    emit_op(OP_GREATER_EQUAL);
   } else if (match(TOKEN_QUESTION)) {
-    emit_bytes(OP_NOT, OP_NOT);
+    emit_op(OP_NOT);
+    emit_op(OP_NOT);
   } else if (match(TOKEN_MOD)) {
-    emit_byte(OP_MOD);
+    emit_op(OP_MOD);
+  }
+}
+
+static void stack_operator() {
+  if (match(TOKEN_DUP)) {
+    emit_op(OP_DUP);
+  } else if (match(TOKEN_SWAP)) {
+    emit_op(OP_SWAP);
+  } else if (match(TOKEN_DROP)) {
+    emit_op(OP_DROP);
+  } else if (match(TOKEN_OVER)) {
+    emit_op(OP_OVER);
+  } else if (match(TOKEN_ROT)) {
+    emit_op(OP_ROT);
+  } else if (match(TOKEN_PICK)) {
+    emit_op(OP_PICK);
+  }
+}
+
+static void if_statement();
+
+static void emit_operation(uint8_t code) {
+  if (code == OP_IF) {
+    if_statement();
+  } else if (code == OP_LET) {
+    error("'let' needs a name right before it.");
+  } else if (code == OP_NOMEMO && current->type == TYPE_PROCEDURE) {
+    // A pragma for the procedure it is written in, not ones it inlines into.
+    if (current->inline_depth == 0) {
+      current->function->no_memo = true;
+    }
+  } else {
+    emit_op(code);
+  }
+}
+
+static bool is_value_instruction(uint8_t instruction) {
+  return instruction == OP_CONSTANT || instruction == OP_VARIABLE ||
+         instruction == OP_PUSH_OPERATION;
+}
+
+static bool is_path(uint8_t *code) {
+  if (code[0] == OP_CONSTANT) {
+    return !IS_PROCEDURE(current_chunk()->constants.value[code[1]]);
+  }
+  return code[0] == OP_VARIABLE || code[0] == OP_PUSH_OPERATION;
+}
+
+// Emits the code that takes whichever path a value-pushing instruction
+// would have handed to 'if': procedures are called, operations are run and
+// everything else is pushed.
+static void emit_path(uint8_t *code) {
+  switch (code[0]) {
+  case OP_CONSTANT: {
+    Value value = current_chunk()->constants.value[code[1]];
+    if (IS_OPERATION(value)) {
+      emit_operation(AS_OPERATION(value)->code);
+    } else {
+      emit_bytes(OP_CONSTANT, code[1]);
+    }
+    break;
+  }
+  case OP_VARIABLE:
+    emit_short(OP_INVOKE, read_short(&code[1]));
+    break;
+  case OP_PUSH_OPERATION:
+    emit_operation(code[1]);
+    break;
+  }
+}
+
+// Replays value-pushing instructions saved from the chunk, running pushed
+// operations instead of pushing them.
+static void emit_unquoted(uint8_t *code, size_t length) {
+  for (size_t i = 0; i < length; i += instruction_length(code[i])) {
+    switch (code[i]) {
+    case OP_CONSTANT:
+      emit_bytes(OP_CONSTANT, code[i + 1]);
+      break;
+    case OP_VARIABLE:
+      emit_short(OP_VARIABLE, read_short(&code[i + 1]));
+      break;
+    case OP_PUSH_OPERATION:
+      emit_operation(code[i + 1]);
+      break;
+    }
+  }
+}
+
+// Finds how many of the last instructions compute the condition of an 'if':
+// the shortest straight-line run that leaves exactly one value without
+// reaching below itself. Returns 0 if there is none.
+static size_t condition_length(size_t *starts, size_t count) {
+  Chunk *chunk = current_chunk();
+  for (size_t length = 1; length <= count && length <= UINT8_COUNT;
+       ++length) {
+    int depth = 0;
+    bool balanced = true;
+    for (size_t i = count - length; i < count; ++i) {
+      int pops;
+      int pushes;
+      if (!stack_effect(chunk->code[starts[i % UINT8_COUNT]], &pops,
+                        &pushes)) {
+        return 0;
+      }
+      if (pops > depth) {
+        balanced = false;
+      }
+      depth += pushes - pops;
+    }
+    if (balanced && depth == 1) {
+      return length;
+    }
   }
+  return 0;
+}
+
+// 'A B cond if' becomes 'cond JUMP_IF_FALSE A JUMP B' when A and B are single
+// pushes and cond is straight-line code leaving one value; anything else is
+// left to the runtime OP_IF.
+static void if_statement() {
+  Chunk *chunk = current_chunk();
+  size_t starts[UINT8_COUNT];
+  size_t count = 0;
+  for (size_t offset = current->barrier; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    starts[count++ % UINT8_COUNT] = offset;
+  }
+  size_t window = count < UINT8_COUNT ? count : UINT8_COUNT;
+  size_t length = window > 2 ? condition_length(starts, count) : 0;
+  if (length == 0 || length + 2 > window) {
+    emit_op(OP_IF);
+    return;
+  }
+
+  size_t a = starts[(count - length - 2) % UINT8_COUNT];
+  size_t b = starts[(count - length - 1) % UINT8_COUNT];
+  size_t condition = starts[(count - length) % UINT8_COUNT];
+  bool marked = current->marker_count > 0 &&
+                current->markers[current->marker_count - 1].offset >= a;
+  if (marked || !is_path(&chunk->code[a]) || !is_path(&chunk->code[b])) {
+    emit_op(OP_IF);
+    return;
+  }
+
+  uint8_t paths[6];
+  memcpy(paths, &chunk->code[a], condition - a);
+  size_t shift = condition - a;
+  memmove(&chunk->code[a], &chunk->code[condition], chunk->count - condition);
+  memmove(&chunk->lines[a], &chunk->lines[condition],
+          (chunk->count - condition) * sizeof(size_t));
+  chunk->count -= shift;
+  current->last_instruction -= shift;
+
+  size_t else_jump = emit_jump(OP_JUMP_IF_FALSE);
+  emit_path(paths);
+  size_t end_jump = emit_jump(OP_JUMP);
+  patch_jump(else_jump);
+  mark_jump_target();
+  emit_path(&paths[b - a]);
+  patch_jump(end_jump);
+  mark_jump_target();
+}
+
+static void while_statement() {
+  if (current->marker_count == 0) {
+    error("'while' needs a ':' before its condition.");
+    return;
+  }
+  Marker marker = current->markers[--current->marker_count];
+  Chunk *chunk = current_chunk();
+  if (marker.previous == SIZE_MAX || marker.previous < current->barrier ||
+      marker.previous + 3 != marker.offset ||
+      chunk->code[marker.previous] != OP_VARIABLE ||
+      chunk->code[marker.offset] != OP_CONSTANT) {
+    error("body of while must be a variable.");
+    return;
+  }
+  uint16_t body = read_short(&chunk->code[marker.previous + 1]);
+
+  // The condition was compiled as the values between ':' and 'while'; they
+  // are now re-run on every iteration instead of captured once.
+  size_t start = marker.offset + 2;
+  size_t length = chunk->count - start;
+  uint8_t condition[UINT8_COUNT];
+  if (length > UINT8_COUNT) {
+    error("while condition too long.");
+    return;
+  }
+  for (size_t i = 0; i < length;
+       i += instruction_length(chunk->code[start + i])) {
+    if (!is_value_instruction(chunk->code[start + i])) {
+      error("while condition may only hold values and '('operators')'.");
+      return;
+    }
+  }
+  memcpy(condition, &chunk->code[start], length);
+  chunk->count = marker.previous;
+
+  mark_jump_target();
+  size_t loop_start = chunk->count;
+  emit_unquoted(condition, length);
+  size_t exit_jump = emit_jump(OP_JUMP_IF_FALSE);
+  emit_short(OP_VARIABLE, body);
+  emit_op(OP_APPLY);
+  emit_loop(loop_start);
+  patch_jump(exit_jump);
+  mark_jump_target();
 }
 
 static void conditional() {
   if (match(TOKEN_IF)) {
-    emit_byte(OP_IF);
+    if_statement();
   } else if (match(TOKEN_WHILE)) {
-    Token token = synthetic_token("while_condition");
-    emit_bytes(OP_DEFINE_FUNCTION, identifier_constant(&token));
-    emit_byte(OP_WHILE);
+    while_statement();
   }
 }
 
@@ -238,43 +574,107 @@ static void parenthesis() {
   if (match(TOKEN_RIGHT_PAREN)) {
     error_at_current("Must have operator before closing ')'.");
   }
+  Op_Code code;
   switch (parser.current.type) {
   case TOKEN_PLUS:
+    code = OP_ADD;
+    break;
   case TOKEN_MINUS:
+    code = OP_SUBTRACT;
+    break;
   case TOKEN_STAR:
+    code = OP_MULTIPLY;
+    break;
   case TOKEN_SLASH:
+    code = OP_DIVIDE;
+    break;
   case TOKEN_EQUAL:
+    code = OP_SET_VARIABLE;
+    break;
   case TOKEN_EQUAL_EQUAL:
+    code = OP_EQUAL;
+    break;
   case TOKEN_LESS:
+    code = OP_LESS;
+    break;
   case TOKEN_GREATER:
+    code = OP_GREATER;
+    break;
   case TOKEN_BANG_EQUAL:
+    code = OP_NOT_EQUAL;
+    break;
   case TOKEN_LESS_EQUAL:
+    code = OP_LESS_EQUAL;
+    break;
   case TOKEN_GREATER_EQUAL:
+    code = OP_GREATER_EQUAL;
+    break;
   case TOKEN_BANG:
+    code = OP_NOT;
+    break;
   case TOKEN_QUESTION:
+    code = OP_TRUTHY;
+    break;
   case TOKEN_COMMA:
+    code = OP_APPLY;
+    break;
   case TOKEN_DOT:
+    code = OP_PRINT;
+    break;
   case TOKEN_CARROT:
+    code = OP_SCAN;
+    break;
   case TOKEN_IF:
+    code = OP_IF;
+    break;
   case TOKEN_MOD:
-    emit_bytes(OP_PUSH_OPERATION, identifier_constant(&parser.current));
-    advance();
+    code = OP_MOD;
+    break;
+  case TOKEN_DUP:
+    code = OP_DUP;
+    break;
+  case TOKEN_SWAP:
+    code = OP_SWAP;
+    break;
+  case TOKEN_DROP:
+    code = OP_DROP;
+    break;
+  case TOKEN_OVER:
+    code = OP_OVER;
+    break;
+  case TOKEN_ROT:
+    code = OP_ROT;
+    break;
+  case TOKEN_PICK:
+    code = OP_PICK;
+    break;
+  case TOKEN_LET:
+    code = OP_LET;
+    break;
+  case TOKEN_NOMEMO:
+    code = OP_NOMEMO;
     break;
   default:
     error_at_current("operator is not allowed in '('_')'.");
-    break;
+    consume(TOKEN_RIGHT_PAREN, "Missing closing ')'.");
+    return;
   }
+  advance();
+  emit_bytes(OP_PUSH_OPERATION, code);
   consume(TOKEN_RIGHT_PAREN, "Missing closing ')'.");
 }
 
 static void variable() {
-  emit_bytes(OP_VARIABLE, identifier_constant(&parser.current));
+  emit_short(OP_VARIABLE, identifier_slot(&parser.current));
   advance();
 }
 
 static void function() {
   advance();
-  emit_bytes(OP_DEFINE_FUNCTION, identifier_constant(&parser.current));
+  if (current->marker_count > 0) {
+    current->marker_count--;
+  }
+  emit_short(OP_DEFINE_FUNCTION, identifier_slot(&parser.current));
   advance();
 }
 
@@ -299,6 +699,14 @@ static void instruction() {
   case TOKEN_QUESTION:
     operator();
     break;
+  case TOKEN_DUP:
+  case TOKEN_SWAP:
+  case TOKEN_DROP:
+  case TOKEN_OVER:
+  case TOKEN_ROT:
+  case TOKEN_PICK:
+    stack_operator();
+    break;
   case TOKEN_LEFT_PAREN:
     parenthesis();
     break;
@@ -308,22 +716,40 @@ static void instruction() {
     emit_constant(NUMBER_VAL(value));
     break;
   }
+  case TOKEN_INTEGER: {
+    advance();
+    // Literals too long for an int are read as doubles.
+    errno = 0;
+    long long value = strtoll(parser.previous.start, NULL, 10);
+    if (errno == 0 && value <= INT_MAX_VALUE) {
+      emit_constant(INT_VAL((int64_t)value));
+    } else {
+      emit_constant(NUMBER_VAL(strtod(parser.previous.start, NULL)));
+    }
+    break;
+  }
   case TOKEN_IDENTIFIER:
     variable();
     break;
   case TOKEN_COLON:
     advance();
+    if (current->marker_count == UINT8_COUNT) {
+      error("Too many nested ':'.");
+      break;
+    }
+    current->markers[current->marker_count++] =
+        (Marker){current_chunk()->count, current->last_instruction};
     emit_constant(NIL_VAL);
     break;
   case TOKEN_EQUAL:
     advance();
-    emit_byte(OP_SET_VARIABLE);
+    emit_op(OP_SET_VARIABLE);
     break;
   case TOKEN_ARROW:
     function();
     break;
   case TOKEN_COMMA:
-    emit_byte(OP_APPLY);
+    emit_op(OP_APPLY);
     advance();
     break;
   case TOKEN_STRING: {
@@ -336,6 +762,14 @@ static void instruction() {
   case TOKEN_WHILE:
     conditional();
     break;
+  case TOKEN_LET:
+    error_at_current("'let' only binds names inside procedure bodies.");
+    advance();
+    break;
+  case TOKEN_NOMEMO:
+    error_at_current("'nomemo' only marks procedure bodies.");
+    advance();
+    break;
 
   default:
     error_at_current("Token not allowed.");
@@ -359,9 +793,160 @@ ObjFunction *compile(const char *source) {
   return parser.had_error ? NULL : function;
 }
 
+static void procedure_values(Value_Array *body);
+
+// Splices in the body of the procedure in slot instead of applying it. The
+// guard in front runs the body only while the slot still holds that
+// procedure; once it is redefined or reassigned, the guard jumps past the
+// copy and applies whatever the slot holds. Returns false, emitting nothing,
+// when the procedure is too big, recursive or not a procedure yet.
+static bool inline_procedure(uint16_t slot) {
+  Value value = vm.global_values.value[slot];
+  if (optimization_level < 1 || !IS_PROCEDURE(value)) {
+    return false;
+  }
+  ObjProcedure *procedure = AS_PROCEDURE(value);
+  if (current->inline_depth == 0) {
+    current->inline_budget =
+        inline_threshold > 0 ? (size_t)inline_threshold : 0;
+  }
+  if (procedure->closure == NULL ||
+      procedure->stack.count > current->inline_budget ||
+      current->inline_depth == INLINE_DEPTH_MAX ||
+      procedure->name == current->function->name) {
+    return false;
+  }
+  for (size_t i = 0; i < current->inline_depth; ++i) {
+    if (current->inlining[i] == procedure) {
+      return false;
+    }
+  }
+
+  uint8_t callee = make_constant(value);
+  emit_byte(OP_INLINE);
+  emit_byte((slot >> 8) & 0xff);
+  emit_byte(slot & 0xff);
+  emit_byte(callee);
+  size_t skip = emit_jump_operand();
+  mark_jump_target();
+  current->inlining[current->inline_depth++] = procedure;
+  current->inline_budget -= procedure->stack.count;
+  size_t local_count = current->local_count;
+  size_t local_floor = current->local_floor;
+  current->local_floor = local_count;
+  procedure_values(&procedure->stack);
+  current->local_count = local_count;
+  current->local_floor = local_floor;
+  current->inline_depth--;
+  patch_jump(skip);
+  mark_jump_target();
+  return true;
+}
+
+static void procedure_value(Value value) {
+  if (IS_OPERATION(value)) {
+    emit_operation(AS_OPERATION(value)->code);
+  } else {
+    emit_constant(value);
+  }
+}
+
+static int resolve_local(uint16_t global) {
+  for (size_t i = current->local_count; i > current->local_floor; --i) {
+    if (current->locals[i - 1] == global) {
+      return (int)(i - 1);
+    }
+  }
+  return -1;
+}
+
+static uint8_t declare_local(uint16_t global) {
+  int local = resolve_local(global);
+  if (local >= 0) {
+    return (uint8_t)local;
+  }
+  if (current->local_count == UINT8_COUNT) {
+    error("Too many local variables in one procedure.");
+    return 0;
+  }
+  current->locals[current->local_count++] = global;
+  if (current->local_count > current->function->local_count) {
+    current->function->local_count = current->local_count;
+  }
+  return (uint8_t)(current->local_count - 1);
+}
+
+// Compiles a name in a procedure body together with the operation right
+// after it, if that is OP_LET, OP_SET_VARIABLE or OP_APPLY and applies to
+// the name. Returns whether it took the operation. 'value name (let)' binds
+// a frame slot that later reads and assignments of the name in the body use
+// instead of the global.
+static bool procedure_name(uint16_t global, uint8_t next) {
+  if (next == OP_LET) {
+    emit_bytes(OP_SET_LOCAL, declare_local(global));
+    return true;
+  }
+  int local = resolve_local(global);
+  if (local >= 0 && next == OP_SET_VARIABLE) {
+    emit_bytes(OP_SET_LOCAL, (uint8_t)local);
+    return true;
+  }
+  if (local >= 0) {
+    emit_bytes(OP_GET_LOCAL, (uint8_t)local);
+    return false;
+  }
+  if (next == OP_APPLY && inline_procedure(global)) {
+    return true;
+  }
+  emit_short(OP_VARIABLE, global);
+  return false;
+}
+
+// The body was captured top of stack first, so replay it in push order.
+static void procedure_values(Value_Array *body) {
+  Token token = parser.previous;
+  for (size_t i = body->count; i > 0; --i) {
+    parser.previous = token;
+    Value value = body->value[i - 1];
+    if (!IS_VARIABLE(value)) {
+      procedure_value(value);
+      continue;
+    }
+    Value next = i > 1 ? body->value[i - 2] : NIL_VAL;
+    uint8_t code = IS_OPERATION(next) ? AS_OPERATION(next)->code : OP_RETURN;
+    if (procedure_name((uint16_t)AS_VARIABLE(value), code)) {
+      i--;
+    }
+  }
+  parser.previous = token;
+}
+
+ObjFunction *compile_procedure(ObjString *name, Value_Array *body,
+                               size_t line) {
+  Parser enclosing_parser = parser;
+  Compiler compiler;
+  init_compiler(&compiler, TYPE_PROCEDURE);
+  current->function->name = name;
+  write_barrier((Obj *)current->function);
+
+  Token token = synthetic_token(name->chars);
+  token.type = TOKEN_IDENTIFIER;
+  token.line = line;
+  parser.had_error = false;
+  parser.panic_mode = false;
+  parser.previous = token;
+  procedure_values(body);
+  ObjFunction *function = end_compiler();
+
+  bool had_error = parser.had_error;
+  parser = enclosing_parser;
+  return had_error ? NULL : function;
+}
+
 void mark_compiler_roots() {
   Compiler *compiler = current;
-  if (compiler != NULL) {
+  while (compiler != NULL) {
     mark_object((Obj *)compiler->function);
+    compiler = compiler->enclosing;
   }
 }
@@ -4,5 +4,12 @@
 #include "object.h"
 #include "vm.h"
 
+// Procedures applied by name from another procedure's body are inlined when
+// their own bodies hold at most this many values; 0, like -O0, turns
+// inlining off.
+extern int inline_threshold;
+
 ObjFunction *compile(const char *source);
+ObjFunction *compile_procedure(ObjString *name, Value_Array *body,
+                               size_t line);
 void mark_compiler_roots();
@@ -3,9 +3,11 @@
 #include "chunk.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 void disassemble_chunk(Chunk *chunk, const char *name) {
   printf("== %s ==\n", name);
@@ -29,7 +31,7 @@ static size_t jump_instruction(const char *name, int sign, Chunk *chunk,
                                size_t offset) {
   uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
   jump |= chunk->code[offset + 2];
-  printf("%-16s %4zu -> %zu", name, offset, offset + 3 + sign * jump);
+  printf("%-16s %4zu -> %zu\n", name, offset, offset + 3 + sign * jump);
   return offset + 3;
 }
 
@@ -42,6 +44,39 @@ static size_t constant_instruction(const char *name, Chunk *chunk,
   return offset + 2;
 }
 
+static size_t operation_instruction(const char *name, Chunk *chunk,
+                                    size_t offset) {
+  uint8_t code = chunk->code[offset + 1];
+  printf("%-16s %4d '", name, code);
+  if (vm.operations[code] != NULL) {
+    print_value(OBJ_VAL(vm.operations[code]));
+  }
+  printf("'\n");
+  return offset + 2;
+}
+
+static size_t global_instruction(const char *name, Chunk *chunk,
+                                 size_t offset) {
+  uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+  slot |= chunk->code[offset + 2];
+  printf("%-16s %4d '", name, slot);
+  print_value(vm.global_names.value[slot]);
+  printf("'\n");
+  return offset + 3;
+}
+
+static size_t inline_instruction(const char *name, Chunk *chunk,
+                                 size_t offset) {
+  uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+  slot |= chunk->code[offset + 2];
+  uint16_t jump = (uint16_t)(chunk->code[offset + 4] << 8);
+  jump |= chunk->code[offset + 5];
+  printf("%-16s %4d '", name, slot);
+  print_value(vm.global_names.value[slot]);
+  printf("' -> %zu\n", offset + 6 + jump);
+  return offset + 6;
+}
+
 static size_t invoke_instruction(const char *name, Chunk *chunk,
                                  size_t offset) {
   uint8_t constant = chunk->code[offset + 1];
@@ -77,16 +112,26 @@ size_t disassemble_instruction(Chunk *chunk, size_t offset) {
     return simple_instruction("OP_SCAN", offset);
   case OP_APPLY:
     return simple_instruction("OP_APPLY", offset);
+  case OP_TAIL_APPLY:
+    return simple_instruction("OP_TAIL_APPLY", offset);
+  case OP_TAIL_INVOKE:
+    return global_instruction("OP_TAIL_INVOKE", chunk, offset);
+  case OP_INLINE:
+    return inline_instruction("OP_INLINE", chunk, offset);
   case OP_RETURN:
     return simple_instruction("OP_RETURN", offset);
   case OP_PUSH_OPERATION:
-    return constant_instruction("OP_PUSH_OPERATION", chunk, offset);
+    return operation_instruction("OP_PUSH_OPERATION", chunk, offset);
   case OP_VARIABLE:
-    return constant_instruction("OP_VARIABLE", chunk, offset);
+    return global_instruction("OP_VARIABLE", chunk, offset);
   case OP_SET_VARIABLE:
     return simple_instruction("OP_SET_VARIABLE", offset);
+  case OP_GET_LOCAL:
+    return byte_instruction("OP_GET_LOCAL", chunk, offset);
+  case OP_SET_LOCAL:
+    return byte_instruction("OP_SET_LOCAL", chunk, offset);
   case OP_DEFINE_FUNCTION:
-    return constant_instruction("OP_DEFINE_FUNCTION", chunk, offset);
+    return global_instruction("OP_DEFINE_FUNCTION", chunk, offset);
   case OP_EQUAL:
     return simple_instruction("OP_EQUAL", offset);
   case OP_GREATER:
@@ -99,14 +144,723 @@ size_t disassemble_instruction(Chunk *chunk, size_t offset) {
     return simple_instruction("OP_LESS_EQUAL", offset);
   case OP_NOT:
     return simple_instruction("OP_NOT", offset);
-  case OP_WHILE:
-    return simple_instruction("OP_WHILE", offset);
+  case OP_NOT_EQUAL:
+    return simple_instruction("OP_NOT_EQUAL", offset);
+  case OP_TRUTHY:
+    return simple_instruction("OP_TRUTHY", offset);
+  case OP_DUP:
+    return simple_instruction("OP_DUP", offset);
+  case OP_SWAP:
+    return simple_instruction("OP_SWAP", offset);
+  case OP_DROP:
+    return simple_instruction("OP_DROP", offset);
+  case OP_OVER:
+    return simple_instruction("OP_OVER", offset);
+  case OP_ROT:
+    return simple_instruction("OP_ROT", offset);
+  case OP_PICK:
+    return simple_instruction("OP_PICK", offset);
+  case OP_LET:
+    return simple_instruction("OP_LET", offset);
+  case OP_NOMEMO:
+    return simple_instruction("OP_NOMEMO", offset);
   case OP_IF:
     return simple_instruction("OP_IF", offset);
+  case OP_JUMP:
+    return jump_instruction("OP_JUMP", 1, chunk, offset);
+  case OP_JUMP_IF_FALSE:
+    return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+  case OP_LOOP:
+    return jump_instruction("OP_LOOP", -1, chunk, offset);
+  case OP_INVOKE:
+    return global_instruction("OP_INVOKE", chunk, offset);
   case OP_MOD:
     return simple_instruction("OP_MOD", offset);
+  case OP_ADD_CONSTANT:
+    return constant_instruction("OP_ADD_CONSTANT", chunk, offset);
+  case OP_SUBTRACT_CONSTANT:
+    return constant_instruction("OP_SUBTRACT_CONSTANT", chunk, offset);
+  case OP_MULTIPLY_CONSTANT:
+    return constant_instruction("OP_MULTIPLY_CONSTANT", chunk, offset);
+  case OP_DIVIDE_CONSTANT:
+    return constant_instruction("OP_DIVIDE_CONSTANT", chunk, offset);
+  case OP_GREATER_CONSTANT:
+    return constant_instruction("OP_GREATER_CONSTANT", chunk, offset);
+  case OP_LESS_CONSTANT:
+    return constant_instruction("OP_LESS_CONSTANT", chunk, offset);
+  case OP_GREATER_EQUAL_CONSTANT:
+    return constant_instruction("OP_GREATER_EQUAL_CONSTANT", chunk, offset);
+  case OP_LESS_EQUAL_CONSTANT:
+    return constant_instruction("OP_LESS_EQUAL_CONSTANT", chunk, offset);
+  case OP_ADD_VARIABLE:
+    return global_instruction("OP_ADD_VARIABLE", chunk, offset);
+  case OP_SUBTRACT_VARIABLE:
+    return global_instruction("OP_SUBTRACT_VARIABLE", chunk, offset);
+  case OP_MULTIPLY_VARIABLE:
+    return global_instruction("OP_MULTIPLY_VARIABLE", chunk, offset);
+  case OP_DIVIDE_VARIABLE:
+    return global_instruction("OP_DIVIDE_VARIABLE", chunk, offset);
+  case OP_GREATER_VARIABLE:
+    return global_instruction("OP_GREATER_VARIABLE", chunk, offset);
+  case OP_LESS_VARIABLE:
+    return global_instruction("OP_LESS_VARIABLE", chunk, offset);
+  case OP_GREATER_EQUAL_VARIABLE:
+    return global_instruction("OP_GREATER_EQUAL_VARIABLE", chunk, offset);
+  case OP_LESS_EQUAL_VARIABLE:
+    return global_instruction("OP_LESS_EQUAL_VARIABLE", chunk, offset);
+  case OP_ADD_LOCAL:
+    return byte_instruction("OP_ADD_LOCAL", chunk, offset);
+  case OP_SUBTRACT_LOCAL:
+    return byte_instruction("OP_SUBTRACT_LOCAL", chunk, offset);
+  case OP_MULTIPLY_LOCAL:
+    return byte_instruction("OP_MULTIPLY_LOCAL", chunk, offset);
+  case OP_DIVIDE_LOCAL:
+    return byte_instruction("OP_DIVIDE_LOCAL", chunk, offset);
+  case OP_GREATER_LOCAL:
+    return byte_instruction("OP_GREATER_LOCAL", chunk, offset);
+  case OP_LESS_LOCAL:
+    return byte_instruction("OP_LESS_LOCAL", chunk, offset);
+  case OP_GREATER_EQUAL_LOCAL:
+    return byte_instruction("OP_GREATER_EQUAL_LOCAL", chunk, offset);
+  case OP_LESS_EQUAL_LOCAL:
+    return byte_instruction("OP_LESS_EQUAL_LOCAL", chunk, offset);
+  case OP_SET_GLOBAL:
+    return global_instruction("OP_SET_GLOBAL", chunk, offset);
+  case OP_ADD_INT:
+    return simple_instruction("OP_ADD_INT", offset);
+  case OP_SUBTRACT_INT:
+    return simple_instruction("OP_SUBTRACT_INT", offset);
+  case OP_MULTIPLY_INT:
+    return simple_instruction("OP_MULTIPLY_INT", offset);
+  case OP_DIVIDE_INT:
+    return simple_instruction("OP_DIVIDE_INT", offset);
+  case OP_GREATER_INT:
+    return simple_instruction("OP_GREATER_INT", offset);
+  case OP_LESS_INT:
+    return simple_instruction("OP_LESS_INT", offset);
+  case OP_GREATER_EQUAL_INT:
+    return simple_instruction("OP_GREATER_EQUAL_INT", offset);
+  case OP_LESS_EQUAL_INT:
+    return simple_instruction("OP_LESS_EQUAL_INT", offset);
+  case OP_ADD_CONSTANT_INT:
+    return constant_instruction("OP_ADD_CONSTANT_INT", chunk, offset);
+  case OP_SUBTRACT_CONSTANT_INT:
+    return constant_instruction("OP_SUBTRACT_CONSTANT_INT", chunk, offset);
+  case OP_MULTIPLY_CONSTANT_INT:
+    return constant_instruction("OP_MULTIPLY_CONSTANT_INT", chunk, offset);
+  case OP_DIVIDE_CONSTANT_INT:
+    return constant_instruction("OP_DIVIDE_CONSTANT_INT", chunk, offset);
+  case OP_GREATER_CONSTANT_INT:
+    return constant_instruction("OP_GREATER_CONSTANT_INT", chunk, offset);
+  case OP_LESS_CONSTANT_INT:
+    return constant_instruction("OP_LESS_CONSTANT_INT", chunk, offset);
+  case OP_GREATER_EQUAL_CONSTANT_INT:
+    return constant_instruction("OP_GREATER_EQUAL_CONSTANT_INT", chunk, offset);
+  case OP_LESS_EQUAL_CONSTANT_INT:
+    return constant_instruction("OP_LESS_EQUAL_CONSTANT_INT", chunk, offset);
+  case OP_ADD_VARIABLE_INT:
+    return global_instruction("OP_ADD_VARIABLE_INT", chunk, offset);
+  case OP_SUBTRACT_VARIABLE_INT:
+    return global_instruction("OP_SUBTRACT_VARIABLE_INT", chunk, offset);
+  case OP_MULTIPLY_VARIABLE_INT:
+    return global_instruction("OP_MULTIPLY_VARIABLE_INT", chunk, offset);
+  case OP_DIVIDE_VARIABLE_INT:
+    return global_instruction("OP_DIVIDE_VARIABLE_INT", chunk, offset);
+  case OP_GREATER_VARIABLE_INT:
+    return global_instruction("OP_GREATER_VARIABLE_INT", chunk, offset);
+  case OP_LESS_VARIABLE_INT:
+    return global_instruction("OP_LESS_VARIABLE_INT", chunk, offset);
+  case OP_GREATER_EQUAL_VARIABLE_INT:
+    return global_instruction("OP_GREATER_EQUAL_VARIABLE_INT", chunk, offset);
+  case OP_LESS_EQUAL_VARIABLE_INT:
+    return global_instruction("OP_LESS_EQUAL_VARIABLE_INT", chunk, offset);
+  case OP_ADD_LOCAL_INT:
+    return byte_instruction("OP_ADD_LOCAL_INT", chunk, offset);
+  case OP_SUBTRACT_LOCAL_INT:
+    return byte_instruction("OP_SUBTRACT_LOCAL_INT", chunk, offset);
+  case OP_MULTIPLY_LOCAL_INT:
+    return byte_instruction("OP_MULTIPLY_LOCAL_INT", chunk, offset);
+  case OP_DIVIDE_LOCAL_INT:
+    return byte_instruction("OP_DIVIDE_LOCAL_INT", chunk, offset);
+  case OP_GREATER_LOCAL_INT:
+    return byte_instruction("OP_GREATER_LOCAL_INT", chunk, offset);
+  case OP_LESS_LOCAL_INT:
+    return byte_instruction("OP_LESS_LOCAL_INT", chunk, offset);
+  case OP_GREATER_EQUAL_LOCAL_INT:
+    return byte_instruction("OP_GREATER_EQUAL_LOCAL_INT", chunk, offset);
+  case OP_LESS_EQUAL_LOCAL_INT:
+    return byte_instruction("OP_LESS_EQUAL_LOCAL_INT", chunk, offset);
+  case OP_ADD_DOUBLE:
+    return simple_instruction("OP_ADD_DOUBLE", offset);
+  case OP_SUBTRACT_DOUBLE:
+    return simple_instruction("OP_SUBTRACT_DOUBLE", offset);
+  case OP_MULTIPLY_DOUBLE:
+    return simple_instruction("OP_MULTIPLY_DOUBLE", offset);
+  case OP_DIVIDE_DOUBLE:
+    return simple_instruction("OP_DIVIDE_DOUBLE", offset);
+  case OP_GREATER_DOUBLE:
+    return simple_instruction("OP_GREATER_DOUBLE", offset);
+  case OP_LESS_DOUBLE:
+    return simple_instruction("OP_LESS_DOUBLE", offset);
+  case OP_GREATER_EQUAL_DOUBLE:
+    return simple_instruction("OP_GREATER_EQUAL_DOUBLE", offset);
+  case OP_LESS_EQUAL_DOUBLE:
+    return simple_instruction("OP_LESS_EQUAL_DOUBLE", offset);
+  case OP_ADD_CONSTANT_DOUBLE:
+    return constant_instruction("OP_ADD_CONSTANT_DOUBLE", chunk, offset);
+  case OP_SUBTRACT_CONSTANT_DOUBLE:
+    return constant_instruction("OP_SUBTRACT_CONSTANT_DOUBLE", chunk, offset);
+  case OP_MULTIPLY_CONSTANT_DOUBLE:
+    return constant_instruction("OP_MULTIPLY_CONSTANT_DOUBLE", chunk, offset);
+  case OP_DIVIDE_CONSTANT_DOUBLE:
+    return constant_instruction("OP_DIVIDE_CONSTANT_DOUBLE", chunk, offset);
+  case OP_GREATER_CONSTANT_DOUBLE:
+    return constant_instruction("OP_GREATER_CONSTANT_DOUBLE", chunk, offset);
+  case OP_LESS_CONSTANT_DOUBLE:
+    return constant_instruction("OP_LESS_CONSTANT_DOUBLE", chunk, offset);
+  case OP_GREATER_EQUAL_CONSTANT_DOUBLE:
+    return constant_instruction("OP_GREATER_EQUAL_CONSTANT_DOUBLE", chunk,
+                                offset);
+  case OP_LESS_EQUAL_CONSTANT_DOUBLE:
+    return constant_instruction("OP_LESS_EQUAL_CONSTANT_DOUBLE", chunk, offset);
+  case OP_ADD_VARIABLE_DOUBLE:
+    return global_instruction("OP_ADD_VARIABLE_DOUBLE", chunk, offset);
+  case OP_SUBTRACT_VARIABLE_DOUBLE:
+    return global_instruction("OP_SUBTRACT_VARIABLE_DOUBLE", chunk, offset);
+  case OP_MULTIPLY_VARIABLE_DOUBLE:
+    return global_instruction("OP_MULTIPLY_VARIABLE_DOUBLE", chunk, offset);
+  case OP_DIVIDE_VARIABLE_DOUBLE:
+    return global_instruction("OP_DIVIDE_VARIABLE_DOUBLE", chunk, offset);
+  case OP_GREATER_VARIABLE_DOUBLE:
+    return global_instruction("OP_GREATER_VARIABLE_DOUBLE", chunk, offset);
+  case OP_LESS_VARIABLE_DOUBLE:
+    return global_instruction("OP_LESS_VARIABLE_DOUBLE", chunk, offset);
+  case OP_GREATER_EQUAL_VARIABLE_DOUBLE:
+    return global_instruction("OP_GREATER_EQUAL_VARIABLE_DOUBLE", chunk,
+                              offset);
+  case OP_LESS_EQUAL_VARIABLE_DOUBLE:
+    return global_instruction("OP_LESS_EQUAL_VARIABLE_DOUBLE", chunk, offset);
+  case OP_ADD_LOCAL_DOUBLE:
+    return byte_instruction("OP_ADD_LOCAL_DOUBLE", chunk, offset);
+  case OP_SUBTRACT_LOCAL_DOUBLE:
+    return byte_instruction("OP_SUBTRACT_LOCAL_DOUBLE", chunk, offset);
+  case OP_MULTIPLY_LOCAL_DOUBLE:
+    return byte_instruction("OP_MULTIPLY_LOCAL_DOUBLE", chunk, offset);
+  case OP_DIVIDE_LOCAL_DOUBLE:
+    return byte_instruction("OP_DIVIDE_LOCAL_DOUBLE", chunk, offset);
+  case OP_GREATER_LOCAL_DOUBLE:
+    return byte_instruction("OP_GREATER_LOCAL_DOUBLE", chunk, offset);
+  case OP_LESS_LOCAL_DOUBLE:
+    return byte_instruction("OP_LESS_LOCAL_DOUBLE", chunk, offset);
+  case OP_GREATER_EQUAL_LOCAL_DOUBLE:
+    return byte_instruction("OP_GREATER_EQUAL_LOCAL_DOUBLE", chunk, offset);
+  case OP_LESS_EQUAL_LOCAL_DOUBLE:
+    return byte_instruction("OP_LESS_EQUAL_LOCAL_DOUBLE", chunk, offset);
+  case OP_ADD_NUM:
+    return simple_instruction("OP_ADD_NUM", offset);
+  case OP_SUBTRACT_NUM:
+    return simple_instruction("OP_SUBTRACT_NUM", offset);
+  case OP_MULTIPLY_NUM:
+    return simple_instruction("OP_MULTIPLY_NUM", offset);
+  case OP_DIVIDE_NUM:
+    return simple_instruction("OP_DIVIDE_NUM", offset);
+  case OP_GREATER_NUM:
+    return simple_instruction("OP_GREATER_NUM", offset);
+  case OP_LESS_NUM:
+    return simple_instruction("OP_LESS_NUM", offset);
+  case OP_GREATER_EQUAL_NUM:
+    return simple_instruction("OP_GREATER_EQUAL_NUM", offset);
+  case OP_LESS_EQUAL_NUM:
+    return simple_instruction("OP_LESS_EQUAL_NUM", offset);
+  case OP_ADD_CONSTANT_NUM:
+    return constant_instruction("OP_ADD_CONSTANT_NUM", chunk, offset);
+  case OP_SUBTRACT_CONSTANT_NUM:
+    return constant_instruction("OP_SUBTRACT_CONSTANT_NUM", chunk, offset);
+  case OP_MULTIPLY_CONSTANT_NUM:
+    return constant_instruction("OP_MULTIPLY_CONSTANT_NUM", chunk, offset);
+  case OP_DIVIDE_CONSTANT_NUM:
+    return constant_instruction("OP_DIVIDE_CONSTANT_NUM", chunk, offset);
+  case OP_GREATER_CONSTANT_NUM:
+    return constant_instruction("OP_GREATER_CONSTANT_NUM", chunk, offset);
+  case OP_LESS_CONSTANT_NUM:
+    return constant_instruction("OP_LESS_CONSTANT_NUM", chunk, offset);
+  case OP_GREATER_EQUAL_CONSTANT_NUM:
+    return constant_instruction("OP_GREATER_EQUAL_CONSTANT_NUM", chunk, offset);
+  case OP_LESS_EQUAL_CONSTANT_NUM:
+    return constant_instruction("OP_LESS_EQUAL_CONSTANT_NUM", chunk, offset);
+  case OP_ADD_VARIABLE_NUM:
+    return global_instruction("OP_ADD_VARIABLE_NUM", chunk, offset);
+  case OP_SUBTRACT_VARIABLE_NUM:
+    return global_instruction("OP_SUBTRACT_VARIABLE_NUM", chunk, offset);
+  case OP_MULTIPLY_VARIABLE_NUM:
+    return global_instruction("OP_MULTIPLY_VARIABLE_NUM", chunk, offset);
+  case OP_DIVIDE_VARIABLE_NUM:
+    return global_instruction("OP_DIVIDE_VARIABLE_NUM", chunk, offset);
+  case OP_GREATER_VARIABLE_NUM:
+    return global_instruction("OP_GREATER_VARIABLE_NUM", chunk, offset);
+  case OP_LESS_VARIABLE_NUM:
+    return global_instruction("OP_LESS_VARIABLE_NUM", chunk, offset);
+  case OP_GREATER_EQUAL_VARIABLE_NUM:
+    return global_instruction("OP_GREATER_EQUAL_VARIABLE_NUM", chunk, offset);
+  case OP_LESS_EQUAL_VARIABLE_NUM:
+    return global_instruction("OP_LESS_EQUAL_VARIABLE_NUM", chunk, offset);
+  case OP_ADD_LOCAL_NUM:
+    return byte_instruction("OP_ADD_LOCAL_NUM", chunk, offset);
+  case OP_SUBTRACT_LOCAL_NUM:
+    return byte_instruction("OP_SUBTRACT_LOCAL_NUM", chunk, offset);
+  case OP_MULTIPLY_LOCAL_NUM:
+    return byte_instruction("OP_MULTIPLY_LOCAL_NUM", chunk, offset);
+  case OP_DIVIDE_LOCAL_NUM:
+    return byte_instruction("OP_DIVIDE_LOCAL_NUM", chunk, offset);
+  case OP_GREATER_LOCAL_NUM:
+    return byte_instruction("OP_GREATER_LOCAL_NUM", chunk, offset);
+  case OP_LESS_LOCAL_NUM:
+    return byte_instruction("OP_LESS_LOCAL_NUM", chunk, offset);
+  case OP_GREATER_EQUAL_LOCAL_NUM:
+    return byte_instruction("OP_GREATER_EQUAL_LOCAL_NUM", chunk, offset);
+  case OP_LESS_EQUAL_LOCAL_NUM:
+    return byte_instruction("OP_LESS_EQUAL_LOCAL_NUM", chunk, offset);
+  case OP_ADD_STR:
+    return simple_instruction("OP_ADD_STR", offset);
   default:
     printf("Unkown opcode %d\n", chunk->code[offset]);
     return offset - 1;
   }
 }
+
+#ifdef DEBUG_PROFILE_OPCODES
+#define PROFILE_TRIGRAMS 4096
+
+typedef struct Ngram {
+  uint32_t key;
+  uint64_t count;
+} Ngram;
+
+static uint64_t unigrams[UINT8_COUNT];
+static uint64_t bigrams[UINT8_COUNT * UINT8_COUNT];
+static Ngram trigrams[PROFILE_TRIGRAMS];
+static size_t trigram_count = 0;
+static uint64_t dropped_trigrams = 0;
+static uint32_t history = 0;
+static size_t history_length = 0;
+
+static const char *opcode_name(uint8_t instruction) {
+  switch (instruction) {
+  case OP_PRINT:
+    return "OP_PRINT";
+  case OP_SCAN:
+    return "OP_SCAN";
+  case OP_ADD:
+    return "OP_ADD";
+  case OP_SUBTRACT:
+    return "OP_SUBTRACT";
+  case OP_MULTIPLY:
+    return "OP_MULTIPLY";
+  case OP_DIVIDE:
+    return "OP_DIVIDE";
+  case OP_MOD:
+    return "OP_MOD";
+  case OP_EQUAL:
+    return "OP_EQUAL";
+  case OP_GREATER:
+    return "OP_GREATER";
+  case OP_LESS:
+    return "OP_LESS";
+  case OP_GREATER_EQUAL:
+    return "OP_GREATER_EQUAL";
+  case OP_LESS_EQUAL:
+    return "OP_LESS_EQUAL";
+  case OP_NOT:
+    return "OP_NOT";
+  case OP_NOT_EQUAL:
+    return "OP_NOT_EQUAL";
+  case OP_TRUTHY:
+    return "OP_TRUTHY";
+  case OP_DUP:
+    return "OP_DUP";
+  case OP_SWAP:
+    return "OP_SWAP";
+  case OP_DROP:
+    return "OP_DROP";
+  case OP_OVER:
+    return "OP_OVER";
+  case OP_ROT:
+    return "OP_ROT";
+  case OP_PICK:
+    return "OP_PICK";
+  case OP_LET:
+    return "OP_LET";
+  case OP_NOMEMO:
+    return "OP_NOMEMO";
+  case OP_IF:
+    return "OP_IF";
+  case OP_JUMP:
+    return "OP_JUMP";
+  case OP_JUMP_IF_FALSE:
+    return "OP_JUMP_IF_FALSE";
+  case OP_LOOP:
+    return "OP_LOOP";
+  case OP_INVOKE:
+    return "OP_INVOKE";
+  case OP_PUSH_OPERATION:
+    return "OP_PUSH_OPERATION";
+  case OP_VARIABLE:
+    return "OP_VARIABLE";
+  case OP_GET_LOCAL:
+    return "OP_GET_LOCAL";
+  case OP_SET_LOCAL:
+    return "OP_SET_LOCAL";
+  case OP_SET_VARIABLE:
+    return "OP_SET_VARIABLE";
+  case OP_DEFINE_FUNCTION:
+    return "OP_DEFINE_FUNCTION";
+  case OP_APPLY:
+    return "OP_APPLY";
+  case OP_TAIL_APPLY:
+    return "OP_TAIL_APPLY";
+  case OP_TAIL_INVOKE:
+    return "OP_TAIL_INVOKE";
+  case OP_INLINE:
+    return "OP_INLINE";
+  case OP_CONSTANT:
+    return "OP_CONSTANT";
+  case OP_ADD_CONSTANT:
+    return "OP_ADD_CONSTANT";
+  case OP_SUBTRACT_CONSTANT:
+    return "OP_SUBTRACT_CONSTANT";
+  case OP_MULTIPLY_CONSTANT:
+    return "OP_MULTIPLY_CONSTANT";
+  case OP_DIVIDE_CONSTANT:
+    return "OP_DIVIDE_CONSTANT";
+  case OP_GREATER_CONSTANT:
+    return "OP_GREATER_CONSTANT";
+  case OP_LESS_CONSTANT:
+    return "OP_LESS_CONSTANT";
+  case OP_GREATER_EQUAL_CONSTANT:
+    return "OP_GREATER_EQUAL_CONSTANT";
+  case OP_LESS_EQUAL_CONSTANT:
+    return "OP_LESS_EQUAL_CONSTANT";
+  case OP_ADD_VARIABLE:
+    return "OP_ADD_VARIABLE";
+  case OP_SUBTRACT_VARIABLE:
+    return "OP_SUBTRACT_VARIABLE";
+  case OP_MULTIPLY_VARIABLE:
+    return "OP_MULTIPLY_VARIABLE";
+  case OP_DIVIDE_VARIABLE:
+    return "OP_DIVIDE_VARIABLE";
+  case OP_GREATER_VARIABLE:
+    return "OP_GREATER_VARIABLE";
+  case OP_LESS_VARIABLE:
+    return "OP_LESS_VARIABLE";
+  case OP_GREATER_EQUAL_VARIABLE:
+    return "OP_GREATER_EQUAL_VARIABLE";
+  case OP_LESS_EQUAL_VARIABLE:
+    return "OP_LESS_EQUAL_VARIABLE";
+  case OP_ADD_LOCAL:
+    return "OP_ADD_LOCAL";
+  case OP_SUBTRACT_LOCAL:
+    return "OP_SUBTRACT_LOCAL";
+  case OP_MULTIPLY_LOCAL:
+    return "OP_MULTIPLY_LOCAL";
+  case OP_DIVIDE_LOCAL:
+    return "OP_DIVIDE_LOCAL";
+  case OP_GREATER_LOCAL:
+    return "OP_GREATER_LOCAL";
+  case OP_LESS_LOCAL:
+    return "OP_LESS_LOCAL";
+  case OP_GREATER_EQUAL_LOCAL:
+    return "OP_GREATER_EQUAL_LOCAL";
+  case OP_LESS_EQUAL_LOCAL:
+    return "OP_LESS_EQUAL_LOCAL";
+  case OP_SET_GLOBAL:
+    return "OP_SET_GLOBAL";
+  case OP_ADD_INT:
+    return "OP_ADD_INT";
+  case OP_SUBTRACT_INT:
+    return "OP_SUBTRACT_INT";
+  case OP_MULTIPLY_INT:
+    return "OP_MULTIPLY_INT";
+  case OP_DIVIDE_INT:
+    return "OP_DIVIDE_INT";
+  case OP_GREATER_INT:
+    return "OP_GREATER_INT";
+  case OP_LESS_INT:
+    return "OP_LESS_INT";
+  case OP_GREATER_EQUAL_INT:
+    return "OP_GREATER_EQUAL_INT";
+  case OP_LESS_EQUAL_INT:
+    return "OP_LESS_EQUAL_INT";
+  case OP_ADD_CONSTANT_INT:
+    return "OP_ADD_CONSTANT_INT";
+  case OP_SUBTRACT_CONSTANT_INT:
+    return "OP_SUBTRACT_CONSTANT_INT";
+  case OP_MULTIPLY_CONSTANT_INT:
+    return "OP_MULTIPLY_CONSTANT_INT";
+  case OP_DIVIDE_CONSTANT_INT:
+    return "OP_DIVIDE_CONSTANT_INT";
+  case OP_GREATER_CONSTANT_INT:
+    return "OP_GREATER_CONSTANT_INT";
+  case OP_LESS_CONSTANT_INT:
+    return "OP_LESS_CONSTANT_INT";
+  case OP_GREATER_EQUAL_CONSTANT_INT:
+    return "OP_GREATER_EQUAL_CONSTANT_INT";
+  case OP_LESS_EQUAL_CONSTANT_INT:
+    return "OP_LESS_EQUAL_CONSTANT_INT";
+  case OP_ADD_VARIABLE_INT:
+    return "OP_ADD_VARIABLE_INT";
+  case OP_SUBTRACT_VARIABLE_INT:
+    return "OP_SUBTRACT_VARIABLE_INT";
+  case OP_MULTIPLY_VARIABLE_INT:
+    return "OP_MULTIPLY_VARIABLE_INT";
+  case OP_DIVIDE_VARIABLE_INT:
+    return "OP_DIVIDE_VARIABLE_INT";
+  case OP_GREATER_VARIABLE_INT:
+    return "OP_GREATER_VARIABLE_INT";
+  case OP_LESS_VARIABLE_INT:
+    return "OP_LESS_VARIABLE_INT";
+  case OP_GREATER_EQUAL_VARIABLE_INT:
+    return "OP_GREATER_EQUAL_VARIABLE_INT";
+  case OP_LESS_EQUAL_VARIABLE_INT:
+    return "OP_LESS_EQUAL_VARIABLE_INT";
+  case OP_ADD_LOCAL_INT:
+    return "OP_ADD_LOCAL_INT";
+  case OP_SUBTRACT_LOCAL_INT:
+    return "OP_SUBTRACT_LOCAL_INT";
+  case OP_MULTIPLY_LOCAL_INT:
+    return "OP_MULTIPLY_LOCAL_INT";
+  case OP_DIVIDE_LOCAL_INT:
+    return "OP_DIVIDE_LOCAL_INT";
+  case OP_GREATER_LOCAL_INT:
+    return "OP_GREATER_LOCAL_INT";
+  case OP_LESS_LOCAL_INT:
+    return "OP_LESS_LOCAL_INT";
+  case OP_GREATER_EQUAL_LOCAL_INT:
+    return "OP_GREATER_EQUAL_LOCAL_INT";
+  case OP_LESS_EQUAL_LOCAL_INT:
+    return "OP_LESS_EQUAL_LOCAL_INT";
+  case OP_ADD_DOUBLE:
+    return "OP_ADD_DOUBLE";
+  case OP_SUBTRACT_DOUBLE:
+    return "OP_SUBTRACT_DOUBLE";
+  case OP_MULTIPLY_DOUBLE:
+    return "OP_MULTIPLY_DOUBLE";
+  case OP_DIVIDE_DOUBLE:
+    return "OP_DIVIDE_DOUBLE";
+  case OP_GREATER_DOUBLE:
+    return "OP_GREATER_DOUBLE";
+  case OP_LESS_DOUBLE:
+    return "OP_LESS_DOUBLE";
+  case OP_GREATER_EQUAL_DOUBLE:
+    return "OP_GREATER_EQUAL_DOUBLE";
+  case OP_LESS_EQUAL_DOUBLE:
+    return "OP_LESS_EQUAL_DOUBLE";
+  case OP_ADD_CONSTANT_DOUBLE:
+    return "OP_ADD_CONSTANT_DOUBLE";
+  case OP_SUBTRACT_CONSTANT_DOUBLE:
+    return "OP_SUBTRACT_CONSTANT_DOUBLE";
+  case OP_MULTIPLY_CONSTANT_DOUBLE:
+    return "OP_MULTIPLY_CONSTANT_DOUBLE";
+  case OP_DIVIDE_CONSTANT_DOUBLE:
+    return "OP_DIVIDE_CONSTANT_DOUBLE";
+  case OP_GREATER_CONSTANT_DOUBLE:
+    return "OP_GREATER_CONSTANT_DOUBLE";
+  case OP_LESS_CONSTANT_DOUBLE:
+    return "OP_LESS_CONSTANT_DOUBLE";
+  case OP_GREATER_EQUAL_CONSTANT_DOUBLE:
+    return "OP_GREATER_EQUAL_CONSTANT_DOUBLE";
+  case OP_LESS_EQUAL_CONSTANT_DOUBLE:
+    return "OP_LESS_EQUAL_CONSTANT_DOUBLE";
+  case OP_ADD_VARIABLE_DOUBLE:
+    return "OP_ADD_VARIABLE_DOUBLE";
+  case OP_SUBTRACT_VARIABLE_DOUBLE:
+    return "OP_SUBTRACT_VARIABLE_DOUBLE";
+  case OP_MULTIPLY_VARIABLE_DOUBLE:
+    return "OP_MULTIPLY_VARIABLE_DOUBLE";
+  case OP_DIVIDE_VARIABLE_DOUBLE:
+    return "OP_DIVIDE_VARIABLE_DOUBLE";
+  case OP_GREATER_VARIABLE_DOUBLE:
+    return "OP_GREATER_VARIABLE_DOUBLE";
+  case OP_LESS_VARIABLE_DOUBLE:
+    return "OP_LESS_VARIABLE_DOUBLE";
+  case OP_GREATER_EQUAL_VARIABLE_DOUBLE:
+    return "OP_GREATER_EQUAL_VARIABLE_DOUBLE";
+  case OP_LESS_EQUAL_VARIABLE_DOUBLE:
+    return "OP_LESS_EQUAL_VARIABLE_DOUBLE";
+  case OP_ADD_LOCAL_DOUBLE:
+    return "OP_ADD_LOCAL_DOUBLE";
+  case OP_SUBTRACT_LOCAL_DOUBLE:
+    return "OP_SUBTRACT_LOCAL_DOUBLE";
+  case OP_MULTIPLY_LOCAL_DOUBLE:
+    return "OP_MULTIPLY_LOCAL_DOUBLE";
+  case OP_DIVIDE_LOCAL_DOUBLE:
+    return "OP_DIVIDE_LOCAL_DOUBLE";
+  case OP_GREATER_LOCAL_DOUBLE:
+    return "OP_GREATER_LOCAL_DOUBLE";
+  case OP_LESS_LOCAL_DOUBLE:
+    return "OP_LESS_LOCAL_DOUBLE";
+  case OP_GREATER_EQUAL_LOCAL_DOUBLE:
+    return "OP_GREATER_EQUAL_LOCAL_DOUBLE";
+  case OP_LESS_EQUAL_LOCAL_DOUBLE:
+    return "OP_LESS_EQUAL_LOCAL_DOUBLE";
+  case OP_ADD_NUM:
+    return "OP_ADD_NUM";
+  case OP_SUBTRACT_NUM:
+    return "OP_SUBTRACT_NUM";
+  case OP_MULTIPLY_NUM:
+    return "OP_MULTIPLY_NUM";
+  case OP_DIVIDE_NUM:
+    return "OP_DIVIDE_NUM";
+  case OP_GREATER_NUM:
+    return "OP_GREATER_NUM";
+  case OP_LESS_NUM:
+    return "OP_LESS_NUM";
+  case OP_GREATER_EQUAL_NUM:
+    return "OP_GREATER_EQUAL_NUM";
+  case OP_LESS_EQUAL_NUM:
+    return "OP_LESS_EQUAL_NUM";
+  case OP_ADD_CONSTANT_NUM:
+    return "OP_ADD_CONSTANT_NUM";
+  case OP_SUBTRACT_CONSTANT_NUM:
+    return "OP_SUBTRACT_CONSTANT_NUM";
+  case OP_MULTIPLY_CONSTANT_NUM:
+    return "OP_MULTIPLY_CONSTANT_NUM";
+  case OP_DIVIDE_CONSTANT_NUM:
+    return "OP_DIVIDE_CONSTANT_NUM";
+  case OP_GREATER_CONSTANT_NUM:
+    return "OP_GREATER_CONSTANT_NUM";
+  case OP_LESS_CONSTANT_NUM:
+    return "OP_LESS_CONSTANT_NUM";
+  case OP_GREATER_EQUAL_CONSTANT_NUM:
+    return "OP_GREATER_EQUAL_CONSTANT_NUM";
+  case OP_LESS_EQUAL_CONSTANT_NUM:
+    return "OP_LESS_EQUAL_CONSTANT_NUM";
+  case OP_ADD_VARIABLE_NUM:
+    return "OP_ADD_VARIABLE_NUM";
+  case OP_SUBTRACT_VARIABLE_NUM:
+    return "OP_SUBTRACT_VARIABLE_NUM";
+  case OP_MULTIPLY_VARIABLE_NUM:
+    return "OP_MULTIPLY_VARIABLE_NUM";
+  case OP_DIVIDE_VARIABLE_NUM:
+    return "OP_DIVIDE_VARIABLE_NUM";
+  case OP_GREATER_VARIABLE_NUM:
+    return "OP_GREATER_VARIABLE_NUM";
+  case OP_LESS_VARIABLE_NUM:
+    return "OP_LESS_VARIABLE_NUM";
+  case OP_GREATER_EQUAL_VARIABLE_NUM:
+    return "OP_GREATER_EQUAL_VARIABLE_NUM";
+  case OP_LESS_EQUAL_VARIABLE_NUM:
+    return "OP_LESS_EQUAL_VARIABLE_NUM";
+  case OP_ADD_LOCAL_NUM:
+    return "OP_ADD_LOCAL_NUM";
+  case OP_SUBTRACT_LOCAL_NUM:
+    return "OP_SUBTRACT_LOCAL_NUM";
+  case OP_MULTIPLY_LOCAL_NUM:
+    return "OP_MULTIPLY_LOCAL_NUM";
+  case OP_DIVIDE_LOCAL_NUM:
+    return "OP_DIVIDE_LOCAL_NUM";
+  case OP_GREATER_LOCAL_NUM:
+    return "OP_GREATER_LOCAL_NUM";
+  case OP_LESS_LOCAL_NUM:
+    return "OP_LESS_LOCAL_NUM";
+  case OP_GREATER_EQUAL_LOCAL_NUM:
+    return "OP_GREATER_EQUAL_LOCAL_NUM";
+  case OP_LESS_EQUAL_LOCAL_NUM:
+    return "OP_LESS_EQUAL_LOCAL_NUM";
+  case OP_ADD_STR:
+    return "OP_ADD_STR";
+  case OP_RETURN:
+    return "OP_RETURN";
+  default:
+    return "OP_UNKNOWN";
+  }
+}
+
+void profile_instruction(uint8_t instruction) {
+  history = ((history << 8) | instruction) & 0xffffff;
+  if (history_length < 3) {
+    history_length++;
+  }
+  unigrams[instruction]++;
+  if (history_length >= 2) {
+    bigrams[history & 0xffff]++;
+  }
+  if (history_length == 3) {
+    uint32_t index = (history * 2654435761u) % PROFILE_TRIGRAMS;
+    while (trigrams[index].count != 0 && trigrams[index].key != history) {
+      index = (index + 1) % PROFILE_TRIGRAMS;
+    }
+    if (trigrams[index].count == 0) {
+      // New trigrams stop at three quarters full, which keeps an empty slot
+      // at the end of every probe; the rest are only counted as dropped.
+      if (trigram_count == PROFILE_TRIGRAMS / 4 * 3) {
+        dropped_trigrams++;
+        return;
+      }
+      trigram_count++;
+      trigrams[index].key = history;
+    }
+    trigrams[index].count++;
+  }
+}
+
+static int compare_ngrams(const void *a, const void *b) {
+  uint64_t count_a = ((const Ngram *)a)->count;
+  uint64_t count_b = ((const Ngram *)b)->count;
+  return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+static void print_ngrams(const char *title, Ngram *ngrams, size_t count,
+                         size_t length, uint64_t total) {
+  qsort(ngrams, count, sizeof(Ngram), compare_ngrams);
+  fprintf(stderr, "== %s ==\n", title);
+  for (size_t i = 0; i < count; ++i) {
+    fprintf(stderr, "%12llu %6.2f%%", (unsigned long long)ngrams[i].count,
+            100.0 * (double)ngrams[i].count / (double)total);
+    for (size_t j = length; j > 0; --j) {
+      fprintf(stderr, " %s",
+              opcode_name((uint8_t)(ngrams[i].key >> (8 * (j - 1)))));
+    }
+    fprintf(stderr, "\n");
+  }
+}
+
+// Dumps every observed n-gram as "count percent OP..." lines on stderr so
+// runs over a corpus can be summed with ordinary text tools.
+void print_profile() {
+  Ngram *ngrams = malloc(sizeof(Ngram) * UINT8_COUNT * UINT8_COUNT);
+  if (ngrams == NULL) {
+    exit(1);
+  }
+  uint64_t total = 0;
+  size_t count = 0;
+  for (size_t i = 0; i < UINT8_COUNT; ++i) {
+    if (unigrams[i] != 0) {
+      ngrams[count++] = (Ngram){(uint32_t)i, unigrams[i]};
+      total += unigrams[i];
+    }
+  }
+  print_ngrams("opcodes", ngrams, count, 1, total);
+
+  count = 0;
+  for (size_t i = 0; i < UINT8_COUNT * UINT8_COUNT; ++i) {
+    if (bigrams[i] != 0) {
+      ngrams[count++] = (Ngram){(uint32_t)i, bigrams[i]};
+    }
+  }
+  print_ngrams("bigrams", ngrams, count, 2, total);
+
+  count = 0;
+  for (size_t i = 0; i < PROFILE_TRIGRAMS; ++i) {
+    if (trigrams[i].count != 0) {
+      ngrams[count++] = trigrams[i];
+    }
+  }
+  print_ngrams("trigrams", ngrams, count, 3, total);
+  if (dropped_trigrams != 0) {
+    fprintf(stderr, "%12llu %6.2f%% (dropped, table full)\n",
+            (unsigned long long)dropped_trigrams,
+            100.0 * (double)dropped_trigrams / (double)total);
+  }
+  free(ngrams);
+}
+#endif /* ifdef DEBUG_PROFILE_OPCODES */
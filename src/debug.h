@@ -4,3 +4,8 @@
 
 void disassemble_chunk(Chunk *chunk, const char *name);
 size_t disassemble_instruction(Chunk *chunk, size_t offset);
+
+#ifdef DEBUG_PROFILE_OPCODES
+void profile_instruction(uint8_t instruction);
+void print_profile();
+#endif /* ifdef DEBUG_PROFILE_OPCODES */
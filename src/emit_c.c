@@ -0,0 +1,336 @@
+#include "emit_c.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "value.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// A procedure body is known statically when everything between its ':' and
+// its '=>' is a plain push. Those bodies are compiled here exactly as
+// define_function() will compile them, and the generated program checks the
+// bytecode before it uses the C version. The procedure is defined too, so the
+// ones after it inline it the way they will at run time.
+static void define_static(ObjProcedure *functions, Chunk *chunk,
+                          Value_Array *pushes, size_t offset, uint16_t slot) {
+  size_t marker = pushes->count;
+  while (marker > 0 && !IS_NIL(pushes->value[marker - 1])) {
+    marker--;
+  }
+  if (marker == 0) {
+    return;
+  }
+  Value_Array body;
+  init_value_array(&body);
+  for (size_t i = pushes->count; i > marker; --i) {
+    write_value_array(&body, pushes->value[i - 1]);
+  }
+  ObjString *name = AS_STRING(vm.global_names.value[slot]);
+  ObjFunction *function =
+      compile_procedure(name, &body, chunk->lines[offset + 1]);
+  if (function == NULL) {
+    free_value_array(&body);
+    return;
+  }
+  push(OBJ_VAL(function));
+  write_value_array(&functions->stack, OBJ_VAL(function));
+  write_barrier((Obj *)functions);
+  ObjProcedure *procedure = new_procedure();
+  procedure->name = name;
+  procedure->stack = body;
+  vm.global_values.value[slot] = OBJ_VAL(procedure);
+  procedure->closure = new_closure(function);
+  write_barrier((Obj *)procedure);
+  pop();
+}
+
+static void collect_procedures(ObjProcedure *functions,
+                               ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  Value_Array pushes;
+  init_value_array(&pushes);
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    uint8_t code = chunk->code[offset];
+    uint16_t operand = chunk->code[offset + 1];
+    if (instruction_length(code) == 3) {
+      operand = (uint16_t)(operand << 8 | chunk->code[offset + 2]);
+    }
+    switch (code) {
+    case OP_CONSTANT:
+      write_value_array(&pushes, chunk->constants.value[operand]);
+      break;
+    case OP_VARIABLE:
+      write_value_array(&pushes, VARIABLE_VAL(operand));
+      break;
+    case OP_PUSH_OPERATION:
+      write_value_array(&pushes, OBJ_VAL(vm.operations[operand]));
+      break;
+    case OP_DEFINE_FUNCTION:
+      define_static(functions, chunk, &pushes, offset, operand);
+      pushes.count = 0;
+      break;
+    default:
+      pushes.count = 0;
+      break;
+    }
+  }
+  free_value_array(&pushes);
+}
+
+static void emit_string(FILE *out, const char *chars) {
+  fputc('"', out);
+  for (const char *c = chars; *c != '\0'; ++c) {
+    switch (*c) {
+    case '"':
+      fputs("\\\"", out);
+      break;
+    case '\\':
+      fputs("\\\\", out);
+      break;
+    case '\n':
+      // Keep the source readable: one literal per line.
+      fputs(c[1] == '\0' ? "\\n" : "\\n\"\n    \"", out);
+      break;
+    default:
+      if ((unsigned char)*c < ' ' || (unsigned char)*c >= 0x7f) {
+        fprintf(out, "\\%03o", (unsigned char)*c);
+      } else {
+        fputc(*c, out);
+      }
+      break;
+    }
+  }
+  fputc('"', out);
+}
+
+static const char *c_operator(uint8_t op) {
+  switch (op) {
+  case OP_ADD:
+    return "add_numbers";
+  case OP_SUBTRACT:
+    return "subtract_numbers";
+  case OP_MULTIPLY:
+    return "multiply_numbers";
+  case OP_DIVIDE:
+    return "divide_numbers";
+  case OP_GREATER:
+    return "greater_numbers";
+  case OP_LESS:
+    return "less_numbers";
+  case OP_GREATER_EQUAL:
+    return "greater_equal_numbers";
+  default:
+    return "less_equal_numbers";
+  }
+}
+
+static void emit_instruction(FILE *out, Chunk *chunk, size_t offset) {
+  uint8_t code = chunk->code[offset];
+  size_t length = instruction_length(code);
+  uint16_t operand = length > 1 ? chunk->code[offset + 1] : 0;
+  if (length >= 3) {
+    operand = (uint16_t)(operand << 8 | chunk->code[offset + 2]);
+  }
+  uint8_t op;
+  Binary_Operand kind;
+  Binary_Form form;
+  if (binary_instruction(code, &op, &kind, &form)) {
+    switch (kind) {
+    case STACK_OPERAND:
+      fprintf(out, "  AOT_BINARY(%zu, %s);\n", offset, c_operator(op));
+      break;
+    case CONSTANT_OPERAND:
+      fprintf(out, "  AOT_BINARY_WITH(%zu, %s, constants[%u]);\n", offset,
+              c_operator(op), operand);
+      break;
+    case VARIABLE_OPERAND:
+      fprintf(out,
+              "  AOT_BINARY_WITH(%zu, %s, vm.global_values.value[%u]);\n",
+              offset, c_operator(op), operand);
+      break;
+    case LOCAL_OPERAND:
+      fprintf(out, "  AOT_BINARY_WITH(%zu, %s, slots[%u]);\n", offset,
+              c_operator(op), operand);
+      break;
+    }
+    return;
+  }
+  switch (code) {
+  case OP_CONSTANT:
+    fprintf(out, "  AOT_PUSH(constants[%u]);\n", operand);
+    break;
+  case OP_VARIABLE:
+    fprintf(out, "  AOT_PUSH(VARIABLE_VAL(%u));\n", operand);
+    break;
+  case OP_PUSH_OPERATION:
+    fprintf(out, "  AOT_PUSH(OBJ_VAL(vm.operations[%u]));\n", operand);
+    break;
+  case OP_SET_GLOBAL:
+    fprintf(out, "  AOT_SET_GLOBAL(%u);\n", operand);
+    break;
+  case OP_GET_LOCAL:
+    fprintf(out, "  AOT_PUSH(slots[%u]);\n", operand);
+    break;
+  case OP_SET_LOCAL:
+    fprintf(out, "  AOT_SET_LOCAL(%u);\n", operand);
+    break;
+  case OP_SET_VARIABLE:
+    fprintf(out, "  AOT_SET_VARIABLE(%zu);\n", offset);
+    break;
+  case OP_EQUAL:
+  case OP_NOT_EQUAL:
+    fprintf(out, "  AOT_EQUAL(%s);\n",
+            code == OP_NOT_EQUAL ? "true" : "false");
+    break;
+  case OP_TRUTHY:
+  case OP_NOT:
+    fprintf(out, "  AOT_TRUTHY(%s);\n", code == OP_NOT ? "true" : "false");
+    break;
+  case OP_INLINE:
+    fprintf(out, "  AOT_INLINE(%zu, %u, constants[%u]);\n", offset, operand,
+            chunk->code[offset + 3]);
+    break;
+  case OP_PRINT:
+    fprintf(out, "  AOT_PRINT();\n");
+    break;
+  case OP_DUP:
+    fprintf(out, "  AOT_DUP();\n");
+    break;
+  case OP_SWAP:
+    fprintf(out, "  AOT_SWAP();\n");
+    break;
+  case OP_DROP:
+    fprintf(out, "  AOT_DROP();\n");
+    break;
+  case OP_OVER:
+    fprintf(out, "  AOT_OVER();\n");
+    break;
+  case OP_ROT:
+    fprintf(out, "  AOT_ROT();\n");
+    break;
+  case OP_JUMP:
+    fprintf(out, "  goto L%zu;\n", offset + 3 + operand);
+    break;
+  case OP_LOOP:
+    fprintf(out, "  goto L%zu;\n", offset + 3 - operand);
+    break;
+  case OP_JUMP_IF_FALSE:
+    fprintf(out, "  if (aot_falsey(aot_value(*--sp))) {\n");
+    fprintf(out, "    goto L%zu;\n", offset + 3 + operand);
+    fprintf(out, "  }\n");
+    break;
+  default:
+    // Calls, returns, definitions and the rest go back to the interpreter.
+    fprintf(out, "  AOT_EXIT(%zu);\n", offset);
+    break;
+  }
+}
+
+// Returns false when it runs out of memory.
+static bool emit_function(FILE *out, size_t index, ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  fprintf(out, "\nstatic const uint8_t code_%zu[] = {", index);
+  for (size_t i = 0; i < chunk->count; ++i) {
+    fprintf(out, "%s%u,", i % 12 == 0 ? "\n    " : " ", chunk->code[i]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  // Frames enter at segment starts; jumps need labels of their own.
+  bool *labelled = calloc(chunk->count + 1, sizeof(bool));
+  if (labelled == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < chunk->segment_count; ++i) {
+    labelled[chunk->segments[i].start] = true;
+  }
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    uint8_t code = chunk->code[offset];
+    if (code == OP_JUMP || code == OP_JUMP_IF_FALSE || code == OP_LOOP) {
+      uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8 |
+                                 chunk->code[offset + 2]);
+      labelled[code == OP_LOOP ? offset + 3 - jump : offset + 3 + jump] = true;
+    }
+  }
+
+  fprintf(out, "static uint8_t *chunk_%zu(ObjFunction *function, "
+               "uint8_t *ip) {\n", index);
+  fprintf(out, "  Value *constants = function->chunk.constants.value;\n");
+  fprintf(out, "  uint8_t *code = function->chunk.code;\n");
+  fprintf(out, "  Value *sp = vm.stack_top;\n");
+  fprintf(out, "  Value *slots = vm.frames[vm.frame_count - 1].slots;\n");
+  fprintf(out, "  (void)constants;\n");
+  fprintf(out, "  (void)slots;\n");
+  fprintf(out, "  switch (ip - code) {\n");
+  for (size_t i = 0; i < chunk->segment_count; ++i) {
+    size_t start = chunk->segments[i].start;
+    fprintf(out, "  case %zu:\n    goto L%zu;\n", start, start);
+  }
+  fprintf(out, "  default:\n    return ip;\n  }\n");
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    if (labelled[offset]) {
+      fprintf(out, "L%zu:\n", offset);
+    }
+    emit_instruction(out, chunk, offset);
+  }
+  fprintf(out, "}\n");
+  free(labelled);
+  return true;
+}
+
+bool emit_c(const char *source, const char *path, FILE *out) {
+  ObjFunction *script = compile(source);
+  if (script == NULL) {
+    return false;
+  }
+  // Everything compiled here stays reachable through one procedure's stack.
+  push(OBJ_VAL(script));
+  ObjProcedure *functions = new_procedure();
+  push(OBJ_VAL(functions));
+  write_value_array(&functions->stack, OBJ_VAL(script));
+  for (size_t i = 0; i < functions->stack.count; ++i) {
+    collect_procedures(functions, AS_FUNCTION(functions->stack.value[i]));
+  }
+
+  fprintf(out, "// Generated by `vast --emit-c` from %s. Do not edit.\n",
+          path);
+  fprintf(out, "#include \"aot.h\"\n\nstatic const char source[] =\n    ");
+  emit_string(out, source);
+  fprintf(out, ";\n");
+  for (size_t i = 0; i < functions->stack.count; ++i) {
+    if (!emit_function(out, i, AS_FUNCTION(functions->stack.value[i]))) {
+      fprintf(stderr, "vast: out of memory emitting C.\n");
+      pop();
+      pop();
+      return false;
+    }
+  }
+  fprintf(out, "\nstatic const AotChunk chunks[] = {\n");
+  for (size_t i = 0; i < functions->stack.count; ++i) {
+    ObjFunction *function = AS_FUNCTION(functions->stack.value[i]);
+    fprintf(out, "    {");
+    if (function->name == NULL) {
+      fprintf(out, "NULL");
+    } else {
+      emit_string(out, function->name->chars);
+    }
+    fprintf(out, ", code_%zu, sizeof(code_%zu), chunk_%zu},\n", i, i, i);
+  }
+  fprintf(out, "};\n\n");
+  fprintf(out, "int main(void) {\n");
+  fprintf(out, "  return aot_main(source, %d, %d, chunks,\n",
+          optimization_level, inline_threshold);
+  fprintf(out, "                  sizeof(chunks) / sizeof(chunks[0]));\n");
+  fprintf(out, "}\n");
+
+  pop();
+  pop();
+  return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "common.h"
+#include <stdio.h>
+
+// Translates a script, and every procedure whose body is spelled out in it,
+// into a C program that links against the vast runtime. path only goes into
+// the header comment. Returns false on a compile error.
+bool emit_c(const char *source, const char *path, FILE *out);
@@ -0,0 +1,759 @@
+#include "jit.h"
+
+bool jit_enabled = true;
+
+#ifdef JIT
+#include "chunk.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Native code keeps the stack top in rbx, the global slots in r12 and the
+// frame's locals in rsi, with the NaN-boxing masks in r13-r15. Every
+// instruction starts and ends with the whole stack in memory, so the code can
+// be entered at any instruction and leaves through an exit stub that hands
+// the interpreter the bytecode address to carry on from. Anything it does not
+// handle, including a guard that fails, exits before the instruction changes
+// anything.
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+
+#define EMIT(assembler, ...)                                                   \
+  emit_bytes(assembler, (const uint8_t[]){__VA_ARGS__},                        \
+             sizeof((const uint8_t[]){__VA_ARGS__}))
+
+typedef uint8_t *(*NativeCode)(uint8_t *entry, Value *slots);
+
+struct JitCode {
+  uint8_t *code;
+  size_t size;
+  // Where the code for each bytecode offset starts, or 0 when entering there
+  // would only exit again.
+  uint32_t *entries;
+};
+
+typedef struct Fixup {
+  size_t at;
+  size_t target;
+} Fixup;
+
+typedef struct Fixups {
+  Fixup *fixup;
+  size_t count;
+  size_t capacity;
+} Fixups;
+
+typedef struct Assembler {
+  Chunk *chunk;
+  uint8_t *code;
+  size_t count;
+  size_t capacity;
+  size_t epilogue;
+  size_t *native;
+  Fixups jumps;
+  Fixups exits;
+} Assembler;
+
+static void emit_bytes(Assembler *assembler, const uint8_t *bytes,
+                       size_t count) {
+  if (assembler->count + count > assembler->capacity) {
+    while (assembler->count + count > assembler->capacity) {
+      assembler->capacity = GROW_CAPACITY(assembler->capacity);
+    }
+    assembler->code = realloc(assembler->code, assembler->capacity);
+    if (assembler->code == NULL) {
+      exit(1);
+    }
+  }
+  memcpy(assembler->code + assembler->count, bytes, count);
+  assembler->count += count;
+}
+
+static void emit_u32(Assembler *assembler, uint32_t value) {
+  emit_bytes(assembler, (const uint8_t *)&value, sizeof(value));
+}
+
+static void emit_u64(Assembler *assembler, uint64_t value) {
+  emit_bytes(assembler, (const uint8_t *)&value, sizeof(value));
+}
+
+// movabs reg, value
+static void emit_load(Assembler *assembler, int reg, uint64_t value) {
+  EMIT(assembler, 0x48, 0xb8 + reg);
+  emit_u64(assembler, value);
+}
+
+static void add_fixup(Fixups *fixups, size_t at, size_t target) {
+  if (fixups->count == fixups->capacity) {
+    fixups->capacity = GROW_CAPACITY(fixups->capacity);
+    fixups->fixup = realloc(fixups->fixup, sizeof(Fixup) * fixups->capacity);
+    if (fixups->fixup == NULL) {
+      exit(1);
+    }
+  }
+  fixups->fixup[fixups->count++] = (Fixup){at, target};
+}
+
+// jmp, or jcc with condition code cc, to a rel32 patched in later.
+static void emit_branch(Assembler *assembler, Fixups *fixups, int cc,
+                        size_t target) {
+  if (cc < 0) {
+    EMIT(assembler, 0xe9);
+  } else {
+    EMIT(assembler, 0x0f, 0x80 + cc);
+  }
+  add_fixup(fixups, assembler->count, target);
+  emit_u32(assembler, 0);
+}
+
+#define CC_O 0x0
+#define CC_E 0x4
+#define CC_NE 0x5
+
+static void emit_exit(Assembler *assembler, int cc, size_t offset) {
+  emit_branch(assembler, &assembler->exits, cc, offset);
+}
+
+// Short forward branch within a template; returns where to patch.
+static size_t emit_short(Assembler *assembler, uint8_t opcode) {
+  EMIT(assembler, opcode, 0);
+  return assembler->count - 1;
+}
+
+static void patch_short(Assembler *assembler, size_t at) {
+  assembler->code[at] = (uint8_t)(assembler->count - at - 1);
+}
+
+static void patch_rel32(Assembler *assembler, size_t at, size_t target) {
+  int32_t rel = (int32_t)((long)target - (long)(at + 4));
+  memcpy(assembler->code + at, &rel, sizeof(rel));
+}
+
+// Forward branch within a template that may not fit in a rel8.
+static size_t emit_near(Assembler *assembler, int cc) {
+  if (cc < 0) {
+    EMIT(assembler, 0xe9);
+  } else {
+    EMIT(assembler, 0x0f, 0x80 + cc);
+  }
+  emit_u32(assembler, 0);
+  return assembler->count - 4;
+}
+
+static void patch_near(Assembler *assembler, size_t at) {
+  patch_rel32(assembler, at, assembler->count);
+}
+
+// mov reg, [rbx + disp]
+static void emit_peek(Assembler *assembler, int reg, int8_t disp) {
+  EMIT(assembler, 0x48, 0x8b, 0x43 | reg << 3, (uint8_t)disp);
+}
+
+// mov [rbx + disp], reg
+static void emit_poke(Assembler *assembler, int reg, int8_t disp) {
+  EMIT(assembler, 0x48, 0x89, 0x43 | reg << 3, (uint8_t)disp);
+}
+
+// add rbx, 8 * count
+static void emit_adjust(Assembler *assembler, int count) {
+  if (count > 0) {
+    EMIT(assembler, 0x48, 0x83, 0xc3, (uint8_t)(8 * count));
+  } else {
+    EMIT(assembler, 0x48, 0x83, 0xeb, (uint8_t)(-8 * count));
+  }
+}
+
+static void emit_push(Assembler *assembler, Value value) {
+  emit_load(assembler, RAX, value);
+  EMIT(assembler, 0x48, 0x89, 0x03); // mov [rbx], rax
+  emit_adjust(assembler, 1);
+}
+
+// Replaces a variable in reg with its value, like variable_value().
+static void emit_resolve(Assembler *assembler, int reg) {
+  EMIT(assembler, 0x48, 0x89, 0xc1 | reg << 3); // mov rcx, reg
+  EMIT(assembler, 0x4c, 0x21, 0xf1);            // and rcx, r14
+  EMIT(assembler, 0x4c, 0x39, 0xf9);            // cmp rcx, r15
+  size_t skip = emit_short(assembler, 0x75);    // jne
+  EMIT(assembler, 0x4c, 0x29, 0xe8 | reg);      // sub reg, r13
+  EMIT(assembler, 0x48, 0xc1, 0xe8 | reg, 3);   // shr reg, 3
+  // mov reg, [r12 + reg * 8]
+  EMIT(assembler, 0x49, 0x8b, 0x04 | reg << 3, 0xc4 | reg << 3);
+  patch_short(assembler, skip);
+}
+
+// Sets ZF when reg holds an int.
+static void emit_int_test(Assembler *assembler, int reg) {
+  EMIT(assembler, 0x48, 0x89, 0xc1 | reg << 3);        // mov rcx, reg
+  EMIT(assembler, 0x48, 0xc1, 0xe9, 48);               // shr rcx, 48
+  EMIT(assembler, 0x81, 0xf9, 0xfe, 0x7f, 0x00, 0x00); // cmp ecx, 0x7ffe
+}
+
+// Sign-extends the payload of the int in reg.
+static void emit_unbox_int(Assembler *assembler, int reg) {
+  EMIT(assembler, 0x48, 0xc1, 0xe0 | reg, 16); // shl reg, 16
+  EMIT(assembler, 0x48, 0xc1, 0xf8 | reg, 16); // sar reg, 16
+}
+
+// Boxes the integer in rax, exiting when it needs more than 48 bits.
+static void emit_box_int(Assembler *assembler, size_t offset) {
+  EMIT(assembler, 0x48, 0x89, 0xc1);     // mov rcx, rax
+  EMIT(assembler, 0x48, 0xc1, 0xe1, 16); // shl rcx, 16
+  EMIT(assembler, 0x48, 0xc1, 0xf9, 16); // sar rcx, 16
+  EMIT(assembler, 0x48, 0x39, 0xc1);     // cmp rcx, rax
+  emit_exit(assembler, CC_NE, offset);
+  EMIT(assembler, 0x48, 0xc1, 0xe0, 16); // shl rax, 16
+  EMIT(assembler, 0x48, 0xc1, 0xe8, 16); // shr rax, 16
+  emit_load(assembler, RCX, INT_TAG);
+  EMIT(assembler, 0x48, 0x09, 0xc8); // or rax, rcx
+}
+
+// Replaces an int in reg with the double of the same value.
+static void emit_int_to_double(Assembler *assembler, int reg) {
+  emit_int_test(assembler, reg);
+  size_t skip = emit_short(assembler, 0x75); // jne
+  emit_unbox_int(assembler, reg);
+  EMIT(assembler, 0xf2, 0x48, 0x0f, 0x2a, 0xd0 | reg); // cvtsi2sd xmm2, reg
+  EMIT(assembler, 0x66, 0x48, 0x0f, 0x7e, 0xd0 | reg); // movq reg, xmm2
+  patch_short(assembler, skip);
+}
+
+// Sets ZF when reg holds anything but a double.
+static void emit_double_test(Assembler *assembler, int reg) {
+  EMIT(assembler, 0x48, 0x89, 0xc1 | reg << 3); // mov rcx, reg
+  EMIT(assembler, 0x4c, 0x21, 0xe9);            // and rcx, r13
+  EMIT(assembler, 0x4c, 0x39, 0xe9);            // cmp rcx, r13
+}
+
+// Leaves the number in reg as a double, converting an int, and exits if it
+// is not a number.
+static void emit_double_operand(Assembler *assembler, int reg,
+                                size_t offset) {
+  emit_double_test(assembler, reg);
+  size_t skip = emit_short(assembler, 0x75); // jne
+  emit_int_test(assembler, reg);
+  emit_exit(assembler, CC_NE, offset);
+  emit_unbox_int(assembler, reg);
+  EMIT(assembler, 0xf2, 0x48, 0x0f, 0x2a, 0xd0 | reg); // cvtsi2sd xmm2, reg
+  EMIT(assembler, 0x66, 0x48, 0x0f, 0x7e, 0xd0 | reg); // movq reg, xmm2
+  patch_short(assembler, skip);
+}
+
+// Jumps to the rel8s left in falsey when rax is falsey, like is_falsey().
+static void emit_falsey_test(Assembler *assembler, size_t falsey[4]) {
+  emit_load(assembler, RCX, NIL_VAL);
+  EMIT(assembler, 0x48, 0x39, 0xc8); // cmp rax, rcx
+  falsey[0] = emit_short(assembler, 0x74);
+  emit_load(assembler, RCX, FALSE_VAL);
+  EMIT(assembler, 0x48, 0x39, 0xc8);
+  falsey[1] = emit_short(assembler, 0x74);
+  emit_load(assembler, RCX, INT_VAL(0));
+  EMIT(assembler, 0x48, 0x39, 0xc8);
+  falsey[2] = emit_short(assembler, 0x74);
+  // Only +0 and -0 are zero once the sign is shifted out.
+  EMIT(assembler, 0x48, 0x89, 0xc1); // mov rcx, rax
+  EMIT(assembler, 0x48, 0xd1, 0xe1); // shl rcx, 1
+  falsey[3] = emit_short(assembler, 0x74);
+}
+
+static void patch_falsey(Assembler *assembler, size_t falsey[4]) {
+  for (int i = 0; i < 4; ++i) {
+    patch_short(assembler, falsey[i]);
+  }
+}
+
+// Combines the ints in rax and rdx, leaving the boxed result, or 0 or 1 for
+// a comparison, in rax. It exits when the result leaves the int range; a
+// division that is not exact jumps to the rel32s left in inexact with the
+// operands converted in xmm0 and xmm1.
+static void emit_int_operation(Assembler *assembler, size_t offset,
+                               uint8_t op, size_t inexact[2]) {
+  emit_unbox_int(assembler, RAX);
+  emit_unbox_int(assembler, RDX);
+  switch (op) {
+  case OP_ADD:
+    EMIT(assembler, 0x48, 0x01, 0xd0); // add rax, rdx
+    break;
+  case OP_SUBTRACT:
+    EMIT(assembler, 0x48, 0x29, 0xd0); // sub rax, rdx
+    break;
+  case OP_MULTIPLY:
+    EMIT(assembler, 0x48, 0x0f, 0xaf, 0xc2); // imul rax, rdx
+    emit_exit(assembler, CC_O, offset);
+    break;
+  case OP_DIVIDE:
+    // Only an exact quotient stays an int; the rest divide as doubles.
+    EMIT(assembler, 0xf2, 0x48, 0x0f, 0x2a, 0xc0); // cvtsi2sd xmm0, rax
+    EMIT(assembler, 0xf2, 0x48, 0x0f, 0x2a, 0xca); // cvtsi2sd xmm1, rdx
+    EMIT(assembler, 0x48, 0x89, 0xd1);             // mov rcx, rdx
+    EMIT(assembler, 0x48, 0x85, 0xc9);             // test rcx, rcx
+    inexact[0] = emit_near(assembler, CC_E);
+    EMIT(assembler, 0x48, 0x99);       // cqo
+    EMIT(assembler, 0x48, 0xf7, 0xf9); // idiv rcx
+    EMIT(assembler, 0x48, 0x85, 0xd2); // test rdx, rdx
+    inexact[1] = emit_near(assembler, CC_NE);
+    break;
+  default:
+    EMIT(assembler, 0x48, 0x39, 0xd0); // cmp rax, rdx
+    switch (op) {
+    case OP_GREATER:
+      EMIT(assembler, 0x0f, 0x9f, 0xc0); // setg al
+      break;
+    case OP_LESS:
+      EMIT(assembler, 0x0f, 0x9c, 0xc0); // setl al
+      break;
+    case OP_GREATER_EQUAL:
+      EMIT(assembler, 0x0f, 0x9d, 0xc0); // setge al
+      break;
+    default:
+      EMIT(assembler, 0x0f, 0x9e, 0xc0); // setle al
+      break;
+    }
+    EMIT(assembler, 0x0f, 0xb6, 0xc0); // movzx eax, al
+    return;
+  }
+  emit_box_int(assembler, offset);
+}
+
+// Combines the doubles in xmm0 and xmm1, leaving the result, or 0 or 1 for a
+// comparison, in rax.
+static void emit_double_operation(Assembler *assembler, uint8_t op) {
+  switch (op) {
+  case OP_ADD:
+    EMIT(assembler, 0xf2, 0x0f, 0x58, 0xc1); // addsd xmm0, xmm1
+    break;
+  case OP_SUBTRACT:
+    EMIT(assembler, 0xf2, 0x0f, 0x5c, 0xc1); // subsd xmm0, xmm1
+    break;
+  case OP_MULTIPLY:
+    EMIT(assembler, 0xf2, 0x0f, 0x59, 0xc1); // mulsd xmm0, xmm1
+    break;
+  case OP_DIVIDE:
+    EMIT(assembler, 0xf2, 0x0f, 0x5e, 0xc1); // divsd xmm0, xmm1
+    break;
+  default:
+    // Unordered compares clear seta and setae, so NaN compares false.
+    if (op == OP_GREATER || op == OP_GREATER_EQUAL) {
+      EMIT(assembler, 0x66, 0x0f, 0x2e, 0xc1); // ucomisd xmm0, xmm1
+    } else {
+      EMIT(assembler, 0x66, 0x0f, 0x2e, 0xc8); // ucomisd xmm1, xmm0
+    }
+    if (op == OP_GREATER || op == OP_LESS) {
+      EMIT(assembler, 0x0f, 0x97, 0xc0); // seta al
+    } else {
+      EMIT(assembler, 0x0f, 0x93, 0xc0); // setae al
+    }
+    EMIT(assembler, 0x0f, 0xb6, 0xc0); // movzx eax, al
+    return;
+  }
+  EMIT(assembler, 0x66, 0x48, 0x0f, 0x7e, 0xc0); // movq rax, xmm0
+}
+
+// The generic and number forms take the integer template for two ints and
+// compare or combine other numbers as doubles. The int and double forms emit
+// only their own template and exit on any other operand, where the
+// interpreter deopts the instruction; a double form converts its int constant
+// here. Strings and anything else exit to the interpreter, which also
+// quickens the instruction.
+static bool emit_binary(Assembler *assembler, size_t offset, uint8_t op,
+                        Binary_Operand operand, Binary_Form form,
+                        uint16_t index) {
+  // Mixed operands take both templates, like the generic form.
+  if (form == NUMBER_FORM) {
+    form = GENERIC_FORM;
+  }
+  Value constant = NIL_VAL;
+  if (operand == CONSTANT_OPERAND) {
+    constant = assembler->chunk->constants.value[index];
+    if (!IS_NUMBER(constant)) {
+      return false;
+    }
+  }
+  bool compare = op != OP_ADD && op != OP_SUBTRACT && op != OP_MULTIPLY &&
+                 op != OP_DIVIDE;
+  int8_t a = operand == STACK_OPERAND ? -16 : -8;
+  emit_peek(assembler, RAX, a);
+  emit_resolve(assembler, RAX);
+  switch (operand) {
+  case STACK_OPERAND:
+    emit_peek(assembler, RDX, -8);
+    emit_resolve(assembler, RDX);
+    break;
+  case CONSTANT_OPERAND:
+    if (form == DOUBLE_FORM) {
+      constant = NUMBER_VAL(AS_NUMBER(constant));
+    }
+    emit_load(assembler, RDX, constant);
+    break;
+  case VARIABLE_OPERAND:
+    // mov rdx, [r12 + index * 8]
+    EMIT(assembler, 0x49, 0x8b, 0x94, 0x24);
+    emit_u32(assembler, (uint32_t)index * sizeof(Value));
+    break;
+  case LOCAL_OPERAND:
+    // mov rdx, [rsi + index * 8]
+    EMIT(assembler, 0x48, 0x8b, 0x96);
+    emit_u32(assembler, (uint32_t)index * sizeof(Value));
+    break;
+  }
+  // A quickened constant already has the type of its form.
+  int checked = operand == CONSTANT_OPERAND && form != GENERIC_FORM ? 1 : 2;
+  const int registers[2] = {RAX, RDX};
+
+  size_t to_double[2] = {0, 0};
+  size_t inexact[2] = {0, 0};
+  size_t int_done = 0;
+  if (form != DOUBLE_FORM) {
+    for (int i = 0; i < checked; ++i) {
+      emit_int_test(assembler, registers[i]);
+      if (form == INT_FORM) {
+        emit_exit(assembler, CC_NE, offset);
+      } else {
+        to_double[i] = emit_near(assembler, CC_NE);
+      }
+    }
+    emit_int_operation(assembler, offset, op, inexact);
+    if (form == GENERIC_FORM || op == OP_DIVIDE) {
+      int_done = emit_near(assembler, -1);
+    }
+  }
+  if (form == GENERIC_FORM) {
+    patch_near(assembler, to_double[0]);
+    patch_near(assembler, to_double[1]);
+    emit_double_operand(assembler, RAX, offset);
+    emit_double_operand(assembler, RDX, offset);
+  } else if (form == DOUBLE_FORM) {
+    for (int i = 0; i < checked; ++i) {
+      emit_double_test(assembler, registers[i]);
+      emit_exit(assembler, CC_E, offset);
+    }
+  }
+  if (form != INT_FORM) {
+    EMIT(assembler, 0x66, 0x48, 0x0f, 0x6e, 0xc0); // movq xmm0, rax
+    EMIT(assembler, 0x66, 0x48, 0x0f, 0x6e, 0xca); // movq xmm1, rdx
+  }
+  if (op == OP_DIVIDE && form != DOUBLE_FORM) {
+    patch_near(assembler, inexact[0]);
+    patch_near(assembler, inexact[1]);
+  }
+  if (form != INT_FORM || op == OP_DIVIDE) {
+    emit_double_operation(assembler, op);
+  }
+  if (int_done != 0) {
+    patch_near(assembler, int_done);
+  }
+  if (compare) {
+    // Comparisons give the int 0 or 1 either way.
+    emit_load(assembler, RCX, INT_TAG);
+    EMIT(assembler, 0x48, 0x09, 0xc8); // or rax, rcx
+  }
+  emit_poke(assembler, RAX, a);
+  if (operand == STACK_OPERAND) {
+    emit_adjust(assembler, -1);
+  }
+  return true;
+}
+
+static void emit_equal(Assembler *assembler, bool negate) {
+  emit_peek(assembler, RAX, -16);
+  emit_resolve(assembler, RAX);
+  emit_peek(assembler, RDX, -8);
+  emit_resolve(assembler, RDX);
+  emit_int_to_double(assembler, RAX);
+  emit_int_to_double(assembler, RDX);
+  // Two numbers compare as doubles, everything else by bits.
+  EMIT(assembler, 0x48, 0x89, 0xc1, 0x4c, 0x21, 0xe9, 0x4c, 0x39, 0xe9);
+  size_t a_bits = emit_short(assembler, 0x74);
+  EMIT(assembler, 0x48, 0x89, 0xd1, 0x4c, 0x21, 0xe9, 0x4c, 0x39, 0xe9);
+  size_t b_bits = emit_short(assembler, 0x74);
+  EMIT(assembler, 0x66, 0x48, 0x0f, 0x6e, 0xc0); // movq xmm0, rax
+  EMIT(assembler, 0x66, 0x48, 0x0f, 0x6e, 0xca); // movq xmm1, rdx
+  EMIT(assembler, 0x66, 0x0f, 0x2e, 0xc1);       // ucomisd xmm0, xmm1
+  EMIT(assembler, 0x0f, 0x94, 0xc0);             // sete al
+  EMIT(assembler, 0x0f, 0x9b, 0xc1);             // setnp cl
+  EMIT(assembler, 0x20, 0xc8);                   // and al, cl
+  size_t done = emit_short(assembler, 0xeb);
+  patch_short(assembler, a_bits);
+  patch_short(assembler, b_bits);
+  EMIT(assembler, 0x48, 0x39, 0xd0); // cmp rax, rdx
+  EMIT(assembler, 0x0f, 0x94, 0xc0); // sete al
+  patch_short(assembler, done);
+  if (negate) {
+    EMIT(assembler, 0x34, 0x01); // xor al, 1
+  }
+  // FALSE_VAL + 1 is TRUE_VAL.
+  EMIT(assembler, 0x0f, 0xb6, 0xc0); // movzx eax, al
+  emit_load(assembler, RCX, FALSE_VAL);
+  EMIT(assembler, 0x48, 0x01, 0xc8); // add rax, rcx
+  emit_poke(assembler, RAX, -16);
+  emit_adjust(assembler, -1);
+}
+
+static void emit_truthy(Assembler *assembler, bool negate) {
+  emit_peek(assembler, RAX, -8);
+  emit_resolve(assembler, RAX);
+  size_t falsey[4];
+  emit_falsey_test(assembler, falsey);
+  emit_load(assembler, RAX, negate ? FALSE_VAL : TRUE_VAL);
+  size_t done = emit_short(assembler, 0xeb);
+  patch_falsey(assembler, falsey);
+  emit_load(assembler, RAX, negate ? TRUE_VAL : FALSE_VAL);
+  patch_short(assembler, done);
+  emit_poke(assembler, RAX, -8);
+}
+
+static void emit_jump_if_false(Assembler *assembler, size_t target) {
+  emit_peek(assembler, RAX, -8);
+  emit_resolve(assembler, RAX);
+  emit_adjust(assembler, -1);
+  size_t falsey[4];
+  emit_falsey_test(assembler, falsey);
+  size_t done = emit_short(assembler, 0xeb);
+  patch_falsey(assembler, falsey);
+  emit_branch(assembler, &assembler->jumps, -1, target);
+  patch_short(assembler, done);
+}
+
+static void emit_set_variable(Assembler *assembler, size_t offset) {
+  emit_peek(assembler, RDX, -8);
+  EMIT(assembler, 0x48, 0x89, 0xd1); // mov rcx, rdx
+  EMIT(assembler, 0x4c, 0x21, 0xf1); // and rcx, r14
+  EMIT(assembler, 0x4c, 0x39, 0xf9); // cmp rcx, r15
+  emit_exit(assembler, CC_NE, offset);
+  emit_peek(assembler, RAX, -16);
+  emit_resolve(assembler, RAX);
+  EMIT(assembler, 0x4c, 0x29, 0xea);       // sub rdx, r13
+  EMIT(assembler, 0x48, 0xc1, 0xea, 3);    // shr rdx, 3
+  EMIT(assembler, 0x49, 0x89, 0x04, 0xd4); // mov [r12 + rdx * 8], rax
+  emit_adjust(assembler, -2);
+}
+
+// Emits the template for the instruction at offset, or returns false.
+static bool emit_instruction(Assembler *assembler, size_t offset) {
+  Chunk *chunk = assembler->chunk;
+  uint8_t code = chunk->code[offset];
+  size_t length = instruction_length(code);
+  uint16_t operand = length > 1 ? chunk->code[offset + 1] : 0;
+  if (length >= 3) {
+    operand = (uint16_t)(operand << 8 | chunk->code[offset + 2]);
+  }
+  uint8_t op;
+  Binary_Operand kind;
+  Binary_Form form;
+  if (binary_instruction(code, &op, &kind, &form)) {
+    return emit_binary(assembler, offset, op, kind, form, operand);
+  }
+  switch (code) {
+  case OP_CONSTANT:
+    emit_push(assembler, chunk->constants.value[operand]);
+    return true;
+  case OP_VARIABLE:
+    emit_push(assembler, VARIABLE_VAL(operand));
+    return true;
+  case OP_PUSH_OPERATION:
+    emit_push(assembler, OBJ_VAL(vm.operations[operand]));
+    return true;
+  case OP_SET_GLOBAL:
+    emit_peek(assembler, RAX, -8);
+    emit_resolve(assembler, RAX);
+    // mov [r12 + operand * 8], rax
+    EMIT(assembler, 0x49, 0x89, 0x84, 0x24);
+    emit_u32(assembler, (uint32_t)operand * sizeof(Value));
+    emit_adjust(assembler, -1);
+    return true;
+  case OP_SET_VARIABLE:
+    emit_set_variable(assembler, offset);
+    return true;
+  case OP_GET_LOCAL:
+    // mov rax, [rsi + operand * 8]
+    EMIT(assembler, 0x48, 0x8b, 0x86);
+    emit_u32(assembler, (uint32_t)operand * sizeof(Value));
+    emit_poke(assembler, RAX, 0);
+    emit_adjust(assembler, 1);
+    return true;
+  case OP_SET_LOCAL:
+    emit_peek(assembler, RAX, -8);
+    emit_resolve(assembler, RAX);
+    // mov [rsi + operand * 8], rax
+    EMIT(assembler, 0x48, 0x89, 0x86);
+    emit_u32(assembler, (uint32_t)operand * sizeof(Value));
+    emit_adjust(assembler, -1);
+    return true;
+  case OP_INLINE:
+    // mov rax, [r12 + operand * 8]
+    EMIT(assembler, 0x49, 0x8b, 0x84, 0x24);
+    emit_u32(assembler, (uint32_t)operand * sizeof(Value));
+    emit_load(assembler, RCX, chunk->constants.value[chunk->code[offset + 3]]);
+    EMIT(assembler, 0x48, 0x39, 0xc8); // cmp rax, rcx
+    emit_exit(assembler, CC_NE, offset);
+    return true;
+  case OP_EQUAL:
+  case OP_NOT_EQUAL:
+    emit_equal(assembler, code == OP_NOT_EQUAL);
+    return true;
+  case OP_TRUTHY:
+  case OP_NOT:
+    emit_truthy(assembler, code == OP_NOT);
+    return true;
+  case OP_JUMP:
+    emit_branch(assembler, &assembler->jumps, -1, offset + 3 + operand);
+    return true;
+  case OP_LOOP:
+    emit_branch(assembler, &assembler->jumps, -1, offset + 3 - operand);
+    return true;
+  case OP_JUMP_IF_FALSE:
+    emit_jump_if_false(assembler, offset + 3 + operand);
+    return true;
+  }
+  return false;
+}
+
+static void emit_prologue(Assembler *assembler) {
+  EMIT(assembler, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+  emit_load(assembler, RAX, (uint64_t)(uintptr_t)&vm.stack_top);
+  EMIT(assembler, 0x48, 0x8b, 0x18); // mov rbx, [rax]
+  emit_load(assembler, RAX, (uint64_t)(uintptr_t)&vm.global_values.value);
+  EMIT(assembler, 0x4c, 0x8b, 0x20); // mov r12, [rax]
+  EMIT(assembler, 0x49, 0xbd);
+  emit_u64(assembler, QNAN);
+  EMIT(assembler, 0x49, 0xbe);
+  emit_u64(assembler, HIGH_MASK | TAG_MASK);
+  EMIT(assembler, 0x49, 0xbf);
+  emit_u64(assembler, QNAN | TAG_VARIABLE);
+  EMIT(assembler, 0xff, 0xe7); // jmp rdi
+
+  assembler->epilogue = assembler->count;
+  emit_load(assembler, RCX, (uint64_t)(uintptr_t)&vm.stack_top);
+  EMIT(assembler, 0x48, 0x89, 0x19); // mov [rcx], rbx
+  EMIT(assembler, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b);
+  EMIT(assembler, 0xc3);
+}
+
+// Each exit target gets one stub that returns its bytecode address.
+// Returns false when it runs out of memory.
+static bool emit_exit_stubs(Assembler *assembler) {
+  Chunk *chunk = assembler->chunk;
+  size_t *stubs = malloc(sizeof(size_t) * (chunk->count + 1));
+  if (stubs == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i <= chunk->count; ++i) {
+    stubs[i] = 0;
+  }
+  for (size_t i = 0; i < assembler->exits.count; ++i) {
+    Fixup *exit = &assembler->exits.fixup[i];
+    if (stubs[exit->target] == 0) {
+      stubs[exit->target] = assembler->count;
+      uint8_t *ip = chunk->code + exit->target;
+      emit_load(assembler, RAX, (uint64_t)(uintptr_t)ip);
+      EMIT(assembler, 0xe9);
+      emit_u32(assembler, 0);
+      patch_rel32(assembler, assembler->count - 4, assembler->epilogue);
+    }
+    patch_rel32(assembler, exit->at, stubs[exit->target]);
+  }
+  free(stubs);
+  return true;
+}
+
+static void free_assembler(Assembler *assembler) {
+  free(assembler->code);
+  free(assembler->native);
+  free(assembler->jumps.fixup);
+  free(assembler->exits.fixup);
+}
+
+static JitCode *compile(ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  Assembler assembler = {0};
+  assembler.chunk = chunk;
+  assembler.native = malloc(sizeof(size_t) * (chunk->count + 1));
+  uint32_t *entries = calloc(chunk->count + 1, sizeof(uint32_t));
+  // Short of memory the function is just interpreted.
+  if (assembler.native == NULL || entries == NULL) {
+    free(entries);
+    free_assembler(&assembler);
+    return NULL;
+  }
+  emit_prologue(&assembler);
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    assembler.native[offset] = assembler.count;
+    if (emit_instruction(&assembler, offset)) {
+      entries[offset] = (uint32_t)assembler.native[offset];
+    } else {
+      entries[offset] = 0;
+      emit_exit(&assembler, -1, offset);
+    }
+  }
+  for (size_t i = 0; i < assembler.jumps.count; ++i) {
+    Fixup *jump = &assembler.jumps.fixup[i];
+    patch_rel32(&assembler, jump->at, assembler.native[jump->target]);
+  }
+  if (!emit_exit_stubs(&assembler)) {
+    free(entries);
+    free_assembler(&assembler);
+    return NULL;
+  }
+
+  JitCode *jit = NULL;
+  uint8_t *code = mmap(NULL, assembler.count, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code != MAP_FAILED) {
+    memcpy(code, assembler.code, assembler.count);
+    if (mprotect(code, assembler.count, PROT_READ | PROT_EXEC) == 0) {
+      jit = malloc(sizeof(JitCode));
+    }
+    if (jit != NULL) {
+      jit->code = code;
+      jit->size = assembler.count;
+      jit->entries = entries;
+      entries = NULL;
+    } else {
+      munmap(code, assembler.count);
+    }
+  }
+  free(entries);
+  free_assembler(&assembler);
+  return jit;
+}
+
+uint8_t *jit_run(ObjFunction *function, uint8_t *ip) {
+  JitCode *jit = function->jit;
+  if (jit == NULL) {
+    // Compile once, on the first entry past the threshold.
+    if (function->hotness <= JIT_THRESHOLD) {
+      if (function->hotness++ < JIT_THRESHOLD) {
+        return ip;
+      }
+      jit = function->jit = compile(function);
+    }
+    if (jit == NULL) {
+      return ip;
+    }
+  }
+  uint32_t entry = jit->entries[ip - function->chunk.code];
+  if (entry == 0) {
+    return ip;
+  }
+  NativeCode native = (NativeCode)(void *)jit->code;
+  return native(jit->code + entry, vm.frames[vm.frame_count - 1].slots);
+}
+
+void jit_free(ObjFunction *function) {
+  JitCode *jit = function->jit;
+  if (jit != NULL) {
+    munmap(jit->code, jit->size);
+    free(jit->entries);
+    free(jit);
+    function->jit = NULL;
+  }
+}
+#endif /* ifdef JIT */
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include "object.h"
+
+// The JIT stitches machine code templates for x86-64 and needs NaN-boxed
+// values; CMake defines JIT on Linux x86-64 when VAST_JIT is on.
+#if defined(JIT) && !defined(NAN_BOXING)
+#undef JIT
+#endif /* if defined(JIT) && !defined(NAN_BOXING) */
+
+// Traces and profiles have to see every instruction.
+#if defined(DEBUG_TRACE_EXECUTION) || defined(DEBUG_PROFILE_OPCODES)
+#undef JIT
+#endif /* if defined(DEBUG_TRACE_EXECUTION) || ... */
+
+// Entering a procedure or resuming it this many times compiles it.
+#define JIT_THRESHOLD 64
+
+typedef struct JitCode JitCode;
+
+// Set by --jit / --no-jit; ignored when the JIT is not built in.
+extern bool jit_enabled;
+
+#ifdef JIT
+// Runs the native code of function from ip, once it is hot, and returns where
+// the interpreter has to carry on. vm.stack_top must be current.
+uint8_t *jit_run(ObjFunction *function, uint8_t *ip);
+void jit_free(ObjFunction *function);
+#endif /* ifdef JIT */
@@ -1,12 +1,19 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "compiler.h"
 #include "debug.h"
+#include "emit_c.h"
+#include "jit.h"
+#include "memo.h"
+#include "memory.h"
+#include "optimizer.h"
 #include "value.h"
 #include "vm.h"
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static char *read_file(const char *path) {
   FILE *file = fopen(path, "rb");
@@ -45,13 +52,107 @@ static void run_file(const char *path) {
   }
 }
 
+static void emit_file(const char *path, const char *out_path) {
+  char *source = read_file(path);
+  char *default_path = NULL;
+  if (out_path == NULL) {
+    // script.vast becomes script.c.
+    size_t length = strlen(path);
+    if (length > 5 && strcmp(path + length - 5, ".vast") == 0) {
+      length -= 5;
+    }
+    default_path = (char *)malloc(length + 3);
+    memcpy(default_path, path, length);
+    strcpy(default_path + length, ".c");
+    out_path = default_path;
+  }
+  FILE *out = fopen(out_path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", out_path);
+    exit(74);
+  }
+  bool emitted = emit_c(source, path, out);
+  fclose(out);
+  free(source);
+  if (!emitted) {
+    remove(out_path);
+    exit(65);
+  }
+  free(default_path);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: vast [-O<level>] [--inline=<values>|--no-inline]\n"
+          "            [--memo=<entries>|--no-memo] [--nursery=<KiB>]\n"
+          "            [--gc-pause=<us>] [--gc-threads=<n>]\n"
+          "            [--gc-sweep=eager|lazy|background] [--gc-stats]\n"
+          "            [--jit|--no-jit] path\n"
+          "       vast [-O<level>] [--inline=<values>|--no-inline]\n"
+          "            --emit-c path [-o out.c]\n");
+  exit(64);
+}
+
 int main(int argc, char *argv[]) {
+  const char *path = NULL;
+  const char *out_path = NULL;
+  bool emit = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "-O", 2) == 0) {
+      optimization_level = argv[i][2] == '\0' ? 1 : atoi(argv[i] + 2);
+    } else if (strncmp(argv[i], "--inline=", 9) == 0) {
+      inline_threshold = atoi(argv[i] + 9);
+    } else if (strcmp(argv[i], "--no-inline") == 0) {
+      inline_threshold = 0;
+    } else if (strncmp(argv[i], "--memo=", 7) == 0) {
+      memo_limit = (size_t)atol(argv[i] + 7);
+    } else if (strcmp(argv[i], "--no-memo") == 0) {
+      memo_limit = 0;
+    } else if (strncmp(argv[i], "--nursery=", 10) == 0) {
+      nursery_size = (size_t)atol(argv[i] + 10) * 1024;
+    } else if (strncmp(argv[i], "--gc-pause=", 11) == 0) {
+      gc_pause_us = (size_t)atol(argv[i] + 11);
+    } else if (strncmp(argv[i], "--gc-threads=", 13) == 0) {
+#ifndef PARALLEL_MARK
+      fprintf(stderr, "vast: built without parallel marking.\n");
+#endif /* ifndef PARALLEL_MARK */
+      gc_threads = (size_t)atol(argv[i] + 13);
+    } else if (strcmp(argv[i], "--gc-sweep=eager") == 0) {
+      gc_sweep = SWEEP_EAGER;
+    } else if (strcmp(argv[i], "--gc-sweep=lazy") == 0) {
+      gc_sweep = SWEEP_LAZY;
+    } else if (strcmp(argv[i], "--gc-sweep=background") == 0) {
+#ifndef BACKGROUND_SWEEP
+      fprintf(stderr, "vast: built without background sweeping.\n");
+#endif /* ifndef BACKGROUND_SWEEP */
+      gc_sweep = SWEEP_BACKGROUND;
+    } else if (strcmp(argv[i], "--gc-stats") == 0) {
+      gc_stats = true;
+    } else if (strcmp(argv[i], "--jit") == 0) {
+#ifndef JIT
+      fprintf(stderr, "vast: built without the JIT, interpreting.\n");
+#endif /* ifndef JIT */
+      jit_enabled = true;
+    } else if (strcmp(argv[i], "--no-jit") == 0) {
+      jit_enabled = false;
+    } else if (strcmp(argv[i], "--emit-c") == 0) {
+      emit = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      out_path = argv[++i];
+    } else if (path == NULL) {
+      path = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (path == NULL || (out_path != NULL && !emit)) {
+    usage();
+  }
   init_VM();
-  if (argc == 2) {
-    run_file(argv[1]);
+  if (emit) {
+    emit_file(path, out_path);
   } else {
-    fprintf(stderr, "Usage: vast [path]\n");
-    exit(64);
+    run_file(path);
   }
   free_VM();
   return EXIT_SUCCESS;
@@ -0,0 +1,355 @@
+#include "memo.h"
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMO_INITIAL_CAPACITY 16
+#define MEMO_MAX_LOAD 0.75
+// Slots a key may sit past its home slot. Past that, storing it evicts
+// whatever is at home.
+#define MEMO_PROBES 4
+// Procedures looked through when checking whether one calls itself.
+#define MEMO_SEARCH_MAX 64
+
+size_t memo_limit = 4096;
+
+// Keys match only when they are the same value, not merely equal ones: 2
+// and 2.0 compare equal but do not compute the same results.
+static bool same_value(Value a, Value b) {
+#ifdef NAN_BOXING
+  return a == b;
+#else
+  if (a.type != b.type) {
+    return false;
+  }
+  switch (a.type) {
+  case VAL_BOOL:
+    return a.as.boolean == b.as.boolean;
+  case VAL_NIL:
+    return true;
+  case VAL_NUMBER:
+    return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+  case VAL_INT:
+    return a.as.integer == b.as.integer;
+  case VAL_VARIABLE:
+    return a.as.slot == b.as.slot;
+  case VAL_OBJ:
+    return a.as.obj == b.as.obj;
+  }
+  return false;
+#endif /* ifdef NAN_BOXING */
+}
+
+static uint64_t value_bits(Value value) {
+#ifdef NAN_BOXING
+  return value;
+#else
+  uint64_t bits = 0;
+  switch (value.type) {
+  case VAL_BOOL:
+    bits = value.as.boolean;
+    break;
+  case VAL_NIL:
+    break;
+  case VAL_NUMBER:
+    memcpy(&bits, &value.as.number, sizeof(double));
+    break;
+  case VAL_INT:
+    bits = (uint64_t)value.as.integer;
+    break;
+  case VAL_VARIABLE:
+    bits = value.as.slot;
+    break;
+  case VAL_OBJ:
+    bits = (uint64_t)(uintptr_t)value.as.obj;
+    break;
+  }
+  return bits ^ ((uint64_t)value.type << 56);
+#endif /* ifdef NAN_BOXING */
+}
+
+static uint32_t hash_values(Value *values, size_t count) {
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < count; ++i) {
+    hash ^= value_bits(values[i]);
+    hash *= 0x100000001b3u;
+    hash ^= hash >> 29;
+  }
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static bool same_key(MemoEntry *entry, uint32_t hash, Value *inputs,
+                     size_t count) {
+  if (entry->hash != hash) {
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (!same_value(entry->values[i], inputs[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void free_entry(MemoTable *table, MemoEntry *entry) {
+  FREE_ARRAY(Value, entry->values, table->inputs + entry->outputs);
+  entry->values = NULL;
+}
+
+void memo_clear(MemoTable *table) {
+  for (size_t i = 0; i < table->capacity; ++i) {
+    if (table->entries[i].values != NULL) {
+      free_entry(table, &table->entries[i]);
+    }
+  }
+  table->count = 0;
+  table->epoch = vm.memo_epoch;
+}
+
+void memo_flush() { vm.memo_epoch++; }
+
+// Tables are dropped lazily, the next time they are used after a flush.
+static void check_epoch(MemoTable *table) {
+  if (table->epoch != vm.memo_epoch) {
+    memo_clear(table);
+  }
+}
+
+MemoEntry *memo_lookup(MemoTable *table, Value *inputs) {
+  check_epoch(table);
+  if (table->count == 0) {
+    return NULL;
+  }
+  uint32_t hash = hash_values(inputs, table->inputs);
+  for (size_t i = 0; i < MEMO_PROBES; ++i) {
+    MemoEntry *entry = &table->entries[(hash + i) & (table->capacity - 1)];
+    if (entry->values == NULL) {
+      return NULL;
+    }
+    if (same_key(entry, hash, inputs, table->inputs)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Nothing is ever removed on its own, so a probe may stop at the first free
+// slot; a key with no room in its window takes its home slot over.
+static MemoEntry *find_slot(MemoEntry *entries, size_t capacity,
+                            uint32_t hash, Value *inputs, size_t count) {
+  for (size_t i = 0; i < MEMO_PROBES; ++i) {
+    MemoEntry *entry = &entries[(hash + i) & (capacity - 1)];
+    if (entry->values == NULL || same_key(entry, hash, inputs, count)) {
+      return entry;
+    }
+  }
+  return &entries[hash & (capacity - 1)];
+}
+
+static void adjust_capacity(MemoTable *table, size_t capacity) {
+  MemoEntry *entries = ALLOCATE(MemoEntry, capacity);
+  for (size_t i = 0; i < capacity; ++i) {
+    entries[i].values = NULL;
+  }
+  table->count = 0;
+  for (size_t i = 0; i < table->capacity; ++i) {
+    MemoEntry *entry = &table->entries[i];
+    if (entry->values == NULL) {
+      continue;
+    }
+    MemoEntry *slot = find_slot(entries, capacity, entry->hash, entry->values,
+                                table->inputs);
+    if (slot->values != NULL) {
+      free_entry(table, slot);
+    } else {
+      table->count++;
+    }
+    *slot = *entry;
+  }
+  FREE_ARRAY(MemoEntry, table->entries, table->capacity);
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+void memo_store(MemoTable *table, Value *inputs, Value *outputs,
+                size_t output_count) {
+  check_epoch(table);
+  // Copy first: allocating can collect, and the table must stay consistent.
+  Value *values = ALLOCATE(Value, table->inputs + output_count);
+  memcpy(values, inputs, sizeof(Value) * table->inputs);
+  memcpy(values + table->inputs, outputs, sizeof(Value) * output_count);
+
+  if (table->count + 1 > table->capacity * MEMO_MAX_LOAD) {
+    // Capacities stay powers of two, the largest at most memo_limit.
+    size_t capacity = table->capacity == 0 ? MEMO_INITIAL_CAPACITY
+                                           : table->capacity * 2;
+    while (capacity > memo_limit && capacity > 1) {
+      capacity /= 2;
+    }
+    if (capacity > table->capacity) {
+      adjust_capacity(table, capacity);
+    }
+  }
+  uint32_t hash = hash_values(inputs, table->inputs);
+  MemoEntry *entry =
+      find_slot(table->entries, table->capacity, hash, inputs, table->inputs);
+  if (entry->values != NULL) {
+    free_entry(table, entry);
+  } else {
+    table->count++;
+  }
+  entry->hash = hash;
+  entry->outputs = output_count;
+  entry->values = values;
+}
+
+void memo_mark(MemoTable *table) {
+  if (table == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < table->capacity; ++i) {
+    MemoEntry *entry = &table->entries[i];
+    if (entry->values == NULL) {
+      continue;
+    }
+    for (size_t j = 0; j < table->inputs + entry->outputs; ++j) {
+      mark_value(entry->values[j]);
+    }
+  }
+}
+
+void memo_free(ObjFunction *function) {
+  MemoTable *table = function->memo;
+  if (table == NULL) {
+    return;
+  }
+  memo_clear(table);
+  FREE_ARRAY(MemoEntry, table->entries, table->capacity);
+  FREE(MemoTable, table);
+  function->memo = NULL;
+}
+
+bool memo_impure_operation(uint8_t code) {
+  switch (code) {
+  case OP_PRINT:
+  case OP_SCAN:
+  case OP_SET_VARIABLE:
+  case OP_SET_GLOBAL:
+  case OP_DEFINE_FUNCTION:
+  case OP_PICK:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool is_pure(Chunk *chunk) {
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    uint8_t code = chunk->code[offset];
+    if (memo_impure_operation(code) ||
+        (code == OP_PUSH_OPERATION &&
+         memo_impure_operation(chunk->code[offset + 1]))) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < chunk->constants.count; ++i) {
+    Value value = chunk->constants.value[i];
+    if (IS_OPERATION(value) &&
+        memo_impure_operation(AS_OPERATION(value)->code)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The global slot an instruction names, or SIZE_MAX.
+static size_t global_operand(uint8_t *code) {
+  switch (code[0]) {
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+    return SIZE_MAX;
+  default:
+    if (instruction_length(code[0]) == 3 || code[0] == OP_INLINE) {
+      return (size_t)(code[1] << 8 | code[2]);
+    }
+    return SIZE_MAX;
+  }
+}
+
+typedef struct Search {
+  size_t slot;
+  ObjFunction *seen[MEMO_SEARCH_MAX];
+  size_t seen_count;
+} Search;
+
+static bool reaches_slot(Search *search, ObjFunction *function);
+
+static bool reaches_through(Search *search, Value value) {
+  if (!IS_PROCEDURE(value) || AS_PROCEDURE(value)->closure == NULL) {
+    return false;
+  }
+  return reaches_slot(search, AS_PROCEDURE(value)->closure->function);
+}
+
+// Whether function names the slot, or a procedure that does, as things are
+// bound now. Gives up, answering no, after MEMO_SEARCH_MAX procedures.
+static bool reaches_slot(Search *search, ObjFunction *function) {
+  for (size_t i = 0; i < search->seen_count; ++i) {
+    if (search->seen[i] == function) {
+      return false;
+    }
+  }
+  if (search->seen_count == MEMO_SEARCH_MAX) {
+    return false;
+  }
+  search->seen[search->seen_count++] = function;
+
+  Chunk *chunk = &function->chunk;
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    size_t slot = global_operand(&chunk->code[offset]);
+    if (slot == search->slot) {
+      return true;
+    }
+    if (slot != SIZE_MAX &&
+        reaches_through(search, vm.global_values.value[slot])) {
+      return true;
+    }
+  }
+  for (size_t i = 0; i < chunk->constants.count; ++i) {
+    if (reaches_through(search, chunk->constants.value[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void memo_prepare(ObjFunction *function, size_t slot) {
+  function->pure = is_pure(&function->chunk);
+  if (!function->pure || function->no_memo || memo_limit == 0) {
+    return;
+  }
+  Search search;
+  search.slot = slot;
+  search.seen_count = 0;
+  if (!reaches_slot(&search, function)) {
+    return;
+  }
+  MemoTable *table = ALLOCATE(MemoTable, 1);
+  // A first guess: how deep the code reaches before its first call.
+  table->inputs = function->chunk.segments[0].consumes;
+  table->count = 0;
+  table->capacity = 0;
+  table->entries = NULL;
+  table->epoch = vm.memo_epoch;
+  function->memo = table;
+}
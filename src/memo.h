@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// Results one memo table keeps at most, set by --memo=<entries>; 0, like
+// --no-memo, turns memoization off.
+extern size_t memo_limit;
+
+typedef struct MemoEntry {
+  uint32_t hash;
+  size_t outputs;
+  // The inputs, then what the call left in their place; NULL while the
+  // entry is free.
+  Value *values;
+} MemoEntry;
+
+// What a procedure left on the stack, by the values it was called on. A
+// call reads at most the top inputs values, so they are the key; the VM
+// raises inputs, dropping every entry, when a call reaches deeper.
+typedef struct MemoTable {
+  size_t inputs;
+  size_t count;
+  size_t capacity;
+  MemoEntry *entries;
+  // The VM's memo_epoch when the entries were stored.
+  size_t epoch;
+} MemoTable;
+
+// Works out whether function's own code is pure, with no I/O and no writes
+// to globals, and gives it a memo table if it is, calls itself through the
+// global slot it is being defined in and has no '(nomemo)' pragma.
+void memo_prepare(ObjFunction *function, size_t slot);
+// Whether running the operation code can do I/O, write a global or read
+// the stack below what stack_effect() reports.
+bool memo_impure_operation(uint8_t code);
+// Drops the results in every table: they may depend on globals that are
+// about to change.
+void memo_flush();
+MemoEntry *memo_lookup(MemoTable *table, Value *inputs);
+void memo_store(MemoTable *table, Value *inputs, Value *outputs,
+                size_t output_count);
+void memo_clear(MemoTable *table);
+void memo_mark(MemoTable *table);
+void memo_free(ObjFunction *function);
@@ -1,6 +1,8 @@
 #include "memory.h"
 #include "chunk.h"
 #include "compiler.h"
+#include "jit.h"
+#include "memo.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
@@ -8,25 +10,151 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#if defined(PARALLEL_MARK) || defined(BACKGROUND_SWEEP)
+#include <pthread.h>
+#endif /* if defined(PARALLEL_MARK) || defined(BACKGROUND_SWEEP) */
+#ifdef PARALLEL_MARK
+#include <sched.h>
+#endif /* ifdef PARALLEL_MARK */
 
 #ifdef DEBUG_LOG_GC
 #include "debug.h"
-#include <stdio.h>
 #endif /* ifdef DEBUG_LOG_GC */
 
 #define GC_HEAP_GROW_FACTOR 2
+// Bytes allocated between two slices of an incremental collection.
+#define GC_SLICE_BYTES (64 * 1024)
+// Objects traced between two looks at the clock.
+#define GC_CLOCK_EVERY 64
+// Bitmap words swept per allocation while a sweep is pending.
+#define SWEEP_PER_ALLOCATION 8
 
-void *reallocate(void *pointer, size_t old_size, size_t new_size) {
+size_t nursery_size = 256 * 1024;
+size_t gc_pause_us = 0;
+bool gc_stats = false;
+size_t gc_threads = 1;
+SweepMode gc_sweep = SWEEP_LAZY;
+
+typedef enum PauseKind { PAUSE_MINOR, PAUSE_MAJOR, PAUSE_SLICE } PauseKind;
+
+// Every pause, in microseconds, while gc_stats is set.
+static struct {
+  uint32_t *pauses;
+  size_t count;
+  size_t capacity;
+  size_t kinds[PAUSE_SLICE + 1];
+} stats;
+
+// Whether the collection running is a minor one, which leaves the old
+// generation alone.
+static bool collecting_young = false;
+
+static void collect_young();
+static void mark_slice();
+static void sweep_step(size_t limit);
+
+#ifdef PARALLEL_MARK
+typedef struct Marker Marker;
+// The marker of the thread running, while marking is spread over threads.
+static _Thread_local Marker *marker = NULL;
+static void mark_in_parallel(Obj *object);
+#endif /* ifdef PARALLEL_MARK */
+
+// Objects are carved out of arenas of ARENA_SIZE bytes, each aligned to its
+// size so an object finds its arena, and its bits in the arena's bitmaps,
+// by masking its address. One pool per object type keeps every slot in an
+// arena the same size.
+#define ARENA_SIZE (256 * 1024)
+#define OBJ_TYPE_COUNT (OBJ_OPERATION + 1)
+#define SLOT_ALIGN 8
+#define ARENA_PAGE 4096
+// One bit for every SLOT_ALIGN bytes of an arena, its header included.
+#define BITMAP_WORDS (ARENA_SIZE / SLOT_ALIGN / 64)
+
+typedef struct Arena {
+  struct Arena *next;
+  // The next arena of the pool with a free slot, while available is set.
+  struct Arena *next_available;
+  bool available;
+  // Left to sweep since the last major collection, linked through
+  // next_unswept; nothing is allocated from it until it is swept.
+  bool unswept;
+  // The sweeping thread has replaced the mark bits with those of the
+  // objects to free.
+  bool scanned;
+  struct Arena *next_unswept;
+  // Bitmap words swept so far.
+  size_t swept_words;
+  size_t slot_size;
+  // Slots past bump have never been handed out.
+  uint8_t *bump;
+  uint8_t *end;
+  // Slots freed since, each holding a pointer to the next.
+  void *free_list;
+  size_t live;
+  // A bit for the first word of every object handed out, and one for every
+  // object marked, so marking never writes to the objects themselves.
+  uint64_t allocated[BITMAP_WORDS];
+  uint64_t marked[BITMAP_WORDS];
+} Arena;
+
+typedef struct Pool {
+  size_t slot_size;
+  Arena *arenas;
+  // Allocation always takes from the first of these.
+  Arena *available;
+  // Arenas the VM's thread has left to sweep.
+  Arena *unswept;
+} Pool;
+
+static Pool pools[OBJ_TYPE_COUNT];
+
+#define ARENA_START(arena)                                                     \
+  ((uint8_t *)(arena) +                                                        \
+   ((sizeof(Arena) + SLOT_ALIGN - 1) & ~(size_t)(SLOT_ALIGN - 1)))
+#define BIT(index) ((uint64_t)1 << ((index) % 64))
+
+// Counts a change in the heap against the next collection, running it first
+// when the heap grows past it.
+static void account(size_t old_size, size_t new_size) {
   vm.bytes_allocated += new_size - old_size;
   if (new_size > old_size) {
+    vm.young_bytes += new_size - old_size;
+    if (vm.sweeping) {
+      sweep_step(SWEEP_PER_ALLOCATION);
+    }
 #ifdef DEBUG_STRESS_GC
-    collect_garbage();
+    bool stress = true;
+#else
+    bool stress = false;
 #endif /* ifdef DEBUG_STRESS_GC */
-    if (vm.bytes_allocated > vm.next_gc) {
-      collect_garbage();
+    if (vm.marking) {
+      // Minor collections wait until marking is done.
+      if (stress || vm.young_bytes > GC_SLICE_BYTES) {
+        mark_slice();
+      }
+    } else if (vm.bytes_allocated > vm.next_gc ||
+               (stress && nursery_size == 0)) {
+      if (gc_pause_us > 0) {
+        mark_slice();
+      } else {
+        collect_garbage();
+      }
+    } else if (nursery_size > 0 && (stress || vm.young_bytes > nursery_size)) {
+      collect_young();
     }
   }
+}
+
+void *reallocate(void *pointer, size_t old_size, size_t new_size) {
+  account(old_size, new_size);
   if (new_size == 0) {
     free(pointer);
     return NULL;
@@ -37,6 +165,170 @@ void *reallocate(void *pointer, size_t old_size, size_t new_size) {
   return result;
 }
 
+static Arena *new_arena(Pool *pool) {
+  // Map twice the size and trim, so what is left is aligned.
+  uint8_t *raw = mmap(NULL, ARENA_SIZE * 2, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(raw != MAP_FAILED && "Could not map an arena");
+  uint8_t *start = (uint8_t *)(((uintptr_t)raw + ARENA_SIZE - 1) &
+                               ~(uintptr_t)(ARENA_SIZE - 1));
+  if (start > raw) {
+    munmap(raw, (size_t)(start - raw));
+  }
+  if (start < raw + ARENA_SIZE) {
+    munmap(start + ARENA_SIZE, (size_t)(raw + ARENA_SIZE - start));
+  }
+
+  // Fresh pages are zeroed, bitmaps included.
+  Arena *arena = (Arena *)start;
+  arena->slot_size = pool->slot_size;
+  arena->bump = ARENA_START(arena);
+  arena->end = start + ARENA_SIZE;
+  arena->free_list = NULL;
+  arena->live = 0;
+  arena->unswept = false;
+  arena->scanned = false;
+  arena->next_unswept = NULL;
+  arena->swept_words = 0;
+  arena->next = pool->arenas;
+  pool->arenas = arena;
+  arena->next_available = pool->available;
+  arena->available = true;
+  pool->available = arena;
+  return arena;
+}
+
+static Arena *arena_of(Obj *object) {
+  return (Arena *)((uintptr_t)object & ~(uintptr_t)(ARENA_SIZE - 1));
+}
+
+static size_t bit_of(Obj *object) {
+  return ((uintptr_t)object & (ARENA_SIZE - 1)) / SLOT_ALIGN;
+}
+
+static bool has_room(Arena *arena) {
+  return arena->free_list != NULL ||
+         arena->bump + arena->slot_size <= arena->end;
+}
+
+static void make_available(Pool *pool, Arena *arena) {
+  arena->next_available = pool->available;
+  arena->available = true;
+  pool->available = arena;
+}
+
+static void sweep_pool(Pool *pool, size_t *limit);
+
+void *allocate_object_memory(ObjType type, size_t size) {
+  account(0, size);
+  Pool *pool = &pools[type];
+  if (pool->slot_size == 0) {
+    pool->slot_size = (size + SLOT_ALIGN - 1) & ~(size_t)(SLOT_ALIGN - 1);
+  }
+  assert(size <= pool->slot_size && "Objects of one type differ in size");
+
+  // An arena left unswept is swept before a new one is mapped.
+  while (pool->available == NULL && pool->unswept != NULL) {
+    size_t limit = BITMAP_WORDS;
+    sweep_pool(pool, &limit);
+  }
+  Arena *arena = pool->available;
+  if (arena == NULL) {
+    arena = new_arena(pool);
+  }
+  void *slot;
+  if (arena->free_list != NULL) {
+    slot = arena->free_list;
+    arena->free_list = *(void **)slot;
+  } else {
+    slot = arena->bump;
+    arena->bump += arena->slot_size;
+  }
+  arena->live++;
+  if (!has_room(arena)) {
+    pool->available = arena->next_available;
+    arena->available = false;
+  }
+
+  size_t bit = bit_of((Obj *)slot);
+  arena->allocated[bit / 64] |= BIT(bit);
+  // Marking is past the roots; the collector traces new objects itself.
+  if (vm.marking) {
+    arena->marked[bit / 64] |= BIT(bit);
+  }
+  if (vm.young_capacity < vm.young_count + 1) {
+    vm.young_capacity = GROW_CAPACITY(vm.young_capacity);
+    vm.young = (Obj **)realloc(vm.young, sizeof(Obj *) * vm.young_capacity);
+    if (vm.young == NULL) {
+      exit(1);
+    }
+  }
+  vm.young[vm.young_count++] = (Obj *)slot;
+  return slot;
+}
+
+void free_object_memory(Obj *object, size_t size) {
+  account(size, 0);
+  Pool *pool = &pools[object->type];
+  Arena *arena = arena_of(object);
+  size_t bit = bit_of(object);
+  arena->allocated[bit / 64] &= ~BIT(bit);
+  arena->marked[bit / 64] &= ~BIT(bit);
+  *(void **)object = arena->free_list;
+  arena->free_list = object;
+  arena->live--;
+  // An arena being swept is made available once it is done.
+  if (!arena->available && !arena->unswept) {
+    make_available(pool, arena);
+  }
+  if (arena->live == 0 && arena != pool->available) {
+    // Hand the pages back but keep the address range and the bitmaps; the
+    // pages come back zeroed the next time the arena is used.
+    uint8_t *start = ARENA_START(arena);
+    uintptr_t page =
+        ((uintptr_t)start + ARENA_PAGE - 1) & ~(uintptr_t)(ARENA_PAGE - 1);
+    madvise((void *)page, (size_t)((uintptr_t)arena->end - page),
+            MADV_DONTNEED);
+    arena->bump = start;
+    arena->free_list = NULL;
+  }
+}
+
+bool is_marked(Obj *object) {
+  size_t bit = bit_of(object);
+  return (arena_of(object)->marked[bit / 64] & BIT(bit)) != 0;
+}
+
+static void clear_mark(Obj *object) {
+  size_t bit = bit_of(object);
+  arena_of(object)->marked[bit / 64] &= ~BIT(bit);
+}
+
+// Sets the mark bit of object, returning whether it was set already.
+static bool test_and_mark(Obj *object) {
+  size_t bit = bit_of(object);
+  uint64_t *word = &arena_of(object)->marked[bit / 64];
+  if (*word & BIT(bit)) {
+    return true;
+  }
+  *word |= BIT(bit);
+  return false;
+}
+
+static void free_arenas() {
+  for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+    Arena *arena = pools[i].arenas;
+    while (arena != NULL) {
+      Arena *next = arena->next;
+      munmap(arena, ARENA_SIZE);
+      arena = next;
+    }
+    pools[i].arenas = NULL;
+    pools[i].available = NULL;
+    pools[i].unswept = NULL;
+  }
+}
+
 static void free_object(Obj *object) {
 #ifdef DEBUG_LOG_GC
   printf("%p free type %d\n", (void *)object, object->type);
@@ -45,34 +337,35 @@ static void free_object(Obj *object) {
   case OBJ_CLOSURE: {
     ObjClosure *closure = (ObjClosure *)object;
     FREE_ARRAY(ObjUpvalue *, closure->upvalues, closure->upvalue_count);
-    FREE(ObjClosure, object);
+    FREE_OBJ(ObjClosure, object);
     break;
   }
   case OBJ_FUNCTION: {
     ObjFunction *function = (ObjFunction *)object;
+#ifdef JIT
+    jit_free(function);
+#endif /* ifdef JIT */
+    memo_free(function);
     free_chunk(&function->chunk);
-    FREE(ObjFunction, object);
+    FREE_OBJ(ObjFunction, object);
     break;
   }
   case OBJ_STRING: {
     ObjString *string = (ObjString *)object;
     FREE_ARRAY(char, string->chars, string->length + 1);
-    FREE(ObjString, object);
+    FREE_OBJ(ObjString, object);
     break;
   }
   case OBJ_UPVALUE:
-    FREE(ObjUpvalue, object);
-    break;
-  case OBJ_VARIABLE:
-    FREE(ObjVariable, object);
+    FREE_OBJ(ObjUpvalue, object);
     break;
   case OBJ_OPERATION:
-    FREE(ObjOperation, object);
+    FREE_OBJ(ObjOperation, object);
     break;
   case OBJ_PROCEDURE: {
     ObjProcedure *procedure = (ObjProcedure *)object;
     free_value_array(&procedure->stack);
-    FREE(ObjProcedure, object);
+    FREE_OBJ(ObjProcedure, object);
     break;
   }
   }
@@ -82,7 +375,14 @@ void mark_object(Obj *object) {
   if (object == NULL) {
     return;
   }
-  if (object->is_marked) {
+#ifdef PARALLEL_MARK
+  if (marker != NULL) {
+    mark_in_parallel(object);
+    return;
+  }
+#endif /* ifdef PARALLEL_MARK */
+  // Old objects first: their mark bits may be the sweeping thread's.
+  if ((collecting_young && object->is_old) || test_and_mark(object)) {
     return;
   }
 #ifdef DEBUG_LOG_GC
@@ -90,7 +390,6 @@ void mark_object(Obj *object) {
   print_value(OBJ_VAL(object));
   printf("\n");
 #endif /* ifdef DEBUG_LOG_GC */
-  object->is_marked = true;
   if (vm.gray_capacity < vm.gray_count + 1) {
     vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
     vm.gray_stack =
@@ -134,6 +433,7 @@ static void blacken_object(Obj *object) {
     ObjFunction *function = (ObjFunction *)object;
     mark_object((Obj *)function->name);
     mark_array(&function->chunk.constants);
+    memo_mark(function->memo);
     break;
   }
   case OBJ_UPVALUE:
@@ -141,14 +441,14 @@ static void blacken_object(Obj *object) {
     break;
   case OBJ_PROCEDURE: {
     ObjProcedure *procedure = (ObjProcedure *)object;
+    mark_object((Obj *)procedure->name);
+    mark_object((Obj *)procedure->closure);
     mark_array(&procedure->stack);
     break;
   }
-  case OBJ_VARIABLE: {
-    mark_value(((ObjVariable *)object)->value);
-    break;
-  }
   case OBJ_OPERATION:
+    mark_object((Obj *)((ObjOperation *)object)->type);
+    break;
   case OBJ_STRING:
     break;
   }
@@ -158,71 +458,724 @@ static void mark_roots() {
   for (Value *slot = vm.stack; slot < vm.stack_top; ++slot) {
     mark_value(*slot);
   }
+  for (Value *slot = vm.locals; slot < vm.locals_top; ++slot) {
+    mark_value(*slot);
+  }
   for (size_t i = 0; i < vm.frame_count; ++i) {
     mark_object((Obj *)vm.frames[i].closure);
+    mark_object((Obj *)vm.frames[i].memo);
   }
+  mark_array(&vm.memo_keys);
   for (ObjUpvalue *upvalue = vm.open_upvalues; upvalue != NULL;
        upvalue = upvalue->next) {
     mark_object((Obj *)upvalue);
   }
   mark_table(&vm.globals);
+  mark_array(&vm.global_names);
+  mark_array(&vm.global_values);
+  for (size_t i = 0; i < UINT8_COUNT; ++i) {
+    mark_object((Obj *)vm.operations[i]);
+  }
   mark_compiler_roots();
   mark_object((Obj *)vm.init_string);
 }
 
-static void trace_references() {
+static uint64_t now_us() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000 + (uint64_t)time.tv_nsec / 1000;
+}
+
+static void record_pause(PauseKind kind, uint64_t start) {
+  if (!gc_stats) {
+    return;
+  }
+  if (stats.capacity < stats.count + 1) {
+    stats.capacity = GROW_CAPACITY(stats.capacity);
+    stats.pauses =
+        (uint32_t *)realloc(stats.pauses, sizeof(uint32_t) * stats.capacity);
+    if (stats.pauses == NULL) {
+      exit(1);
+    }
+  }
+  uint64_t pause = now_us() - start;
+  stats.pauses[stats.count++] = pause > UINT32_MAX ? UINT32_MAX : pause;
+  stats.kinds[kind]++;
+}
+
+#ifdef PARALLEL_MARK
+#define MARK_MAX_THREADS 64
+// Gray objects a marker hands over to its shared deque at a time.
+#define MARK_SHARE_BATCH 64
+
+// Each marking thread works off a private gray stack. When that holds
+// more than it needs and the thread's shared deque has run dry, a batch
+// moves over, for idle threads to steal.
+struct Marker {
+  Obj **local;
+  size_t local_count;
+  size_t local_capacity;
+  pthread_mutex_t lock;
+  // The owner takes from the top, thieves from the bottom.
+  Obj **shared;
+  size_t shared_bottom;
+  size_t shared_top;
+  size_t shared_capacity;
+};
+
+static struct {
+  Marker markers[MARK_MAX_THREADS];
+  pthread_t threads[MARK_MAX_THREADS];
+  // Threads started, the collecting one included.
+  size_t count;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  size_t round;
+  size_t finished;
+  bool quit;
+  // Markers with nothing left to do or steal.
+  size_t idle;
+} mark_threads = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                  .start = PTHREAD_COND_INITIALIZER,
+                  .done = PTHREAD_COND_INITIALIZER};
+
+static void push_local(Marker *self, Obj *object) {
+  if (self->local_capacity < self->local_count + 1) {
+    self->local_capacity = GROW_CAPACITY(self->local_capacity);
+    self->local =
+        (Obj **)realloc(self->local, sizeof(Obj *) * self->local_capacity);
+    if (self->local == NULL) {
+      exit(1);
+    }
+  }
+  self->local[self->local_count++] = object;
+}
+
+static size_t shared_count(Marker *self) {
+  return __atomic_load_n(&self->shared_top, __ATOMIC_RELAXED) -
+         __atomic_load_n(&self->shared_bottom, __ATOMIC_RELAXED);
+}
+
+// Two threads may reach an object at once; whichever sets the bit first
+// traces it. Others may be setting bits in the same word.
+static void mark_in_parallel(Obj *object) {
+  if (collecting_young && object->is_old) {
+    return;
+  }
+  size_t bit = bit_of(object);
+  uint64_t *word = &arena_of(object)->marked[bit / 64];
+  if ((__atomic_load_n(word, __ATOMIC_RELAXED) & BIT(bit)) ||
+      (__atomic_fetch_or(word, BIT(bit), __ATOMIC_RELAXED) & BIT(bit))) {
+    return;
+  }
+  push_local(marker, object);
+}
+
+static void share(Marker *self) {
+  pthread_mutex_lock(&self->lock);
+  if (self->shared_bottom == self->shared_top) {
+    __atomic_store_n(&self->shared_bottom, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&self->shared_top, 0, __ATOMIC_RELAXED);
+  }
+  if (self->shared_capacity < self->shared_top + MARK_SHARE_BATCH) {
+    self->shared_capacity = self->shared_top + MARK_SHARE_BATCH * 4;
+    self->shared =
+        (Obj **)realloc(self->shared, sizeof(Obj *) * self->shared_capacity);
+    if (self->shared == NULL) {
+      exit(1);
+    }
+  }
+  self->local_count -= MARK_SHARE_BATCH;
+  memcpy(self->shared + self->shared_top, self->local + self->local_count,
+         sizeof(Obj *) * MARK_SHARE_BATCH);
+  __atomic_store_n(&self->shared_top, self->shared_top + MARK_SHARE_BATCH,
+                   __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&self->lock);
+}
+
+// Moves up to half of what victim shares, at least one object, to self.
+static bool take(Marker *self, Marker *victim, bool from_top) {
+  if (shared_count(victim) == 0) {
+    return false;
+  }
+  pthread_mutex_lock(&victim->lock);
+  size_t count = victim->shared_top - victim->shared_bottom;
+  size_t taking = count > 1 ? count / 2 : count;
+  for (size_t i = 0; i < taking; ++i) {
+    if (from_top) {
+      push_local(self, victim->shared[--victim->shared_top]);
+    } else {
+      push_local(self, victim->shared[victim->shared_bottom++]);
+    }
+  }
+  __atomic_store_n(&victim->shared_top, victim->shared_top, __ATOMIC_RELAXED);
+  __atomic_store_n(&victim->shared_bottom, victim->shared_bottom,
+                   __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&victim->lock);
+  return taking > 0;
+}
+
+static bool steal(Marker *self, size_t index) {
+  for (size_t i = 1; i < mark_threads.count; ++i) {
+    Marker *victim = &mark_threads.markers[(index + i) % mark_threads.count];
+    if (take(self, victim, false)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool work_left() {
+  for (size_t i = 0; i < mark_threads.count; ++i) {
+    if (shared_count(&mark_threads.markers[i]) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Marking is over once every marker is idle: an idle one has no objects
+// of its own, and only a busy one can share more.
+static bool all_idle() {
+  __atomic_add_fetch(&mark_threads.idle, 1, __ATOMIC_ACQ_REL);
+  while (__atomic_load_n(&mark_threads.idle, __ATOMIC_ACQUIRE) <
+         mark_threads.count) {
+    if (work_left()) {
+      __atomic_sub_fetch(&mark_threads.idle, 1, __ATOMIC_ACQ_REL);
+      return false;
+    }
+    sched_yield();
+  }
+  return true;
+}
+
+static void drain(size_t index) {
+  Marker *self = &mark_threads.markers[index];
+  marker = self;
+  for (;;) {
+    while (self->local_count > 0) {
+      blacken_object(self->local[--self->local_count]);
+      if (self->local_count > MARK_SHARE_BATCH * 2 && shared_count(self) == 0) {
+        share(self);
+      }
+    }
+    if (take(self, self, true) || steal(self, index)) {
+      continue;
+    }
+    if (all_idle()) {
+      break;
+    }
+  }
+  marker = NULL;
+}
+
+static void *mark_thread(void *argument) {
+  size_t index = (size_t)(uintptr_t)argument;
+  size_t round = 0;
+  for (;;) {
+    pthread_mutex_lock(&mark_threads.lock);
+    while (mark_threads.round == round && !mark_threads.quit) {
+      pthread_cond_wait(&mark_threads.start, &mark_threads.lock);
+    }
+    if (mark_threads.quit) {
+      pthread_mutex_unlock(&mark_threads.lock);
+      return NULL;
+    }
+    round = mark_threads.round;
+    pthread_mutex_unlock(&mark_threads.lock);
+
+    drain(index);
+
+    pthread_mutex_lock(&mark_threads.lock);
+    mark_threads.finished++;
+    pthread_cond_signal(&mark_threads.done);
+    pthread_mutex_unlock(&mark_threads.lock);
+  }
+}
+
+static void init_marker(Marker *self) {
+  self->local = NULL;
+  self->local_count = 0;
+  self->local_capacity = 0;
+  pthread_mutex_init(&self->lock, NULL);
+  self->shared = NULL;
+  self->shared_bottom = 0;
+  self->shared_top = 0;
+  self->shared_capacity = 0;
+}
+
+// Starts the helper threads the first time marking is spread out. They
+// wait between collections, until the VM is freed.
+static void start_markers() {
+  if (mark_threads.count > 0) {
+    return;
+  }
+  size_t wanted = gc_threads < MARK_MAX_THREADS ? gc_threads : MARK_MAX_THREADS;
+  init_marker(&mark_threads.markers[0]);
+  mark_threads.count = 1;
+  while (mark_threads.count < wanted) {
+    init_marker(&mark_threads.markers[mark_threads.count]);
+    if (pthread_create(&mark_threads.threads[mark_threads.count], NULL,
+                       mark_thread,
+                       (void *)(uintptr_t)mark_threads.count) != 0) {
+      break;
+    }
+    mark_threads.count++;
+  }
+}
+
+// The gray objects so far are dealt out to the markers; the collecting
+// thread marks alongside the helpers until they all run out.
+static void trace_in_parallel() {
+  start_markers();
+  for (size_t i = 0; i < vm.gray_count; ++i) {
+    push_local(&mark_threads.markers[i % mark_threads.count], vm.gray_stack[i]);
+  }
+  vm.gray_count = 0;
+
+  pthread_mutex_lock(&mark_threads.lock);
+  mark_threads.idle = 0;
+  mark_threads.finished = 0;
+  mark_threads.round++;
+  pthread_cond_broadcast(&mark_threads.start);
+  pthread_mutex_unlock(&mark_threads.lock);
+
+  drain(0);
+
+  pthread_mutex_lock(&mark_threads.lock);
+  while (mark_threads.finished < mark_threads.count - 1) {
+    pthread_cond_wait(&mark_threads.done, &mark_threads.lock);
+  }
+  pthread_mutex_unlock(&mark_threads.lock);
+}
+
+static void stop_markers() {
+  pthread_mutex_lock(&mark_threads.lock);
+  mark_threads.quit = true;
+  pthread_cond_broadcast(&mark_threads.start);
+  pthread_mutex_unlock(&mark_threads.lock);
+  for (size_t i = 0; i < mark_threads.count; ++i) {
+    if (i > 0) {
+      pthread_join(mark_threads.threads[i], NULL);
+    }
+    Marker *self = &mark_threads.markers[i];
+    free(self->local);
+    free(self->shared);
+    pthread_mutex_destroy(&self->lock);
+  }
+  mark_threads.count = 0;
+  mark_threads.round = 0;
+  mark_threads.quit = false;
+}
+#endif /* ifdef PARALLEL_MARK */
+
+// Drains the gray stack, giving up at deadline. Returns whether it emptied.
+static bool trace_references(uint64_t deadline) {
+#ifdef PARALLEL_MARK
+  if (deadline == UINT64_MAX && gc_threads > 1 && !collecting_young) {
+    trace_in_parallel();
+    return true;
+  }
+#endif /* ifdef PARALLEL_MARK */
+  size_t traced = 0;
   while (vm.gray_count > 0) {
     Obj *object = vm.gray_stack[--vm.gray_count];
     blacken_object(object);
+    if (++traced % GC_CLOCK_EVERY == 0 && now_us() >= deadline) {
+      return vm.gray_count == 0;
+    }
   }
+  return true;
 }
 
-static void sweep() {
-  Obj *previous = NULL;
-  Obj *object = vm.objects;
-  while (object != NULL) {
-    if (object->is_marked) {
-      object->is_marked = false;
-      previous = object;
-      object = object->next;
-    } else {
-      Obj *unreached = object;
-      object = object->next;
-      if (previous != NULL) {
-        previous->next = object;
+void remember_object(Obj *object) {
+  object->is_remembered = true;
+  if (vm.remembered_capacity < vm.remembered_count + 1) {
+    vm.remembered_capacity = GROW_CAPACITY(vm.remembered_capacity);
+    vm.remembered = (Obj **)realloc(vm.remembered,
+                                    sizeof(Obj *) * vm.remembered_capacity);
+    if (vm.remembered == NULL) {
+      exit(1);
+    }
+  }
+  vm.remembered[vm.remembered_count++] = object;
+}
+
+// Old objects written since the last collection count as roots for what
+// they point at; they are not marked themselves.
+static void mark_remembered() {
+  for (size_t i = 0; i < vm.remembered_count; ++i) {
+    blacken_object(vm.remembered[i]);
+  }
+}
+
+static void forget_remembered() {
+  for (size_t i = 0; i < vm.remembered_count; ++i) {
+    vm.remembered[i]->is_remembered = false;
+  }
+  vm.remembered_count = 0;
+}
+
+#ifdef DEBUG_LOG_GC
+static size_t bytes_before_gc;
+#endif /* ifdef DEBUG_LOG_GC */
+
+// Frees the objects in one bitmap word of arena that are allocated but not
+// marked, or, once the sweeping thread has scanned it, those its mark bits
+// now stand for. Either way the word is left with no marks.
+static void sweep_word(Arena *arena, size_t word) {
+  uint64_t dead = arena->scanned
+                      ? arena->marked[word]
+                      : arena->allocated[word] & ~arena->marked[word];
+  arena->marked[word] = 0;
+  while (dead != 0) {
+    size_t bit = word * 64 + (size_t)__builtin_ctzll(dead);
+    dead &= dead - 1;
+    free_object((Obj *)((uint8_t *)arena + bit * SLOT_ALIGN));
+  }
+}
+
+// Sweeps up to limit words of the pool's unswept arenas, taking off limit
+// what it swept; SIZE_MAX sweeps them all.
+static void sweep_pool(Pool *pool, size_t *limit) {
+  while (pool->unswept != NULL && *limit > 0) {
+    Arena *arena = pool->unswept;
+    sweep_word(arena, arena->swept_words++);
+    if (*limit != SIZE_MAX) {
+      (*limit)--;
+    }
+    if (arena->swept_words == BITMAP_WORDS) {
+      pool->unswept = arena->next_unswept;
+      arena->unswept = false;
+      arena->scanned = false;
+      arena->swept_words = 0;
+      if (!arena->available && has_room(arena)) {
+        make_available(pool, arena);
+      }
+    }
+  }
+}
+
+#ifdef BACKGROUND_SWEEP
+// The sweeping thread takes the unswept arenas over. It turns the mark
+// bits of each into those of the objects to free, which only the VM's
+// thread may do, and hands the arena back through scanned.
+static struct {
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t lock;
+  // Only the sweeping thread touches these while it runs.
+  Arena *unscanned[OBJ_TYPE_COUNT];
+  Arena *scanned[OBJ_TYPE_COUNT];
+  bool done;
+} sweeper = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void *sweep_thread(void *argument) {
+  (void)argument;
+  for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+    Arena *arena = sweeper.unscanned[i];
+    while (arena != NULL) {
+      Arena *next = arena->next_unswept;
+      for (size_t word = 0; word < BITMAP_WORDS; ++word) {
+        arena->marked[word] = arena->allocated[word] & ~arena->marked[word];
+      }
+      arena->scanned = true;
+      pthread_mutex_lock(&sweeper.lock);
+      arena->next_unswept = sweeper.scanned[i];
+      sweeper.scanned[i] = arena;
+      pthread_mutex_unlock(&sweeper.lock);
+      arena = next;
+    }
+    sweeper.unscanned[i] = NULL;
+  }
+  pthread_mutex_lock(&sweeper.lock);
+  sweeper.done = true;
+  pthread_mutex_unlock(&sweeper.lock);
+  return NULL;
+}
+
+// Moves the arenas the sweeping thread has scanned back to their pools,
+// where they are swept like any other. Returns whether the thread is done.
+static bool collect_swept(bool wait) {
+  if (wait) {
+    pthread_join(sweeper.thread, NULL);
+    sweeper.running = false;
+  }
+  Arena *scanned[OBJ_TYPE_COUNT];
+  pthread_mutex_lock(&sweeper.lock);
+  for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+    scanned[i] = sweeper.scanned[i];
+    sweeper.scanned[i] = NULL;
+  }
+  bool done = sweeper.done;
+  pthread_mutex_unlock(&sweeper.lock);
+  for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+    while (scanned[i] != NULL) {
+      Arena *next = scanned[i]->next_unswept;
+      scanned[i]->next_unswept = pools[i].unswept;
+      pools[i].unswept = scanned[i];
+      scanned[i] = next;
+    }
+  }
+  if (!done) {
+    return false;
+  }
+  if (sweeper.running) {
+    pthread_join(sweeper.thread, NULL);
+    sweeper.running = false;
+  }
+  return true;
+}
+#endif /* ifdef BACKGROUND_SWEEP */
+
+// Sweeping waits for allocation: the arenas holding objects are left
+// unswept, and freed of what the collection did not mark a few bitmap
+// words per allocation, or before the pool allocates from them.
+static void start_sweeping() {
+  // The young objects are swept with the old ones. The marked ones are old
+  // from here on, so minor collections leave them alone.
+  for (size_t i = 0; i < vm.young_count; ++i) {
+    if (is_marked(vm.young[i])) {
+      vm.young[i]->is_old = true;
+    }
+  }
+  vm.young_count = 0;
+  vm.young_bytes = 0;
+  vm.sweeping = true;
+  vm.next_gc = SIZE_MAX;
+  for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+    Pool *pool = &pools[i];
+    // Only empty arenas stay available.
+    Arena **link = &pool->available;
+    while (*link != NULL) {
+      if ((*link)->live > 0) {
+        (*link)->available = false;
+        *link = (*link)->next_available;
       } else {
-        vm.objects = object;
+        link = &(*link)->next_available;
+      }
+    }
+    for (Arena *arena = pool->arenas; arena != NULL; arena = arena->next) {
+      if (arena->live > 0) {
+        arena->unswept = true;
+        arena->next_unswept = pool->unswept;
+        pool->unswept = arena;
       }
-      free_object(unreached);
     }
   }
+#ifdef BACKGROUND_SWEEP
+  if (gc_sweep == SWEEP_BACKGROUND) {
+    for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+      sweeper.unscanned[i] = pools[i].unswept;
+      sweeper.scanned[i] = NULL;
+    }
+    sweeper.done = false;
+    if (pthread_create(&sweeper.thread, NULL, sweep_thread, NULL) == 0) {
+      sweeper.running = true;
+      for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+        pools[i].unswept = NULL;
+      }
+    }
+  }
+#endif /* ifdef BACKGROUND_SWEEP */
+  sweep_step(gc_sweep == SWEEP_EAGER ? SIZE_MAX : 0);
 }
 
-void collect_garbage() {
+// Sweeps up to limit bitmap words; SIZE_MAX finishes the sweep, waiting for
+// the sweeping thread if there is one. The next collection is due only
+// once the sweep is done, measured from what is left.
+static void sweep_step(size_t limit) {
+  bool swept = true;
+#ifdef BACKGROUND_SWEEP
+  if (sweeper.running) {
+    swept = collect_swept(limit == SIZE_MAX);
+  }
+#endif /* ifdef BACKGROUND_SWEEP */
+  for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+    sweep_pool(&pools[i], &limit);
+    if (pools[i].unswept != NULL) {
+      swept = false;
+    }
+  }
+  if (!swept) {
+    return;
+  }
+  vm.sweeping = false;
+  vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+
 #ifdef DEBUG_LOG_GC
-  printf("-- gc begin\n");
+  size_t before = bytes_before_gc;
+  printf("-- gc end\n");
+  printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+         before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc);
+#endif /* ifdef DEBUG_LOG_GC */
+}
+
+// Frees the young objects nothing reached and promotes the rest, so the
+// young generation is empty after every collection.
+static void sweep_young() {
+  for (size_t i = 0; i < vm.young_count; ++i) {
+    Obj *object = vm.young[i];
+    if (is_marked(object)) {
+      clear_mark(object);
+      object->is_old = true;
+    } else {
+      if (object->type == OBJ_STRING) {
+        table_delete(&vm.strings, (ObjString *)object);
+      }
+      free_object(object);
+    }
+  }
+  vm.young_count = 0;
+  vm.young_bytes = 0;
+}
+
+// Traces from the roots and the remembered set into the young generation
+// only, so it costs what survives rather than what the heap holds.
+static void collect_young() {
+#ifdef DEBUG_LOG_GC
+  printf("-- minor gc begin\n");
   size_t before = vm.bytes_allocated;
 #endif /* ifdef DEBUG_LOG_GC */
 
+  uint64_t start = now_us();
+  collecting_young = true;
   mark_roots();
-  trace_references();
-  table_remove_white(&vm.strings);
-  sweep();
-  vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+  mark_remembered();
+  trace_references(UINT64_MAX);
+  forget_remembered();
+  sweep_young();
+  collecting_young = false;
+  record_pause(PAUSE_MINOR, start);
 
 #ifdef DEBUG_LOG_GC
-  printf("-- gc end\n");
+  printf("-- minor gc end\n");
   printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
          before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc);
 #endif /* ifdef DEBUG_LOG_GC */
 }
 
+// Objects allocated while marking start out marked, so nothing traces
+// them; this traces the ones allocated since it last ran.
+static void trace_new_objects() {
+  for (size_t i = vm.young_traced; i < vm.young_count; ++i) {
+    blacken_object(vm.young[i]);
+  }
+  vm.young_traced = vm.young_count;
+}
+
+static void start_marking() {
+#ifdef DEBUG_LOG_GC
+  printf("-- gc begin\n");
+#endif /* ifdef DEBUG_LOG_GC */
+  if (vm.sweeping) {
+    sweep_step(SIZE_MAX);
+  }
+  vm.marking = true;
+  vm.young_traced = vm.young_count;
+#ifdef DEBUG_LOG_GC
+  bytes_before_gc = vm.bytes_allocated;
+#endif /* ifdef DEBUG_LOG_GC */
+  mark_roots();
+}
+
+// Marking runs from the roots as they were when it started. The stack,
+// locals and globals change without barriers, so they are traced again
+// here, with the objects written or allocated since. Only when that adds
+// nothing new before deadline does the collection sweep.
+static bool finish_marking(uint64_t deadline) {
+  mark_roots();
+  mark_remembered();
+  trace_new_objects();
+  if (!trace_references(deadline)) {
+    return false;
+  }
+  table_remove_white(&vm.strings);
+  forget_remembered();
+  vm.marking = false;
+  start_sweeping();
+  return true;
+}
+
+// One bounded step of an incremental collection, starting one if none is
+// running.
+static void mark_slice() {
+  uint64_t start = now_us();
+  uint64_t deadline = start + gc_pause_us;
+  if (!vm.marking) {
+    start_marking();
+  }
+  trace_new_objects();
+  if (trace_references(deadline) && now_us() < deadline) {
+    finish_marking(deadline);
+  }
+  vm.young_bytes = 0;
+  record_pause(PAUSE_SLICE, start);
+}
+
+void collect_garbage() {
+  uint64_t start = now_us();
+  if (!vm.marking) {
+    start_marking();
+  }
+  finish_marking(UINT64_MAX);
+  record_pause(PAUSE_MAJOR, start);
+}
+
+static int compare_pauses(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint32_t percentile(size_t percent) {
+  return stats.pauses[(stats.count - 1) * percent / 100];
+}
+
+static void print_gc_stats() {
+  fprintf(stderr, "gc: %zu pauses (%zu minor, %zu major, %zu slices)",
+          stats.count, stats.kinds[PAUSE_MINOR], stats.kinds[PAUSE_MAJOR],
+          stats.kinds[PAUSE_SLICE]);
+  if (stats.count > 0) {
+    qsort(stats.pauses, stats.count, sizeof(uint32_t), compare_pauses);
+    fprintf(stderr, ", p50 %uus p90 %uus p99 %uus max %uus", percentile(50),
+            percentile(90), percentile(99), stats.pauses[stats.count - 1]);
+  }
+  fprintf(stderr, "\n");
+}
+
 void free_objects() {
-  Obj *object = vm.objects;
-  while (object != NULL) {
-    Obj *next = object->next;
-    free_object(object);
-    object = next;
+  if (vm.sweeping) {
+    sweep_step(SIZE_MAX);
   }
+  for (size_t i = 0; i < OBJ_TYPE_COUNT; ++i) {
+    for (Arena *arena = pools[i].arenas; arena != NULL; arena = arena->next) {
+      for (size_t word = 0; word < BITMAP_WORDS; ++word) {
+        uint64_t left = arena->allocated[word];
+        while (left != 0) {
+          size_t bit = word * 64 + (size_t)__builtin_ctzll(left);
+          left &= left - 1;
+          free_object((Obj *)((uint8_t *)arena + bit * SLOT_ALIGN));
+        }
+      }
+    }
+  }
+  free_arenas();
+  free(vm.young);
+  vm.young = NULL;
+  vm.young_count = 0;
+  vm.young_capacity = 0;
+#ifdef PARALLEL_MARK
+  stop_markers();
+#endif /* ifdef PARALLEL_MARK */
   free(vm.gray_stack);
+  free(vm.remembered);
+  if (gc_stats) {
+    print_gc_stats();
+  }
+  free(stats.pauses);
+  stats.pauses = NULL;
+  stats.count = 0;
+  stats.capacity = 0;
 }
@@ -2,12 +2,16 @@
 
 #include "common.h"
 #include "object.h"
+#include "vm.h"
 
 #define ALLOCATE(type, count)                                                  \
   (type *)reallocate(NULL, 0, sizeof(type) * (count))
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+#define FREE_OBJ(type, pointer)                                                \
+  free_object_memory((Obj *)(pointer), sizeof(type))
+
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity)*2)
 #define GROW_ARRAY(type, pointer, old_count, new_count)                        \
   (type *)reallocate(pointer, sizeof(type) * (old_count),                      \
@@ -15,8 +19,46 @@
 #define FREE_ARRAY(type, pointer, old_count)                                   \
   reallocate(pointer, sizeof(type) * (old_count), 0)
 
+// Bytes allocated between minor collections, set by --nursery=<KiB>; 0
+// makes every collection a major one.
+extern size_t nursery_size;
+// The longest a slice of marking may run, set by --gc-pause=<us>; 0 stops
+// the world for every major collection.
+extern size_t gc_pause_us;
+// Threads marking a major collection that stops the world, set by
+// --gc-threads=<n>; needs a build with PARALLEL_MARK.
+extern size_t gc_threads;
+typedef enum SweepMode {
+  SWEEP_EAGER,
+  SWEEP_LAZY,
+  SWEEP_BACKGROUND
+} SweepMode;
+// How a major collection frees what it did not mark, set by
+// --gc-sweep=<eager|lazy|background>: all at once, a few bitmap words per
+// allocation, or scanning the bitmaps on a thread of its own, which needs
+// BACKGROUND_SWEEP.
+extern SweepMode gc_sweep;
+// Set by --gc-stats: report collection pauses when the VM is freed.
+extern bool gc_stats;
+
 void *reallocate(void *pointer, size_t old_size, size_t new_size);
+// Memory for an object from its type's pool: a slot off an arena's free
+// list, or the next one past its bump pointer. The object joins the young
+// generation, marked if a collection is marking.
+void *allocate_object_memory(ObjType type, size_t size);
+void free_object_memory(Obj *object, size_t size);
+// Whether the collection running has reached object.
+bool is_marked(Obj *object);
 void mark_object(Obj *object);
 void mark_value(Value value);
+void remember_object(Obj *object);
+// Call after storing a reference into object: an old object that may now
+// point at a young one has to be traced by the next minor collection, and
+// any object written during marking again before marking ends.
+static inline void write_barrier(Obj *object) {
+  if ((object->is_old || vm.marking) && !object->is_remembered) {
+    remember_object(object);
+  }
+}
 void collect_garbage();
 void free_objects();
@@ -15,11 +15,10 @@
   (type *)allocate_object(sizeof(type), object_type)
 
 static Obj *allocate_object(size_t size, ObjType type) {
-  Obj *object = (Obj *)reallocate(NULL, 0, size);
+  Obj *object = (Obj *)allocate_object_memory(type, size);
   object->type = type;
-  object->is_marked = false;
-  object->next = vm.objects;
-  vm.objects = object;
+  object->is_old = false;
+  object->is_remembered = false;
 
 #ifdef DEBUG_LOG_GC
   printf("%p allocat %zu for %d\n", (void *)object, size, type);
@@ -44,7 +43,14 @@ ObjFunction *new_function() {
   ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
   function->arity = 0;
   function->upvalue_count = 0;
+  function->local_count = 0;
   function->name = NULL;
+  function->hotness = 0;
+  function->jit = NULL;
+  function->aot = NULL;
+  function->pure = false;
+  function->no_memo = false;
+  function->memo = NULL;
   init_chunk(&function->chunk);
   return function;
 }
@@ -130,13 +136,6 @@ ObjString *copy_string(const char *chars, size_t length, bool strlit) {
   return allocate_string(heap_chars, length, hash, strlit);
 }
 
-ObjVariable *new_variable() {
-  ObjVariable *variable = ALLOCATE_OBJ(ObjVariable, OBJ_VARIABLE);
-  variable->name = NULL;
-  variable->value = NIL_VAL;
-  return variable;
-}
-
 ObjUpvalue *new_upvalue(Value *slot) {
   ObjUpvalue *upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
   upvalue->location = slot;
@@ -148,6 +147,7 @@ ObjUpvalue *new_upvalue(Value *slot) {
 ObjProcedure *new_procedure() {
   ObjProcedure *procedure = ALLOCATE_OBJ(ObjProcedure, OBJ_PROCEDURE);
   procedure->name = NULL;
+  procedure->closure = NULL;
   init_value_array(&procedure->stack);
   return procedure;
 }
@@ -155,6 +155,7 @@ ObjProcedure *new_procedure() {
 ObjOperation *new_operation() {
   ObjOperation *operation = ALLOCATE_OBJ(ObjOperation, OBJ_OPERATION);
   operation->type = NULL;
+  operation->code = OP_RETURN;
   return operation;
 }
 
@@ -188,12 +189,6 @@ void print_object(Value value) {
   case OBJ_STRING:
     printf("%s", AS_CSTRING(value));
     break;
-  case OBJ_VARIABLE: {
-    printf("%s={", AS_VARIABLE(value)->name->chars);
-    print_value(AS_VARIABLE(value)->value);
-    printf("}");
-    break;
-  }
   case OBJ_PROCEDURE:
     print_procedure(AS_PROCEDURE(value));
     break;
@@ -12,7 +12,6 @@
 #define IS_CLOSURE(value) is_obj_type(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
-#define IS_VARIABLE(value) is_obj_type(value, OBJ_VARIABLE)
 #define IS_PROCEDURE(value) is_obj_type(value, OBJ_PROCEDURE)
 #define IS_OPERATION(value) is_obj_type(value, OBJ_OPERATION)
 
@@ -20,7 +19,6 @@
 #define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
-#define AS_VARIABLE(value) ((ObjVariable *)AS_OBJ(value))
 #define AS_PROCEDURE(value) ((ObjProcedure *)AS_OBJ(value))
 #define AS_OPERATION(value) ((ObjOperation *)AS_OBJ(value))
 
@@ -29,48 +27,69 @@ typedef enum ObjType {
   OBJ_FUNCTION,
   OBJ_STRING,
   OBJ_UPVALUE,
-  OBJ_VARIABLE,
   OBJ_PROCEDURE,
   OBJ_OPERATION
 } ObjType;
 
+// Mark bits live in bitmaps beside the objects, and the collector finds
+// objects through its arenas, so the header is three bytes; the fields of
+// each object type start with those that fit in the padding after it.
 struct Obj {
-  ObjType type;
-  bool is_marked;
-  struct Obj *next;
+  // An ObjType.
+  uint8_t type;
+  // Survived a collection; only major collections trace it.
+  bool is_old;
+  // On the remembered set until the next collection.
+  bool is_remembered;
 };
 
+struct ObjFunction;
+
+// Native code for a function compiled ahead of time: runs from ip, a segment
+// start, and returns where the interpreter has to carry on.
+typedef uint8_t *(*AotFn)(struct ObjFunction *function, uint8_t *ip);
+
 typedef struct ObjFunction {
   Obj obj;
+  // How often the function was entered before the JIT compiled it.
+  uint32_t hotness;
   size_t arity;
   size_t upvalue_count;
+  // Slots its frame needs for names bound with 'let'.
+  size_t local_count;
   Chunk chunk;
   ObjString *name;
+  struct JitCode *jit;
+  AotFn aot;
+  // No I/O and no writes to globals in the chunk itself; memo_prepare()
+  // sets it when a procedure is defined.
+  bool pure;
+  // Set by a '(nomemo)' pragma in the body.
+  bool no_memo;
+  struct MemoTable *memo;
 } ObjFunction;
 
 typedef Value (*NativeFn)(size_t arg_count, Value *args);
 
 struct ObjString {
   Obj obj;
+  uint32_t hash;
   size_t length;
   char *chars;
-  uint32_t hash;
 };
 
-typedef struct {
-  Obj obj;
-  ObjString *name;
-  Value value;
-} ObjVariable;
+typedef struct ObjClosure ObjClosure;
 
 typedef struct {
   Obj obj;
   Value_Array stack;
   ObjString *name;
+  ObjClosure *closure;
 } ObjProcedure;
 
 typedef struct {
   Obj obj;
+  Op_Code code;
   ObjString *type;
 } ObjOperation;
 
@@ -81,18 +100,17 @@ typedef struct ObjUpvalue {
   struct ObjUpvalue *next;
 } ObjUpvalue;
 
-typedef struct {
+struct ObjClosure {
   Obj obj;
   ObjFunction *function;
   ObjUpvalue **upvalues;
   size_t upvalue_count;
-} ObjClosure;
+};
 
 ObjClosure *new_closure(ObjFunction *function);
 ObjFunction *new_function();
 ObjString *take_string(char *chars, size_t length);
 ObjString *copy_string(const char *chars, size_t length, bool str_lit);
-ObjVariable *new_variable();
 ObjUpvalue *new_upvalue(Value *slot);
 ObjProcedure *new_procedure();
 ObjOperation *new_operation();
@@ -0,0 +1,470 @@
+#include "optimizer.h"
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int optimization_level = 1;
+
+typedef struct Instruction {
+  uint8_t code;
+  uint16_t operand;
+  // The constant of an OP_INLINE, whose operand is its slot.
+  uint8_t callee;
+  size_t line;
+  size_t offset;
+  size_t target;
+  bool is_target;
+  bool dead;
+} Instruction;
+
+typedef struct Optimizer {
+  Chunk *chunk;
+  Instruction *code;
+  size_t count;
+} Optimizer;
+
+// Superinstructions, picked from DEBUG_PROFILE_OPCODES runs: a constant,
+// variable or local feeding a binary operator, a variable feeding '=', and
+// negation pairs.
+uint8_t fused_instruction(uint8_t previous, uint8_t instruction) {
+  if (previous == OP_CONSTANT || previous == OP_VARIABLE) {
+    bool constant = previous == OP_CONSTANT;
+    switch (instruction) {
+    case OP_ADD:
+      return constant ? OP_ADD_CONSTANT : OP_ADD_VARIABLE;
+    case OP_SUBTRACT:
+      return constant ? OP_SUBTRACT_CONSTANT : OP_SUBTRACT_VARIABLE;
+    case OP_MULTIPLY:
+      return constant ? OP_MULTIPLY_CONSTANT : OP_MULTIPLY_VARIABLE;
+    case OP_DIVIDE:
+      return constant ? OP_DIVIDE_CONSTANT : OP_DIVIDE_VARIABLE;
+    case OP_GREATER:
+      return constant ? OP_GREATER_CONSTANT : OP_GREATER_VARIABLE;
+    case OP_LESS:
+      return constant ? OP_LESS_CONSTANT : OP_LESS_VARIABLE;
+    case OP_GREATER_EQUAL:
+      return constant ? OP_GREATER_EQUAL_CONSTANT : OP_GREATER_EQUAL_VARIABLE;
+    case OP_LESS_EQUAL:
+      return constant ? OP_LESS_EQUAL_CONSTANT : OP_LESS_EQUAL_VARIABLE;
+    case OP_SET_VARIABLE:
+      return constant ? instruction : OP_SET_GLOBAL;
+    }
+  }
+  if (previous == OP_GET_LOCAL) {
+    switch (instruction) {
+    case OP_ADD:
+      return OP_ADD_LOCAL;
+    case OP_SUBTRACT:
+      return OP_SUBTRACT_LOCAL;
+    case OP_MULTIPLY:
+      return OP_MULTIPLY_LOCAL;
+    case OP_DIVIDE:
+      return OP_DIVIDE_LOCAL;
+    case OP_GREATER:
+      return OP_GREATER_LOCAL;
+    case OP_LESS:
+      return OP_LESS_LOCAL;
+    case OP_GREATER_EQUAL:
+      return OP_GREATER_EQUAL_LOCAL;
+    case OP_LESS_EQUAL:
+      return OP_LESS_EQUAL_LOCAL;
+    }
+  }
+  if (instruction == OP_NOT) {
+    switch (previous) {
+    case OP_EQUAL:
+      return OP_NOT_EQUAL;
+    case OP_NOT_EQUAL:
+      return OP_EQUAL;
+    case OP_NOT:
+      return OP_TRUTHY;
+    case OP_TRUTHY:
+      return OP_NOT;
+    }
+  }
+  if (instruction == OP_TRUTHY) {
+    switch (previous) {
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_NOT:
+    case OP_TRUTHY:
+      return previous;
+    }
+  }
+  return instruction;
+}
+
+static bool is_jump(uint8_t code) {
+  return code == OP_JUMP || code == OP_JUMP_IF_FALSE || code == OP_LOOP;
+}
+
+// Instructions that may send control to instruction->target.
+static bool has_target(uint8_t code) {
+  return is_jump(code) || code == OP_INLINE;
+}
+
+static bool is_push(uint8_t code) {
+  return code == OP_CONSTANT || code == OP_VARIABLE ||
+         code == OP_PUSH_OPERATION || code == OP_GET_LOCAL;
+}
+
+static bool is_falsey(Value value) {
+  return IS_NIL(value) || (IS_NUMBER(value) && AS_NUMBER(value) == 0.0) ||
+         (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+// The binary operator behind an instruction that takes its right operand
+// from the constant table, or the instruction itself.
+static uint8_t constant_operator(uint8_t code) {
+  switch (code) {
+  case OP_ADD_CONSTANT:
+    return OP_ADD;
+  case OP_SUBTRACT_CONSTANT:
+    return OP_SUBTRACT;
+  case OP_MULTIPLY_CONSTANT:
+    return OP_MULTIPLY;
+  case OP_DIVIDE_CONSTANT:
+    return OP_DIVIDE;
+  case OP_GREATER_CONSTANT:
+    return OP_GREATER;
+  case OP_LESS_CONSTANT:
+    return OP_LESS;
+  case OP_GREATER_EQUAL_CONSTANT:
+    return OP_GREATER_EQUAL;
+  case OP_LESS_EQUAL_CONSTANT:
+    return OP_LESS_EQUAL;
+  default:
+    return code;
+  }
+}
+
+// Computes 'a b op' the way run() would. Only numbers are folded, and only
+// through operators that never fail or allocate.
+static bool fold(uint8_t code, Value a, Value b, Value *result) {
+  if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+    return false;
+  }
+  switch (code) {
+  case OP_ADD:
+    *result = add_numbers(a, b);
+    return true;
+  case OP_SUBTRACT:
+    *result = subtract_numbers(a, b);
+    return true;
+  case OP_MULTIPLY:
+    *result = multiply_numbers(a, b);
+    return true;
+  case OP_DIVIDE:
+    *result = divide_numbers(a, b);
+    return true;
+  case OP_GREATER:
+    *result = greater_numbers(a, b);
+    return true;
+  case OP_LESS:
+    *result = less_numbers(a, b);
+    return true;
+  case OP_GREATER_EQUAL:
+    *result = greater_equal_numbers(a, b);
+    return true;
+  case OP_LESS_EQUAL:
+    *result = less_equal_numbers(a, b);
+    return true;
+  case OP_EQUAL:
+    *result = BOOL_VAL(values_equal(a, b));
+    return true;
+  case OP_NOT_EQUAL:
+    *result = BOOL_VAL(!values_equal(a, b));
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void decode(Optimizer *optimizer) {
+  Chunk *chunk = optimizer->chunk;
+  optimizer->code = malloc(sizeof(Instruction) * chunk->count);
+  optimizer->count = 0;
+  size_t *index = malloc(sizeof(size_t) * (chunk->count + 1));
+  if (optimizer->code == NULL || index == NULL) {
+    exit(1);
+  }
+  for (size_t offset = 0; offset < chunk->count;) {
+    Instruction *instruction = &optimizer->code[optimizer->count];
+    size_t length = instruction_length(chunk->code[offset]);
+    instruction->code = chunk->code[offset];
+    instruction->operand = 0;
+    if (length == 2) {
+      instruction->operand = chunk->code[offset + 1];
+    } else if (length >= 3) {
+      instruction->operand =
+          (uint16_t)(chunk->code[offset + 1] << 8 | chunk->code[offset + 2]);
+    }
+    if (instruction->code == OP_INLINE) {
+      instruction->callee = chunk->code[offset + 3];
+      // The length of the inlined copy, until it is turned into a target.
+      instruction->target = (size_t)(chunk->code[offset + 4] << 8 |
+                                     chunk->code[offset + 5]);
+    }
+    instruction->line = chunk->lines[offset];
+    instruction->offset = offset;
+    instruction->dead = false;
+    index[offset] = optimizer->count++;
+    offset += length;
+  }
+  index[chunk->count] = optimizer->count;
+  for (size_t i = 0; i < optimizer->count; ++i) {
+    Instruction *instruction = &optimizer->code[i];
+    if (instruction->code == OP_LOOP) {
+      instruction->target =
+          index[instruction->offset + 3 - instruction->operand];
+    } else if (is_jump(instruction->code)) {
+      instruction->target =
+          index[instruction->offset + 3 + instruction->operand];
+    } else if (instruction->code == OP_INLINE) {
+      instruction->target =
+          index[instruction->offset + 6 + instruction->target];
+    }
+  }
+  free(index);
+}
+
+static size_t next_live(Optimizer *optimizer, size_t i) {
+  while (i < optimizer->count && optimizer->code[i].dead) {
+    i++;
+  }
+  return i;
+}
+
+static void mark_targets(Optimizer *optimizer) {
+  for (size_t i = 0; i < optimizer->count; ++i) {
+    optimizer->code[i].is_target = false;
+  }
+  for (size_t i = 0; i < optimizer->count; ++i) {
+    Instruction *instruction = &optimizer->code[i];
+    if (!instruction->dead && has_target(instruction->code)) {
+      instruction->target = next_live(optimizer, instruction->target);
+      if (instruction->target < optimizer->count) {
+        optimizer->code[instruction->target].is_target = true;
+      }
+    }
+  }
+}
+
+static Value constant(Optimizer *optimizer, Instruction *instruction) {
+  return optimizer->chunk->constants.value[instruction->operand];
+}
+
+static bool same_constant(Value a, Value b) {
+  if (IS_INT(a) || IS_INT(b)) {
+    return IS_INT(a) && IS_INT(b) && AS_INT(a) == AS_INT(b);
+  }
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    // Bitwise, so 0 and -0 stay apart.
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    return memcmp(&x, &y, sizeof(double)) == 0;
+  }
+  return IS_BOOL(a) && IS_BOOL(b) && AS_BOOL(a) == AS_BOOL(b);
+}
+
+// Points the instruction at a constant holding the value, reusing an
+// existing one so folding does not eat into the 256-entry table.
+static bool make_constant(Optimizer *optimizer, Instruction *instruction,
+                          Value value) {
+  Value_Array *constants = &optimizer->chunk->constants;
+  size_t index = 0;
+  while (index < constants->count &&
+         !same_constant(constants->value[index], value)) {
+    index++;
+  }
+  if (index > UINT8_MAX) {
+    return false;
+  }
+  if (index == constants->count) {
+    add_constant(optimizer->chunk, value);
+  }
+  instruction->code = OP_CONSTANT;
+  instruction->operand = (uint16_t)index;
+  return true;
+}
+
+// Rewrites the instruction at i together with the live ones after it in the
+// same basic block. Returns whether anything changed.
+static bool peephole(Optimizer *optimizer, size_t i) {
+  Instruction *a = &optimizer->code[i];
+  size_t j = next_live(optimizer, i + 1);
+  if (a->code == OP_JUMP && a->target == j) {
+    a->dead = true;
+    return true;
+  }
+  if (a->code == OP_JUMP || a->code == OP_LOOP || a->code == OP_RETURN) {
+    // Nothing falls through, so everything up to the next jump target is
+    // unreachable.
+    bool changed = false;
+    for (; j < optimizer->count && !optimizer->code[j].is_target; ++j) {
+      changed |= !optimizer->code[j].dead;
+      optimizer->code[j].dead = true;
+    }
+    return changed;
+  }
+  if ((a->code == OP_JUMP || a->code == OP_JUMP_IF_FALSE) &&
+      a->target < optimizer->count &&
+      optimizer->code[a->target].code == OP_JUMP &&
+      a->target != optimizer->code[a->target].target) {
+    a->target = optimizer->code[a->target].target;
+    return true;
+  }
+  if (j >= optimizer->count || optimizer->code[j].is_target) {
+    return false;
+  }
+  Instruction *b = &optimizer->code[j];
+
+  if (a->code == OP_CONSTANT) {
+    Value value;
+    if (constant_operator(b->code) != b->code &&
+        fold(constant_operator(b->code), constant(optimizer, a),
+             constant(optimizer, b), &value) &&
+        make_constant(optimizer, a, value)) {
+      b->dead = true;
+      return true;
+    }
+    if (b->code == OP_NOT || b->code == OP_TRUTHY) {
+      bool falsey = is_falsey(constant(optimizer, a));
+      if (make_constant(optimizer, a,
+                        BOOL_VAL(b->code == OP_NOT ? falsey : !falsey))) {
+        b->dead = true;
+        return true;
+      }
+    }
+    if (b->code == OP_JUMP_IF_FALSE) {
+      // A constant condition always goes the same way.
+      if (is_falsey(constant(optimizer, a))) {
+        b->code = OP_JUMP;
+      } else {
+        b->dead = true;
+      }
+      a->dead = true;
+      return true;
+    }
+  }
+  if (((a->code == OP_VARIABLE && b->code == OP_SET_GLOBAL) ||
+       (a->code == OP_GET_LOCAL && b->code == OP_SET_LOCAL)) &&
+      a->operand == b->operand) {
+    // 'x x =' stores x back into itself.
+    a->dead = true;
+    b->dead = true;
+    return true;
+  }
+  if (((is_push(a->code) || a->code == OP_DUP) && b->code == OP_DROP) ||
+      (a->code == OP_SWAP && b->code == OP_SWAP)) {
+    a->dead = true;
+    b->dead = true;
+    return true;
+  }
+  if (a->code == OP_TRUTHY && b->code == OP_JUMP_IF_FALSE) {
+    a->dead = true;
+    return true;
+  }
+  uint8_t fused = fused_instruction(a->code, b->code);
+  if (fused != b->code) {
+    a->code = fused;
+    b->dead = true;
+    return true;
+  }
+
+  size_t k = next_live(optimizer, j + 1);
+  if (k >= optimizer->count || optimizer->code[k].is_target) {
+    return false;
+  }
+  Instruction *c = &optimizer->code[k];
+  Value value;
+  if (a->code == OP_CONSTANT && b->code == OP_CONSTANT &&
+      fold(c->code, constant(optimizer, a), constant(optimizer, b), &value) &&
+      make_constant(optimizer, a, value)) {
+    b->dead = true;
+    c->dead = true;
+    return true;
+  }
+  return false;
+}
+
+static void encode(Optimizer *optimizer) {
+  Chunk *chunk = optimizer->chunk;
+  size_t *offsets = malloc(sizeof(size_t) * (optimizer->count + 1));
+  if (offsets == NULL) {
+    exit(1);
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < optimizer->count; ++i) {
+    offsets[i] = offset;
+    if (!optimizer->code[i].dead) {
+      offset += instruction_length(optimizer->code[i].code);
+    }
+  }
+  offsets[optimizer->count] = offset;
+
+  for (size_t i = 0; i < optimizer->count; ++i) {
+    Instruction *instruction = &optimizer->code[i];
+    if (instruction->dead) {
+      continue;
+    }
+    uint8_t *code = &chunk->code[offsets[i]];
+    size_t length = instruction_length(instruction->code);
+    uint16_t operand = instruction->operand;
+    if (instruction->code == OP_LOOP) {
+      operand = (uint16_t)(offsets[i] + 3 - offsets[instruction->target]);
+    } else if (is_jump(instruction->code)) {
+      operand = (uint16_t)(offsets[instruction->target] - offsets[i] - 3);
+    }
+    code[0] = instruction->code;
+    if (length == 2) {
+      code[1] = (uint8_t)operand;
+    } else if (length >= 3) {
+      code[1] = (operand >> 8) & 0xff;
+      code[2] = operand & 0xff;
+    }
+    if (instruction->code == OP_INLINE) {
+      uint16_t jump = (uint16_t)(offsets[instruction->target] - offsets[i] - 6);
+      code[3] = instruction->callee;
+      code[4] = (jump >> 8) & 0xff;
+      code[5] = jump & 0xff;
+    }
+    for (size_t byte = 0; byte < length; ++byte) {
+      chunk->lines[offsets[i] + byte] = instruction->line;
+    }
+  }
+  chunk->count = offset;
+  free(offsets);
+}
+
+// Folds constant arithmetic, comparisons, negations and branches, drops
+// pushes whose value is immediately thrown away, re-fuses what folding
+// exposes, threads jumps and removes unreachable code. Rewrites stay inside
+// basic blocks; jump offsets are recomputed when the chunk is re-encoded.
+void optimize_chunk(Chunk *chunk) {
+  if (optimization_level < 1 || chunk->count == 0) {
+    return;
+  }
+  Optimizer optimizer;
+  optimizer.chunk = chunk;
+  decode(&optimizer);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    mark_targets(&optimizer);
+    for (size_t i = 0; i < optimizer.count; ++i) {
+      if (!optimizer.code[i].dead && peephole(&optimizer, i)) {
+        changed = true;
+        mark_targets(&optimizer);
+      }
+    }
+  }
+  mark_targets(&optimizer);
+  encode(&optimizer);
+  free(optimizer.code);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+
+// 0 emits one instruction per token; 1 (the default) fuses instructions as
+// they are emitted and runs optimize_chunk() over every finished chunk.
+extern int optimization_level;
+
+uint8_t fused_instruction(uint8_t previous, uint8_t instruction);
+void optimize_chunk(Chunk *chunk);
@@ -112,10 +112,38 @@ static TokenType identifier_type() {
   switch (scanner.start[0]) {
   case 'a':
     return check_keyword(1, 2, "nd", TOKEN_AND);
+  case 'd':
+    if (scanner.current - scanner.start > 1) {
+      switch (scanner.start[1]) {
+      case 'u':
+        return check_keyword(2, 1, "p", TOKEN_DUP);
+      case 'r':
+        return check_keyword(2, 2, "op", TOKEN_DROP);
+      }
+    }
+    break;
   case 'i':
     return check_keyword(1, 1, "f", TOKEN_IF);
+  case 'l':
+    return check_keyword(1, 2, "et", TOKEN_LET);
+  case 'n':
+    return check_keyword(1, 5, "omemo", TOKEN_NOMEMO);
   case 'o':
-    return check_keyword(1, 1, "r", TOKEN_OR);
+    if (scanner.current - scanner.start > 1) {
+      switch (scanner.start[1]) {
+      case 'r':
+        return check_keyword(1, 1, "r", TOKEN_OR);
+      case 'v':
+        return check_keyword(2, 2, "er", TOKEN_OVER);
+      }
+    }
+    break;
+  case 'p':
+    return check_keyword(1, 3, "ick", TOKEN_PICK);
+  case 'r':
+    return check_keyword(1, 2, "ot", TOKEN_ROT);
+  case 's':
+    return check_keyword(1, 3, "wap", TOKEN_SWAP);
   case 'w':
     return check_keyword(1, 4, "hile", TOKEN_WHILE);
   case 'f':
@@ -143,8 +171,9 @@ static Token number() {
     while (is_digit(peek())) {
       advance();
     }
+    return make_token(TOKEN_NUMBER);
   }
-  return make_token(TOKEN_NUMBER);
+  return make_token(TOKEN_INTEGER);
 }
 
 static Token string() {
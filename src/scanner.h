@@ -28,6 +28,7 @@ typedef enum TokenType {
   TOKEN_IDENTIFIER,
   TOKEN_STRING,
   TOKEN_NUMBER,
+  TOKEN_INTEGER,
 
   TOKEN_AND,
   TOKEN_FALSE,
@@ -38,6 +39,15 @@ typedef enum TokenType {
   TOKEN_ARROW,
   TOKEN_COLON,
 
+  TOKEN_DUP,
+  TOKEN_SWAP,
+  TOKEN_DROP,
+  TOKEN_OVER,
+  TOKEN_ROT,
+  TOKEN_PICK,
+  TOKEN_LET,
+  TOKEN_NOMEMO,
+
   TOKEN_ERROR,
   TOKEN_EOF
 } TokenType;
@@ -138,7 +138,7 @@ ObjString *table_find_string(Table *table, const char *chars, size_t length,
 void table_remove_white(Table *table) {
   for (size_t i = 0; i < table->capacity; ++i) {
     Entry *entry = &table->entries[i];
-    if (entry->key != NULL && !entry->key->obj.is_marked) {
+    if (entry->key != NULL && !is_marked((Obj *)entry->key)) {
       table_delete(table, entry->key);
     }
   }
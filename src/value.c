@@ -1,4 +1,5 @@
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -7,6 +8,7 @@
 #include "memory.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 
 bool values_equal(Value a, Value b) {
 #ifdef NAN_BOXING
@@ -15,6 +17,9 @@ bool values_equal(Value a, Value b) {
   }
   return a == b;
 #else
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    return AS_NUMBER(a) == AS_NUMBER(b);
+  }
   if (a.type != b.type) {
     return false;
   }
@@ -23,8 +28,8 @@ bool values_equal(Value a, Value b) {
     return AS_BOOL(a) == AS_BOOL(b);
   case VAL_NIL:
     return true;
-  case VAL_NUMBER:
-    return AS_NUMBER(a) == AS_NUMBER(b);
+  case VAL_VARIABLE:
+    return AS_VARIABLE(a) == AS_VARIABLE(b);
   case VAL_OBJ:
     return AS_OBJ(a) == AS_OBJ(b);
   default:
@@ -54,14 +59,24 @@ void free_value_array(Value_Array *arr) {
   init_value_array(arr);
 }
 
+static void print_variable(Value value) {
+  printf("%s={", AS_CSTRING(vm.global_names.value[AS_VARIABLE(value)]));
+  print_value(vm.global_values.value[AS_VARIABLE(value)]);
+  printf("}");
+}
+
 void print_value(Value value) {
 #ifdef NAN_BOXING
   if (IS_BOOL(value)) {
     printf(AS_BOOL(value) ? "true" : "false");
   } else if (IS_NIL(value)) {
     printf("nil");
+  } else if (IS_INT(value)) {
+    printf("%" PRId64, AS_INT(value));
   } else if (IS_NUMBER(value)) {
     printf("%g", AS_NUMBER(value));
+  } else if (IS_VARIABLE(value)) {
+    print_variable(value);
   } else if (IS_OBJ(value)) {
     print_object(value);
   }
@@ -76,6 +91,12 @@ void print_value(Value value) {
   case VAL_NUMBER:
     printf("%g", AS_NUMBER(value));
     break;
+  case VAL_INT:
+    printf("%" PRId64, AS_INT(value));
+    break;
+  case VAL_VARIABLE:
+    print_variable(value);
+    break;
   case VAL_OBJ:
     print_object(value);
     break;
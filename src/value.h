@@ -14,24 +14,41 @@ typedef struct ObjString ObjString;
 #define TAG_NIL 1
 #define TAG_FALSE 2
 #define TAG_TRUE 3
+#define TAG_VARIABLE 4
+#define TAG_MASK 7
+
+// Ints are a quiet NaN with bit 49 set over a 48-bit two's complement
+// payload. Nothing else uses bit 49, and the CPU never produces it.
+#define INT_TAG ((uint64_t)0x7ffe000000000000)
+#define HIGH_MASK ((uint64_t)0xffff000000000000)
 
 typedef uint64_t Value;
 
 #define IS_BOOL(value) ((value | 1) == TRUE_VAL)
 #define IS_NIL(value) ((value) == NIL_VAL)
-#define IS_NUMBER(value) (((value)&QNAN) != QNAN)
+#define IS_INT(value) (((value)&HIGH_MASK) == INT_TAG)
+#define IS_DOUBLE(value) (((value)&QNAN) != QNAN)
+#define IS_NUMBER(value) (IS_DOUBLE(value) || IS_INT(value))
 #define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_VARIABLE(value)                                                     \
+  (((value) & (HIGH_MASK | TAG_MASK)) == (QNAN | TAG_VARIABLE))
 
 #define AS_BOOL(value) ((value) == TRUE_VAL)
-#define AS_NUMBER(value) value_to_num(value)
+#define AS_INT(value) ((int64_t)((value) << 16) >> 16)
+#define AS_DOUBLE(value) value_to_num(value)
+#define AS_NUMBER(value) value_to_number(value)
 #define AS_OBJ(value) ((Obj *)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+#define AS_VARIABLE(value) ((size_t)(((value) & ~(SIGN_BIT | QNAN)) >> 3))
 
 #define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
 #define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define INT_VAL(i) ((Value)(INT_TAG | ((uint64_t)(i) & ~HIGH_MASK)))
 #define NUMBER_VAL(num) num_to_value(num)
 #define OBJ_VAL(obj) (Value)(SIGN_BIT | QNAN | (uintptr_t)(obj))
+#define VARIABLE_VAL(slot)                                                     \
+  ((Value)(QNAN | ((uint64_t)(slot) << 3) | TAG_VARIABLE))
 
 static inline double value_to_num(Value value) {
   double num;
@@ -45,34 +62,147 @@ static inline Value num_to_value(double num) {
   return value;
 }
 
+static inline double value_to_number(Value value) {
+  return IS_INT(value) ? (double)AS_INT(value) : value_to_num(value);
+}
+
 #else
 
-typedef enum ValueType { VAL_BOOL, VAL_NIL, VAL_NUMBER, VAL_OBJ } ValueType;
+typedef enum ValueType {
+  VAL_BOOL,
+  VAL_NIL,
+  VAL_NUMBER,
+  VAL_INT,
+  VAL_VARIABLE,
+  VAL_OBJ
+} ValueType;
 
 typedef struct Value {
   ValueType type;
   union {
     bool boolean;
     double number;
+    int64_t integer;
+    size_t slot;
     Obj *obj;
   } as;
 } Value;
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
-#define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_INT(value) ((value).type == VAL_INT)
+#define IS_DOUBLE(value) ((value).type == VAL_NUMBER)
+#define IS_NUMBER(value) (IS_DOUBLE(value) || IS_INT(value))
+#define IS_VARIABLE(value) ((value).type == VAL_VARIABLE)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
 #define AS_OBJ(value) ((value).as.obj)
 #define AS_BOOL(value) ((value).as.boolean)
-#define AS_NUMBER(value) ((value).as.number)
+#define AS_INT(value) ((value).as.integer)
+#define AS_DOUBLE(value) ((value).as.number)
+#define AS_NUMBER(value) value_to_number(value)
+#define AS_VARIABLE(value) ((value).as.slot)
 
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = value}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define VARIABLE_VAL(value) ((Value){VAL_VARIABLE, {.slot = value}})
 #define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj *)object}})
+
+static inline double value_to_number(Value value) {
+  return IS_INT(value) ? (double)AS_INT(value) : value.as.number;
+}
 #endif
 
+// Ints hold 48 bits in either representation, so both behave the same.
+#define INT_MAX_VALUE (((int64_t)1 << 47) - 1)
+#define INT_MIN_VALUE (-((int64_t)1 << 47))
+
+// Arithmetic on two numbers. Ints stay ints while the result is an exact
+// int in range and become doubles otherwise; comparisons give 0 or 1.
+static inline Value int_result(int64_t result) {
+  if (result < INT_MIN_VALUE || result > INT_MAX_VALUE) {
+    return NUMBER_VAL((double)result);
+  }
+  return INT_VAL(result);
+}
+
+// The int halves take two ints and the double halves two doubles, for
+// callers that have already checked.
+static inline Value add_ints(Value a, Value b) {
+  return int_result(AS_INT(a) + AS_INT(b));
+}
+
+static inline Value subtract_ints(Value a, Value b) {
+  return int_result(AS_INT(a) - AS_INT(b));
+}
+
+static inline Value multiply_ints(Value a, Value b) {
+  int64_t product;
+  if (__builtin_mul_overflow(AS_INT(a), AS_INT(b), &product)) {
+    return NUMBER_VAL((double)AS_INT(a) * (double)AS_INT(b));
+  }
+  return int_result(product);
+}
+
+static inline Value divide_ints(Value a, Value b) {
+  int64_t x = AS_INT(a);
+  int64_t y = AS_INT(b);
+  if (y != 0 && x % y == 0) {
+    return int_result(x / y);
+  }
+  return NUMBER_VAL((double)x / (double)y);
+}
+
+static inline Value add_doubles(double a, double b) {
+  return NUMBER_VAL(a + b);
+}
+
+static inline Value subtract_doubles(double a, double b) {
+  return NUMBER_VAL(a - b);
+}
+
+static inline Value multiply_doubles(double a, double b) {
+  return NUMBER_VAL(a * b);
+}
+
+static inline Value divide_doubles(double a, double b) {
+  return NUMBER_VAL(a / b);
+}
+
+#define COMPARE(name, op)                                                      \
+  static inline Value name##_ints(Value a, Value b) {                          \
+    return INT_VAL(AS_INT(a) op AS_INT(b));                                    \
+  }                                                                            \
+  static inline Value name##_doubles(double a, double b) {                     \
+    return INT_VAL(a op b);                                                    \
+  }
+
+COMPARE(greater, >)
+COMPARE(less, <)
+COMPARE(greater_equal, >=)
+COMPARE(less_equal, <=)
+#undef COMPARE
+
+#define NUMBERS(name)                                                          \
+  static inline Value name##_numbers(Value a, Value b) {                       \
+    if (IS_INT(a) && IS_INT(b)) {                                              \
+      return name##_ints(a, b);                                                \
+    }                                                                          \
+    return name##_doubles(AS_NUMBER(a), AS_NUMBER(b));                         \
+  }
+
+NUMBERS(add)
+NUMBERS(subtract)
+NUMBERS(multiply)
+NUMBERS(divide)
+NUMBERS(greater)
+NUMBERS(less)
+NUMBERS(greater_equal)
+NUMBERS(less_equal)
+#undef NUMBERS
+
 typedef struct Value_Array {
   size_t capacity;
   size_t count;
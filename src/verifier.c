@@ -0,0 +1,335 @@
+#include "verifier.h"
+#include "chunk.h"
+#include "common.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct Work {
+  size_t offset;
+  long low;
+  long high;
+} Work;
+
+typedef struct Verifier {
+  Chunk *chunk;
+  bool *boundary;
+  // Depth range seen at each offset during the current segment walk,
+  // relative to the segment's start.
+  long *low;
+  long *high;
+  size_t *stamp;
+  Work *work;
+  size_t work_count;
+  size_t work_capacity;
+} Verifier;
+
+static bool is_constant_operand(uint8_t code) {
+  switch (code) {
+  case OP_CONSTANT:
+  case OP_ADD_CONSTANT:
+  case OP_SUBTRACT_CONSTANT:
+  case OP_MULTIPLY_CONSTANT:
+  case OP_DIVIDE_CONSTANT:
+  case OP_GREATER_CONSTANT:
+  case OP_LESS_CONSTANT:
+  case OP_GREATER_EQUAL_CONSTANT:
+  case OP_LESS_EQUAL_CONSTANT:
+  case OP_ADD_CONSTANT_INT:
+  case OP_SUBTRACT_CONSTANT_INT:
+  case OP_MULTIPLY_CONSTANT_INT:
+  case OP_DIVIDE_CONSTANT_INT:
+  case OP_GREATER_CONSTANT_INT:
+  case OP_LESS_CONSTANT_INT:
+  case OP_GREATER_EQUAL_CONSTANT_INT:
+  case OP_LESS_EQUAL_CONSTANT_INT:
+  case OP_ADD_CONSTANT_DOUBLE:
+  case OP_SUBTRACT_CONSTANT_DOUBLE:
+  case OP_MULTIPLY_CONSTANT_DOUBLE:
+  case OP_DIVIDE_CONSTANT_DOUBLE:
+  case OP_GREATER_CONSTANT_DOUBLE:
+  case OP_LESS_CONSTANT_DOUBLE:
+  case OP_GREATER_EQUAL_CONSTANT_DOUBLE:
+  case OP_LESS_EQUAL_CONSTANT_DOUBLE:
+  case OP_ADD_CONSTANT_NUM:
+  case OP_SUBTRACT_CONSTANT_NUM:
+  case OP_MULTIPLY_CONSTANT_NUM:
+  case OP_DIVIDE_CONSTANT_NUM:
+  case OP_GREATER_CONSTANT_NUM:
+  case OP_LESS_CONSTANT_NUM:
+  case OP_GREATER_EQUAL_CONSTANT_NUM:
+  case OP_LESS_EQUAL_CONSTANT_NUM:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool is_jump(uint8_t code) {
+  return code == OP_JUMP || code == OP_JUMP_IF_FALSE || code == OP_LOOP;
+}
+
+// Instructions whose effect on the stack depends on what they run. A new
+// segment starts after each of them, and the VM checks it on resuming.
+static bool ends_segment(uint8_t code) {
+  switch (code) {
+  case OP_IF:
+  case OP_APPLY:
+  case OP_TAIL_APPLY:
+  case OP_INVOKE:
+  case OP_TAIL_INVOKE:
+  case OP_DEFINE_FUNCTION:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// What a segment-ending instruction pops before control leaves it.
+static long segment_end_pops(uint8_t code) {
+  switch (code) {
+  case OP_IF:
+    return 3;
+  case OP_APPLY:
+  case OP_TAIL_APPLY:
+  case OP_DEFINE_FUNCTION:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static size_t jump_target(Chunk *chunk, size_t offset) {
+  uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+  jump |= chunk->code[offset + 2];
+  if (chunk->code[offset] == OP_LOOP) {
+    return offset + 3 < jump ? SIZE_MAX : offset + 3 - jump;
+  }
+  return offset + 3 + jump;
+}
+
+// Where a stale OP_INLINE guard resumes once its call returns.
+static size_t inline_end(Chunk *chunk, size_t offset) {
+  uint16_t jump = (uint16_t)(chunk->code[offset + 4] << 8);
+  jump |= chunk->code[offset + 5];
+  return offset + 6 + jump;
+}
+
+static const char *check_operands(Verifier *verifier) {
+  Chunk *chunk = verifier->chunk;
+  for (size_t offset = 0; offset < chunk->count;) {
+    uint8_t code = chunk->code[offset];
+    if (code > OP_RETURN) {
+      return "Unknown opcode.";
+    }
+    size_t length = instruction_length(code);
+    if (offset + length > chunk->count) {
+      return "Instruction runs off the end of the chunk.";
+    }
+    verifier->boundary[offset] = true;
+    uint16_t operand = length > 1 ? chunk->code[offset + 1] : 0;
+    if (length == 3) {
+      operand = (uint16_t)(operand << 8 | chunk->code[offset + 2]);
+    }
+    if (is_constant_operand(code) && operand >= chunk->constants.count) {
+      return "Constant out of range.";
+    }
+    if (code == OP_PUSH_OPERATION && vm.operations[operand] == NULL) {
+      return "Unknown operation.";
+    }
+    if (length == 3 && !is_jump(code) &&
+        operand >= vm.global_values.count) {
+      return "Global out of range.";
+    }
+    if (code == OP_INLINE &&
+        ((size_t)(operand << 8 | chunk->code[offset + 2]) >=
+             vm.global_values.count ||
+         chunk->code[offset + 3] >= chunk->constants.count)) {
+      return "Inlined procedure out of range.";
+    }
+    offset += length;
+  }
+  verifier->boundary[chunk->count] = true;
+
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    uint8_t code = chunk->code[offset];
+    if (is_jump(code) || code == OP_INLINE) {
+      size_t target = code == OP_INLINE ? inline_end(chunk, offset)
+                                        : jump_target(chunk, offset);
+      if (target > chunk->count || !verifier->boundary[target]) {
+        return "Jump into the middle of an instruction.";
+      }
+    }
+  }
+  return NULL;
+}
+
+static void add_work(Verifier *verifier, size_t offset, long low, long high) {
+  if (verifier->work_count == verifier->work_capacity) {
+    verifier->work_capacity = GROW_CAPACITY(verifier->work_capacity);
+    verifier->work =
+        realloc(verifier->work, sizeof(Work) * verifier->work_capacity);
+    if (verifier->work == NULL) {
+      exit(1);
+    }
+  }
+  verifier->work[verifier->work_count++] = (Work){offset, low, high};
+}
+
+// Widens the depth range recorded at offset and queues it when it grew.
+static void flow(Verifier *verifier, size_t segment, size_t offset, long low,
+                 long high) {
+  if (verifier->stamp[offset] != segment) {
+    verifier->stamp[offset] = segment;
+    verifier->low[offset] = low;
+    verifier->high[offset] = high;
+  } else if (low < verifier->low[offset] || high > verifier->high[offset]) {
+    if (low < verifier->low[offset]) {
+      verifier->low[offset] = low;
+    }
+    if (high > verifier->high[offset]) {
+      verifier->high[offset] = high;
+    }
+  } else {
+    return;
+  }
+  add_work(verifier, offset, verifier->low[offset], verifier->high[offset]);
+}
+
+// Walks every path from start until it leaves the segment, tracking how far
+// below its starting depth the segment reads and how far above it writes.
+static const char *walk_segment(Verifier *verifier, size_t segment,
+                                Segment *result) {
+  Chunk *chunk = verifier->chunk;
+  long consumes = 0;
+  long grows = 0;
+  verifier->work_count = 0;
+  flow(verifier, segment, result->start, 0, 0);
+  while (verifier->work_count > 0) {
+    Work work = verifier->work[--verifier->work_count];
+    if (work.offset == chunk->count) {
+      return "Code runs off the end of the chunk.";
+    }
+    uint8_t code = chunk->code[work.offset];
+    int pops;
+    int pushes;
+    if (!stack_effect(code, &pops, &pushes)) {
+      pops = is_jump(code) ? code == OP_JUMP_IF_FALSE : 0;
+      pushes = 0;
+      if (ends_segment(code)) {
+        pops = (int)segment_end_pops(code);
+      }
+    }
+    if (pops - work.low > consumes) {
+      consumes = pops - work.low;
+    }
+    long low = work.low - pops + pushes;
+    long high = work.high - pops + pushes;
+    if (high > grows) {
+      grows = high;
+    }
+    if (grows > STACK_MAX) {
+      return "Stack overflow.";
+    }
+    if (consumes > STACK_MAX) {
+      return "Stack underflow.";
+    }
+
+    if (code == OP_RETURN || ends_segment(code)) {
+      continue;
+    }
+    size_t next = work.offset + instruction_length(code);
+    if (is_jump(code)) {
+      flow(verifier, segment, jump_target(chunk, work.offset), low, high);
+      if (code != OP_JUMP_IF_FALSE) {
+        continue;
+      }
+    }
+    flow(verifier, segment, next, low, high);
+  }
+  result->consumes = (size_t)consumes;
+  result->grows = (size_t)grows;
+  return NULL;
+}
+
+static int compare_offsets(const void *a, const void *b) {
+  size_t x = *(const size_t *)a;
+  size_t y = *(const size_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Segments start at offset 0, after each segment-ending instruction and
+// where a stale OP_INLINE guard's call returns to.
+static const char *find_segments(Verifier *verifier) {
+  Chunk *chunk = verifier->chunk;
+  size_t *starts = malloc(sizeof(size_t) * (chunk->count + 1));
+  if (starts == NULL) {
+    exit(1);
+  }
+  size_t count = 0;
+  starts[count++] = 0;
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk->code[offset])) {
+    uint8_t code = chunk->code[offset];
+    if (ends_segment(code)) {
+      starts[count++] = offset + instruction_length(code);
+    } else if (code == OP_INLINE) {
+      starts[count++] = inline_end(chunk, offset);
+    }
+  }
+  qsort(starts, count, sizeof(size_t), compare_offsets);
+  size_t unique = 1;
+  for (size_t i = 1; i < count; ++i) {
+    if (starts[i] != starts[unique - 1]) {
+      starts[unique++] = starts[i];
+    }
+  }
+
+  FREE_ARRAY(Segment, chunk->segments, chunk->segment_count);
+  chunk->segments = ALLOCATE(Segment, unique);
+  chunk->segment_count = unique;
+  for (size_t i = 0; i < unique; ++i) {
+    chunk->segments[i].start = starts[i];
+  }
+  free(starts);
+  for (size_t i = 0; i < unique; ++i) {
+    const char *message = walk_segment(verifier, i + 1, &chunk->segments[i]);
+    if (message != NULL) {
+      return message;
+    }
+  }
+  return NULL;
+}
+
+const char *verify_chunk(Chunk *chunk) {
+  Verifier verifier;
+  verifier.chunk = chunk;
+  verifier.boundary = calloc(chunk->count + 1, sizeof(bool));
+  verifier.low = malloc(sizeof(long) * (chunk->count + 1));
+  verifier.high = malloc(sizeof(long) * (chunk->count + 1));
+  verifier.stamp = calloc(chunk->count + 1, sizeof(size_t));
+  if (verifier.boundary == NULL || verifier.low == NULL ||
+      verifier.high == NULL || verifier.stamp == NULL) {
+    exit(1);
+  }
+  verifier.work = NULL;
+  verifier.work_count = 0;
+  verifier.work_capacity = 0;
+
+  const char *message = check_operands(&verifier);
+  if (message == NULL) {
+    message = find_segments(&verifier);
+  }
+
+  free(verifier.boundary);
+  free(verifier.low);
+  free(verifier.high);
+  free(verifier.stamp);
+  free(verifier.work);
+  return message;
+}
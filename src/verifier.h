@@ -0,0 +1,8 @@
+#pragma once
+
+#include "chunk.h"
+
+// Checks that every instruction, operand and jump in the chunk is well
+// formed and records the stack each segment of straight-line code needs.
+// Returns NULL on success or a description of the first problem.
+const char *verify_chunk(Chunk *chunk);
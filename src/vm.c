@@ -1,12 +1,16 @@
 #include "vm.h"
+#include "aot.h"
 #include "chunk.h"
 #include "compiler.h"
 #include "debug.h"
+#include "jit.h"
+#include "memo.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 #include <ctype.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -18,29 +22,44 @@
 
 VM vm;
 
-ObjString *plus, *minus, *star, *divide, *dot, *scan, *equal, *less, *greater,
-    *less_equal, *greater_equal, *not, *not_equal, *question, *_if, *set,
-    *comma, *mod;
+static void define_operator(const char *chars, Op_Code code) {
+  ObjString *name = copy_string(chars, strlen(chars), false);
+  push(OBJ_VAL(name));
+  ObjOperation *operation = new_operation();
+  operation->type = name;
+  write_barrier((Obj *)operation);
+  operation->code = code;
+  vm.operations[code] = operation;
+  pop();
+}
 
 static void operators() {
-  plus = copy_string("+", 1, false);
-  minus = copy_string("-", 1, false);
-  star = copy_string("*", 1, false);
-  divide = copy_string("/", 1, false);
-  dot = copy_string(".", 1, false);
-  scan = copy_string("^", 1, false);
-  equal = copy_string("?=", 2, false);
-  less = copy_string("<", 1, false);
-  greater = copy_string(">", 1, false);
-  less_equal = copy_string("<=", 2, false);
-  greater_equal = copy_string(">=", 2, false);
-  not = copy_string("!", 1, false);
-  not_equal = copy_string("!=", 2, false);
-  question = copy_string("?", 1, false);
-  _if = copy_string("if", 2, false);
-  set = copy_string("=", 1, false);
-  comma = copy_string(",", 1, false);
-  mod = copy_string("%%", 1, false);
+  define_operator("+", OP_ADD);
+  define_operator("-", OP_SUBTRACT);
+  define_operator("*", OP_MULTIPLY);
+  define_operator("/", OP_DIVIDE);
+  define_operator(".", OP_PRINT);
+  define_operator("^", OP_SCAN);
+  define_operator("?=", OP_EQUAL);
+  define_operator("<", OP_LESS);
+  define_operator(">", OP_GREATER);
+  define_operator("<=", OP_LESS_EQUAL);
+  define_operator(">=", OP_GREATER_EQUAL);
+  define_operator("!", OP_NOT);
+  define_operator("!=", OP_NOT_EQUAL);
+  define_operator("?", OP_TRUTHY);
+  define_operator("if", OP_IF);
+  define_operator("=", OP_SET_VARIABLE);
+  define_operator(",", OP_APPLY);
+  define_operator("%", OP_MOD);
+  define_operator("dup", OP_DUP);
+  define_operator("swap", OP_SWAP);
+  define_operator("drop", OP_DROP);
+  define_operator("over", OP_OVER);
+  define_operator("rot", OP_ROT);
+  define_operator("pick", OP_PICK);
+  define_operator("let", OP_LET);
+  define_operator("nomemo", OP_NOMEMO);
 }
 
 static double str_to_double(char *input, int *status_code) {
@@ -79,8 +98,11 @@ static double str_to_double(char *input, int *status_code) {
 
 static void reset_stack() {
   vm.stack_top = vm.stack;
+  vm.locals_top = vm.locals;
   vm.frame_count = 0;
   vm.open_upvalues = NULL;
+  vm.memo_frames = 0;
+  vm.memo_keys.count = 0;
 }
 
 static void runtime_error(const char *format, ...) {
@@ -93,7 +115,10 @@ static void runtime_error(const char *format, ...) {
   for (ssize_t i = vm.frame_count - 1; i >= 0; i--) {
     CallFrame *frame = &vm.frames[i];
     ObjFunction *function = frame->closure->function;
-    size_t instruction = frame->ip - function->chunk.code - 1;
+    size_t instruction = frame->ip - function->chunk.code;
+    if (instruction > 0) {
+      instruction--;
+    }
     fprintf(stderr, "[line %zu] in ", function->chunk.lines[instruction]);
     if (function->name == NULL) {
       fprintf(stderr, "script\n");
@@ -106,15 +131,45 @@ static void runtime_error(const char *format, ...) {
 }
 
 void init_VM() {
+  vm.frames = NULL;
+  vm.frame_capacity = 0;
+  vm.stack = NULL;
+  vm.stack_capacity = 0;
+  vm.locals = NULL;
+  vm.locals_capacity = 0;
   reset_stack();
-  vm.objects = NULL;
+  vm.young = NULL;
+  vm.young_count = 0;
+  vm.young_capacity = 0;
+  vm.marking = false;
+  vm.young_traced = 0;
+  vm.sweeping = false;
   vm.bytes_allocated = 0;
   vm.next_gc = 1024 * 1024;
+  vm.young_bytes = 0;
   vm.gray_capacity = 0;
   vm.gray_count = 0;
   vm.gray_stack = NULL;
+  vm.remembered_capacity = 0;
+  vm.remembered_count = 0;
+  vm.remembered = NULL;
   init_table(&vm.globals);
+  init_value_array(&vm.global_names);
+  init_value_array(&vm.global_values);
+  init_value_array(&vm.memo_keys);
+  vm.memo_epoch = 0;
   init_table(&vm.strings);
+  for (size_t i = 0; i < UINT8_COUNT; ++i) {
+    vm.operations[i] = NULL;
+  }
+  // One slot below the bottom of the stack lets run() spill its cached top
+  // without checking whether the stack is empty.
+  vm.stack = GROW_ARRAY(Value, NULL, 0, UINT8_COUNT + 1) + 1;
+  vm.stack[-1] = NIL_VAL;
+  vm.stack_capacity = UINT8_COUNT;
+  vm.locals = GROW_ARRAY(Value, NULL, 0, UINT8_COUNT);
+  vm.locals_capacity = UINT8_COUNT;
+  reset_stack();
 
   vm.init_string = NULL;
   vm.init_string = copy_string("init", 4, false);
@@ -122,12 +177,41 @@ void init_VM() {
 }
 
 void free_VM() {
+#ifdef DEBUG_PROFILE_OPCODES
+  print_profile();
+#endif /* ifdef DEBUG_PROFILE_OPCODES */
   free_table(&vm.globals);
+  free_value_array(&vm.global_names);
+  free_value_array(&vm.global_values);
+  free_value_array(&vm.memo_keys);
   free_table(&vm.strings);
+  FREE_ARRAY(CallFrame, vm.frames, vm.frame_capacity);
+  FREE_ARRAY(Value, vm.stack - 1, vm.stack_capacity + 1);
+  vm.stack = NULL;
+  vm.stack_capacity = 0;
+  FREE_ARRAY(Value, vm.locals, vm.locals_capacity);
+  vm.locals = NULL;
+  vm.locals_capacity = 0;
+  vm.frames = NULL;
+  vm.frame_capacity = 0;
   vm.init_string = NULL;
   free_objects();
 }
 
+size_t resolve_global(ObjString *name) {
+  Value slot;
+  if (table_get(&vm.globals, name, &slot)) {
+    return (size_t)AS_NUMBER(slot);
+  }
+  push(OBJ_VAL(name));
+  write_value_array(&vm.global_names, OBJ_VAL(name));
+  write_value_array(&vm.global_values, NIL_VAL);
+  size_t index = vm.global_values.count - 1;
+  table_set(&vm.globals, name, NUMBER_VAL((double)index));
+  pop();
+  return index;
+}
+
 void push(Value value) {
   *vm.stack_top = value;
   vm.stack_top++;
@@ -140,21 +224,246 @@ Value pop() {
 
 static Value peek(int distance) { return vm.stack_top[-1 - distance]; }
 
+// Makes room for count more values, moving the stack if it has to grow.
+static bool ensure_stack(size_t count) {
+  size_t needed = (size_t)(vm.stack_top - vm.stack) + count + STACK_SLACK;
+  if (needed <= vm.stack_capacity) {
+    return true;
+  }
+  if (needed > STACK_MAX + STACK_SLACK) {
+    runtime_error("Stack overflow.");
+    return false;
+  }
+  size_t old_capacity = vm.stack_capacity;
+  size_t capacity = old_capacity;
+  while (capacity < needed) {
+    capacity = GROW_CAPACITY(capacity);
+  }
+  if (capacity > STACK_MAX + STACK_SLACK) {
+    capacity = STACK_MAX + STACK_SLACK;
+  }
+  Value *old_stack = vm.stack;
+  vm.stack =
+      GROW_ARRAY(Value, vm.stack - 1, old_capacity + 1, capacity + 1) + 1;
+  vm.stack_capacity = capacity;
+  vm.stack_top = vm.stack + (vm.stack_top - old_stack);
+  for (ObjUpvalue *upvalue = vm.open_upvalues; upvalue != NULL;
+       upvalue = upvalue->next) {
+    upvalue->location = vm.stack + (upvalue->location - old_stack);
+  }
+  return true;
+}
+
+static Segment *find_segment(Chunk *chunk, size_t offset) {
+  // Calls always enter the first segment.
+  if (offset == 0) {
+    return chunk->segments;
+  }
+  size_t low = 0;
+  size_t high = chunk->segment_count;
+  while (high - low > 1) {
+    size_t middle = low + (high - low) / 2;
+    if (chunk->segments[middle].start <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return &chunk->segments[low];
+}
+
+// Called whenever a frame starts or resumes a segment of verified code, with
+// the effect of anything that runs inline before it: the segment then runs
+// without checking its pushes and pops.
+static bool enter_segment(CallFrame *frame, int pops, int pushes) {
+  Chunk *chunk = &frame->closure->function->chunk;
+  Segment *segment = find_segment(chunk, (size_t)(frame->ip - chunk->code));
+  size_t depth = (size_t)(vm.stack_top - vm.stack);
+  if (depth < (size_t)pops || depth - pops + pushes < segment->consumes) {
+    runtime_error("Stack underflow.");
+    return false;
+  }
+  // How deep anything has read, for frames recording memo results.
+  size_t reach = depth - pops + pushes - segment->consumes;
+  size_t low = reach < depth - pops ? reach : depth - pops;
+  if (low < vm.stack_low) {
+    vm.stack_low = low;
+  }
+  return ensure_stack((size_t)pushes + segment->grows);
+}
+
+// Something is about to do I/O or write a global under frames that record
+// memo results: none of them may store, and results stored so far may
+// depend on what changes.
+static void stop_memo() {
+  for (size_t i = 0; i < vm.frame_count; ++i) {
+    vm.frames[i].memo = NULL;
+  }
+  vm.memo_frames = 0;
+  vm.memo_keys.count = 0;
+  memo_flush();
+}
+
+// An operation taken as an if path or invoked through a variable runs inline
+// before the frame's next segment. OP_IF and OP_APPLY check again once they
+// know where they go.
+static bool enter_operation(CallFrame *frame, uint8_t code) {
+  if (vm.memo_frames > 0 && memo_impure_operation(code)) {
+    stop_memo();
+  }
+  int pops;
+  int pushes;
+  if (stack_effect(code, &pops, &pushes)) {
+    return enter_segment(frame, pops, pushes);
+  }
+  size_t depth = (size_t)(vm.stack_top - vm.stack);
+  size_t reads = code == OP_IF ? 3u : 1u;
+  if (depth < reads) {
+    runtime_error("Stack underflow.");
+    return false;
+  }
+  if (depth - reads < vm.stack_low) {
+    vm.stack_low = depth - reads;
+  }
+  return true;
+}
+
+// Gives the frame's function fresh locals on top of its callers'.
+static void enter_locals(CallFrame *frame) {
+  size_t count = frame->closure->function->local_count;
+  size_t base = (size_t)(frame->slots - vm.locals);
+  if (base + count > vm.locals_capacity) {
+    size_t old_capacity = vm.locals_capacity;
+    size_t capacity = old_capacity;
+    while (capacity < base + count) {
+      capacity = GROW_CAPACITY(capacity);
+    }
+    Value *old_locals = vm.locals;
+    vm.locals = GROW_ARRAY(Value, vm.locals, old_capacity, capacity);
+    vm.locals_capacity = capacity;
+    vm.locals_top = vm.locals + (vm.locals_top - old_locals);
+    for (size_t i = 0; i < vm.frame_count; ++i) {
+      vm.frames[i].slots = vm.locals + (vm.frames[i].slots - old_locals);
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    frame->slots[i] = NIL_VAL;
+  }
+  vm.locals_top = frame->slots + count;
+}
+
+// Leaves what a memoized call left the last time in place of its inputs,
+// and carries on in the caller as if it had returned.
+static bool replay_memo(MemoEntry *entry, size_t inputs) {
+  if (entry->outputs > inputs && !ensure_stack(entry->outputs - inputs)) {
+    return false;
+  }
+  Value *base = vm.stack_top - inputs;
+  memcpy(base, entry->values + inputs, sizeof(Value) * entry->outputs);
+  vm.stack_top = base + entry->outputs;
+  if ((size_t)(base - vm.stack) < vm.stack_low) {
+    vm.stack_low = (size_t)(base - vm.stack);
+  }
+  return enter_segment(&vm.frames[vm.frame_count - 1], 0, 0);
+}
+
+// Has the frame record its result: copies the key, the top inputs values,
+// and starts tracking how deep the call reads.
+static void start_memo(CallFrame *frame, ObjFunction *function,
+                       size_t inputs) {
+  size_t keys = vm.memo_keys.count;
+  for (Value *value = vm.stack_top - inputs; value < vm.stack_top; ++value) {
+    write_value_array(&vm.memo_keys, *value);
+  }
+  frame->memo = function;
+  frame->memo_keys = keys;
+  frame->memo_entry = (size_t)(vm.stack_top - vm.stack);
+  frame->memo_low = vm.stack_low;
+  vm.stack_low = frame->memo_entry;
+  vm.memo_frames++;
+}
+
+// Stores what the returning frame left in place of its key. If it read
+// deeper than the key, the table's key grows instead and nothing is stored.
+static void finish_memo(CallFrame *frame) {
+  MemoTable *table = frame->memo->memo;
+  size_t inputs = vm.memo_keys.count - frame->memo_keys;
+  size_t consumed = frame->memo_entry - vm.stack_low;
+  if (consumed > table->inputs) {
+    memo_clear(table);
+    table->inputs = consumed;
+  } else if (inputs == table->inputs) {
+    size_t base = frame->memo_entry - inputs;
+    memo_store(table, &vm.memo_keys.value[frame->memo_keys], vm.stack + base,
+               (size_t)(vm.stack_top - vm.stack) - base);
+    write_barrier((Obj *)frame->memo);
+  }
+  vm.memo_keys.count = frame->memo_keys;
+  vm.memo_frames--;
+  if (frame->memo_low < vm.stack_low) {
+    vm.stack_low = frame->memo_low;
+  }
+  frame->memo = NULL;
+}
+
 static bool call(ObjClosure *closure, size_t arg_count) {
   if (arg_count != closure->function->arity) {
     runtime_error("Expected %d arguments but got %d.", closure->function->arity,
                   arg_count);
     return false;
   }
-  if (vm.frame_count == FRAMES_MAX) {
-    runtime_error("Stack overflow.");
-    return false;
+  ObjFunction *function = closure->function;
+  if (vm.memo_frames > 0 && !function->pure) {
+    stop_memo();
+  }
+  MemoTable *table = function->memo;
+  bool record = table != NULL &&
+                (size_t)(vm.stack_top - vm.stack) >= table->inputs;
+  if (record) {
+    if (vm.memo_frames == 0) {
+      // Globals may have changed since the last outermost memoized call.
+      memo_flush();
+    }
+    MemoEntry *entry = memo_lookup(table, vm.stack_top - table->inputs);
+    if (entry != NULL) {
+      return replay_memo(entry, table->inputs);
+    }
+  }
+  if (vm.frame_count == vm.frame_capacity) {
+    if (vm.frame_count == FRAMES_MAX) {
+      runtime_error("Stack overflow.");
+      return false;
+    }
+    // Growing may collect, and the closure is not in a frame yet.
+    size_t old_capacity = vm.frame_capacity;
+    vm.frame_capacity = GROW_CAPACITY(old_capacity);
+    push(OBJ_VAL(closure));
+    vm.frames =
+        GROW_ARRAY(CallFrame, vm.frames, old_capacity, vm.frame_capacity);
+    pop();
   }
   CallFrame *frame = &vm.frames[vm.frame_count++];
   frame->closure = closure;
   frame->ip = closure->function->chunk.code;
-  frame->slots = vm.stack_top - arg_count - 1;
-  return true;
+  frame->slots = vm.locals_top;
+  frame->memo = NULL;
+  if (record) {
+    start_memo(frame, function, table->inputs);
+  }
+  enter_locals(frame);
+  return enter_segment(frame, 0, 0);
+}
+
+// Procedures leave their results on the stack, so a call in tail position
+// only has to point the current frame at the new code.
+static bool tail_call(CallFrame *frame, ObjClosure *closure) {
+  if (vm.memo_frames > 0 && !closure->function->pure) {
+    stop_memo();
+  }
+  frame->closure = closure;
+  frame->ip = closure->function->chunk.code;
+  enter_locals(frame);
+  return enter_segment(frame, 0, 0);
 }
 
 static ObjUpvalue *capture_upvalue(Value *local) {
@@ -204,30 +513,13 @@ static void concatonate() {
   pop();
   push(OBJ_VAL(result));
 }
-static void vars_to_vals() {
-  Value v2 = peek(0);
-  Value v1 = peek(1);
-  if (IS_VARIABLE(v1) && IS_VARIABLE(v2)) {
-    Value v3 = AS_VARIABLE(v1)->value;
-    Value v4 = AS_VARIABLE(v2)->value;
-    pop();
-    pop();
-    push(v3);
-    push(v4);
-  } else if (IS_VARIABLE(v1)) {
-    Value v3 = AS_VARIABLE(v1)->value;
-    pop();
-    pop();
-    push(v3);
-    push(v2);
-  } else if (IS_VARIABLE(v2)) {
-    Value v4 = AS_VARIABLE(v2)->value;
-    pop();
-    pop();
-    push(v1);
-    push(v4);
+static Value variable_value(Value value) {
+  if (IS_VARIABLE(value)) {
+    return vm.global_values.value[AS_VARIABLE(value)];
   }
+  return value;
 }
+
 #ifdef DEBUG_TRACE_EXECUTION
 static void stack_print() {
   CallFrame *frame = &vm.frames[vm.frame_count - 1];
@@ -244,406 +536,730 @@ static void stack_print() {
 }
 #endif /* ifdef DEBUG_TRACE_EXECUTION */
 
-static InterpretResult run_function(ObjProcedure *procedure);
-
-static void define_function(ObjString *name) {
+static bool define_function(uint16_t slot, size_t line) {
+  ObjString *name = AS_STRING(vm.global_names.value[slot]);
   ObjProcedure *procedure = new_procedure();
   procedure->name = name;
-  size_t i = 0;
-  while (i < STACK_MAX && peek(i) != NIL_VAL) {
+  write_barrier((Obj *)procedure);
+  push(OBJ_VAL(procedure));
+  size_t depth = (size_t)(vm.stack_top - vm.stack);
+  size_t i = 1;
+  while (i < depth && !IS_NIL(peek(i))) {
     write_value_array(&procedure->stack, peek(i));
+    write_barrier((Obj *)procedure);
     i++;
   }
+  if (i == depth) {
+    runtime_error("'=>' without a ':' before it.");
+    return false;
+  }
   for (size_t j = 0; j <= i; ++j) {
     pop();
   }
-  table_set(&vm.globals, name, OBJ_VAL(procedure));
+  push(OBJ_VAL(procedure));
+  ObjFunction *function = compile_procedure(name, &procedure->stack, line);
+  if (function == NULL) {
+    runtime_error("Could not compile procedure '%s'.", name->chars);
+    return false;
+  }
+  function->aot = aot_find(name, function);
+  push(OBJ_VAL(function));
+  procedure->closure = new_closure(function);
+  write_barrier((Obj *)procedure);
+  pop();
+  memo_prepare(function, slot);
+  vm.global_values.value[slot] = OBJ_VAL(procedure);
+  pop();
+  return true;
 }
 
+// Truncating, like C: the result takes the sign of the dividend.
 static void modulo() {
-  Value a = peek(1);
-  Value b = peek(0);
-  double a_ = AS_NUMBER(a);
-  double b_ = AS_NUMBER(b);
-  while (a_ >= b_) {
-    a_ -= b_;
+  Value b = pop();
+  Value a = pop();
+  if (IS_INT(a) && IS_INT(b) && AS_INT(b) != 0) {
+    push(INT_VAL(AS_INT(a) % AS_INT(b)));
+  } else {
+    push(NUMBER_VAL(fmod(AS_NUMBER(a), AS_NUMBER(b))));
   }
-  pop();
-  pop();
-  push(NUMBER_VAL(a_));
 }
 
-#define BINARY_OP(value_type, op)                                              \
+// The specialized form of a generic arithmetic or comparison instruction for
+// the operand types it just saw, or the instruction itself. A double and an
+// int constant take the double form, other mixes the number form.
+static uint8_t quickened(uint8_t instruction, Value a, Value b) {
+  Binary_Form form;
+  if (IS_INT(a) && IS_INT(b)) {
+    form = INT_FORM;
+  } else if (IS_DOUBLE(a) &&
+             (IS_DOUBLE(b) || (IS_INT(b) && instruction >= OP_ADD_CONSTANT &&
+                               instruction <= OP_LESS_EQUAL_CONSTANT))) {
+    form = DOUBLE_FORM;
+  } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    form = NUMBER_FORM;
+  } else if (instruction == OP_ADD && IS_STRING(a) && IS_STRING(b)) {
+    return OP_ADD_STR;
+  } else {
+    return instruction;
+  }
+  uint8_t op;
+  Binary_Operand operand;
+  Binary_Form generic;
+  if (!binary_instruction(instruction, &op, &operand, &generic)) {
+    return instruction;
+  }
+  return binary_code(op, operand, form);
+}
+
+// Handlers reach the stack through these. With STACK_CACHING, run() keeps the
+// stack pointer in sp and the top value in tos; SYNC() writes them back before
+// anything that reads vm.stack_top or can collect, and RELOAD() picks them up
+// again afterwards, since the stack may have moved.
+#ifdef STACK_CACHING
+#define TOP tos
+#define SP sp
+#define PUSH(value)                                                            \
+  do {                                                                         \
+    Value pushed = (value);                                                    \
+    sp[-1] = tos;                                                              \
+    sp++;                                                                      \
+    tos = pushed;                                                              \
+  } while (false)
+#define DROP(count) (sp -= (count), tos = sp[-1])
+#define SYNC() (sp[-1] = tos, vm.stack_top = sp)
+#define RELOAD() (sp = vm.stack_top, tos = sp[-1])
+#else
+#define TOP (vm.stack_top[-1])
+#define SP vm.stack_top
+#define PUSH(value) push(value)
+#define DROP(count) (vm.stack_top -= (count))
+#define SYNC() ((void)0)
+#define RELOAD() ((void)0)
+#endif /* ifdef STACK_CACHING */
+#define SECOND (SP[-2])
+#define THIRD (SP[-3])
+
+// Where a frame starts or resumes a segment, compiled code carries on: the
+// ahead-of-time version of the chunk if the program has one, otherwise the
+// JIT once the chunk is hot.
+#ifdef JIT
+#define ENTER_NATIVE()                                                         \
   do {                                                                         \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
+    ObjFunction *native = frame->closure->function;                            \
+    if (native->aot != NULL) {                                                 \
+      frame->ip = native->aot(native, frame->ip);                              \
+    } else if (jit_enabled) {                                                  \
+      frame->ip = jit_run(native, frame->ip);                                  \
+    }                                                                          \
+  } while (false)
+#else
+#define ENTER_NATIVE()                                                         \
+  do {                                                                         \
+    ObjFunction *native = frame->closure->function;                            \
+    if (native->aot != NULL) {                                                 \
+      frame->ip = native->aot(native, frame->ip);                              \
+    }                                                                          \
+  } while (false)
+#endif /* ifdef JIT */
+
+#define VARS_TO_VALS()                                                         \
+  do {                                                                         \
+    TOP = variable_value(TOP);                                                 \
+    SECOND = variable_value(SECOND);                                           \
+  } while (false)
+
+#define BINARY_OP(operation)                                                   \
+  do {                                                                         \
+    if (!IS_NUMBER(TOP) || !IS_NUMBER(SECOND)) {                               \
       runtime_error("Operands must be numbers.");                              \
       return INTERPRET_RUNTIME_ERROR;                                          \
     }                                                                          \
-    double b = AS_NUMBER(pop());                                               \
-    double a = AS_NUMBER(pop());                                               \
-    push(value_type(a op b));                                                  \
+    Value b = TOP;                                                             \
+    DROP(1);                                                                   \
+    TOP = operation(TOP, b);                                                   \
   } while (false)
 
-static InterpretResult run_operation(ObjOperation *operation) {
-  if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(plus))) {
-    vars_to_vals();
-    if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-      concatonate();
-    } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-      double b = AS_NUMBER(pop());
-      double a = AS_NUMBER(pop());
-      push(NUMBER_VAL(a + b));
-    } else {
-      runtime_error("Operands must be either two strings or two numbers.");
-      return INTERPRET_RUNTIME_ERROR;
-    }
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(minus))) {
-    vars_to_vals();
-    BINARY_OP(NUMBER_VAL, -);
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(star))) {
-    vars_to_vals();
-    BINARY_OP(NUMBER_VAL, *);
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(divide))) {
-    vars_to_vals();
-    BINARY_OP(NUMBER_VAL, /);
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(mod))) {
-    vars_to_vals();
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-      runtime_error("Operands must be both be numbers");
-      return INTERPRET_RUNTIME_ERROR;
-    }
-    modulo();
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(equal))) {
-    vars_to_vals();
-    Value b = pop();
-    Value a = pop();
-    printf("a: ");
-    print_value(a);
-    printf("\nb: ");
-    print_value(b);
-    printf("\n");
-    push(BOOL_VAL(values_equal(a, b)));
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(greater))) {
-    vars_to_vals();
-    BINARY_OP(NUMBER_VAL, >);
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(less))) {
-    vars_to_vals();
-    BINARY_OP(NUMBER_VAL, <);
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(greater_equal))) {
-    vars_to_vals();
-    BINARY_OP(NUMBER_VAL, >=);
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(less_equal))) {
-    vars_to_vals();
-    BINARY_OP(NUMBER_VAL, <=);
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(not ))) {
-    if (IS_VARIABLE(peek(0))) {
-      Value value = AS_VARIABLE(peek(0))->value;
-      pop();
-      push(value);
-    }
-    Value not = BOOL_VAL(is_falsey(peek(0)));
-    pop();
-    push(not );
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(question))) {
-    if (IS_VARIABLE(peek(0))) {
-      Value value = AS_VARIABLE(peek(0))->value;
-      pop();
-      push(value);
-    }
-    Value not = BOOL_VAL(!is_falsey(peek(0)));
-    pop();
-    push(not );
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(_if))) {
-    Value val = pop();
-    vars_to_vals();
-    push(val);
-    Value boolean = BOOL_VAL(!is_falsey(peek(0)));
-    Value path;
-    if (AS_BOOL(boolean)) {
-      path = peek(2);
-    } else {
-      path = peek(1);
-    }
-    pop();
-    pop();
-    pop();
-    InterpretResult result = INTERPRET_OK;
-    if (IS_PROCEDURE(path)) {
-      result = run_function(AS_PROCEDURE(path));
-    } else if (IS_OPERATION(path)) {
-      result = run_operation(AS_OPERATION(path));
-    } else {
-      push(path);
-    }
-    if (result == INTERPRET_RUNTIME_ERROR) {
-      return INTERPRET_RUNTIME_ERROR;
-    }
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(dot))) {
-    if (IS_VARIABLE(peek(0))) {
-      print_value(AS_VARIABLE(peek(0))->value);
-      pop();
-      return INTERPRET_OK;
-    }
-    print_value(pop());
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(scan))) {
-    char buffer[1024];
-
-    if (fgets(buffer, sizeof(buffer), stdin) != NULL) {
-      int status_code = 0;
-      double result = str_to_double(buffer, &status_code);
-
-      if (status_code == -1) {
-        size_t length = strlen(buffer);
-        char *str = ALLOCATE(char, length);
-        memcpy(str, buffer, length - 1);
-        str[length - 1] = '\0';
-        push(OBJ_VAL(take_string(str, length)));
-      } else {
-        push(NUMBER_VAL(result));
-      }
-    } else {
-      runtime_error("reached end of input.");
-      return INTERPRET_RUNTIME_ERROR;
-    }
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(set))) {
-    if (!IS_VARIABLE(peek(0))) {
-      runtime_error("Can only asign to variables.");
-      return INTERPRET_RUNTIME_ERROR;
-    }
-    table_set(&vm.globals, AS_VARIABLE(peek(0))->name, peek(1));
-    pop();
-    pop();
-  } else if (values_equal(OBJ_VAL(operation->type), OBJ_VAL(comma))) {
-    if (!IS_VARIABLE(peek(0))) {
-      runtime_error("can not run a non procedure.");
-      return INTERPRET_RUNTIME_ERROR;
-    }
-    Value value;
-    table_get(&vm.globals, AS_VARIABLE(peek(0))->name, &value);
-    if (!IS_PROCEDURE(value)) {
-      table_delete(&vm.globals, AS_VARIABLE(peek(0))->name);
-      runtime_error("can not run a non procedure.");
-      return INTERPRET_RUNTIME_ERROR;
-    }
-    pop();
-    InterpretResult result = run_function(AS_PROCEDURE(value));
-    if (result == INTERPRET_RUNTIME_ERROR) {
-      return INTERPRET_RUNTIME_ERROR;
-    }
-  }
+// Quickened handlers re-check their guard on every run and hand the
+// instruction back to its generic form when it fails. The int forms need two
+// ints and the double forms two doubles, so neither has to convert; the
+// number forms take an int and a double.
+#define INT_OP(operation, generic)                                             \
+  do {                                                                         \
+    Value b = variable_value(TOP);                                             \
+    Value a = variable_value(SECOND);                                          \
+    if (!IS_INT(a) || !IS_INT(b)) {                                            \
+      *start = generic;                                                        \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    DROP(1);                                                                   \
+    TOP = operation##_ints(a, b);                                              \
+  } while (false)
 
-  return INTERPRET_OK;
-}
+#define DOUBLE_OP(operation, generic)                                          \
+  do {                                                                         \
+    Value b = variable_value(TOP);                                             \
+    Value a = variable_value(SECOND);                                          \
+    if (!IS_DOUBLE(a) || !IS_DOUBLE(b)) {                                      \
+      *start = generic;                                                        \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    DROP(1);                                                                   \
+    TOP = operation##_doubles(AS_DOUBLE(a), AS_DOUBLE(b));                     \
+  } while (false)
 
-static Value variable_to_value(Value val) {
-  if (IS_VARIABLE(val)) {
-    ObjVariable *v = AS_VARIABLE(val);
-    Value variable_value;
-    return variable_value;
-  }
-  return val;
-}
+#define NUMBER_OP(operation, generic)                                          \
+  do {                                                                         \
+    Value b = variable_value(TOP);                                             \
+    Value a = variable_value(SECOND);                                          \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                                      \
+      *start = generic;                                                        \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    DROP(1);                                                                   \
+    TOP = operation##_numbers(a, b);                                           \
+  } while (false)
 
-static InterpretResult run_function(ObjProcedure *procedure) {
-  for (ssize_t i = procedure->stack.count - 1; i >= 0; --i) {
-    if (IS_OPERATION(procedure->stack.value[i])) {
-      InterpretResult result =
-          run_operation(AS_OPERATION(procedure->stack.value[i]));
-      if (result == INTERPRET_RUNTIME_ERROR) {
-        return INTERPRET_RUNTIME_ERROR;
-      }
-    } else if (IS_VARIABLE(procedure->stack.value[i])) {
-      ObjString *name = AS_VARIABLE(procedure->stack.value[i])->name;
-      ObjVariable *variable = new_variable();
-      Value value;
-      table_get(&vm.globals, name, &value);
-      variable->name = name;
-      variable->value = value;
-      push(OBJ_VAL(variable));
-    } else {
-      push(procedure->stack.value[i]);
-    }
-  }
-  return INTERPRET_OK;
-}
+// The constant had the right type when the instruction was quickened, and
+// constants never change.
+#define INT_CONSTANT_OP(operation, fused, generic)                             \
+  do {                                                                         \
+    Value b = READ_CONSTANT();                                                 \
+    Value a = variable_value(TOP);                                             \
+    if (!IS_INT(a)) {                                                          \
+      *start = fused;                                                          \
+      PUSH(b);                                                                 \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    TOP = operation##_ints(a, b);                                              \
+  } while (false)
+
+#define DOUBLE_CONSTANT_OP(operation, fused, generic)                          \
+  do {                                                                         \
+    Value b = READ_CONSTANT();                                                 \
+    Value a = variable_value(TOP);                                             \
+    if (!IS_DOUBLE(a)) {                                                       \
+      *start = fused;                                                          \
+      PUSH(b);                                                                 \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    TOP = operation##_doubles(AS_DOUBLE(a), AS_NUMBER(b));                     \
+  } while (false)
+
+#define NUMBER_CONSTANT_OP(operation, fused, generic)                          \
+  do {                                                                         \
+    Value b = READ_CONSTANT();                                                 \
+    Value a = variable_value(TOP);                                             \
+    if (!IS_NUMBER(a)) {                                                       \
+      *start = fused;                                                          \
+      PUSH(b);                                                                 \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    TOP = operation##_numbers(a, b);                                           \
+  } while (false)
+
+// A global or a local can change type between runs, so the variable and
+// local forms guard their operand as well.
+#define INT_OPERAND_OP(read, operation, fused, generic)                        \
+  do {                                                                         \
+    Value b = read;                                                            \
+    Value a = variable_value(TOP);                                             \
+    if (!IS_INT(a) || !IS_INT(b)) {                                            \
+      *start = fused;                                                          \
+      PUSH(b);                                                                 \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    TOP = operation##_ints(a, b);                                              \
+  } while (false)
+
+#define DOUBLE_OPERAND_OP(read, operation, fused, generic)                     \
+  do {                                                                         \
+    Value b = read;                                                            \
+    Value a = variable_value(TOP);                                             \
+    if (!IS_DOUBLE(a) || !IS_DOUBLE(b)) {                                      \
+      *start = fused;                                                          \
+      PUSH(b);                                                                 \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    TOP = operation##_doubles(AS_DOUBLE(a), AS_DOUBLE(b));                     \
+  } while (false)
+
+#define NUMBER_OPERAND_OP(read, operation, fused, generic)                     \
+  do {                                                                         \
+    Value b = read;                                                            \
+    Value a = variable_value(TOP);                                             \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                                      \
+      *start = fused;                                                          \
+      PUSH(b);                                                                 \
+      JUMP_TO(generic);                                                        \
+    }                                                                          \
+    TOP = operation##_numbers(a, b);                                           \
+  } while (false)
 
 static InterpretResult run() {
   CallFrame *frame = &vm.frames[vm.frame_count - 1];
-  operators();
+  ENTER_NATIVE();
+#ifdef STACK_CACHING
+  Value *sp = vm.stack_top;
+  Value tos = sp[-1];
+#endif /* ifdef STACK_CACHING */
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT()                                                           \
   (frame->ip += 2, (uint16_t)((frame->ip[-2]) << 8 | frame->ip[-1]))
 #define READ_CONSTANT()                                                        \
   (frame->closure->function->chunk.constants.value[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_GLOBAL() (vm.global_values.value[READ_SHORT()])
+#define READ_LOCAL() (frame->slots[READ_BYTE()])
 
-  for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-    stack_print();
+#define TRACE_EXECUTION()                                                      \
+  do {                                                                         \
+    SYNC();                                                                    \
+    stack_print();                                                             \
+  } while (false)
+#else
+#define TRACE_EXECUTION()                                                      \
+  do {                                                                         \
+  } while (false)
 #endif /* ifdef DEBUG_TRACE_EXECUTION */
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
-    case OP_ADD: {
-      vars_to_vals();
-      if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+
+#ifdef DEBUG_PROFILE_OPCODES
+#define PROFILE_INSTRUCTION() profile_instruction(instruction)
+#else
+#define PROFILE_INSTRUCTION()                                                  \
+  do {                                                                         \
+  } while (false)
+#endif /* ifdef DEBUG_PROFILE_OPCODES */
+
+#define QUICKEN()                                                              \
+  do {                                                                         \
+    if (start != NULL) {                                                       \
+      *start = quickened(*start, SECOND, TOP);                                 \
+    }                                                                          \
+  } while (false)
+
+#ifdef COMPUTED_GOTO
+  static void *dispatch_table[UINT8_COUNT] = {
+      [OP_PRINT] = &&do_OP_PRINT,
+      [OP_SCAN] = &&do_OP_SCAN,
+      [OP_ADD] = &&do_OP_ADD,
+      [OP_SUBTRACT] = &&do_OP_SUBTRACT,
+      [OP_MULTIPLY] = &&do_OP_MULTIPLY,
+      [OP_DIVIDE] = &&do_OP_DIVIDE,
+      [OP_MOD] = &&do_OP_MOD,
+      [OP_EQUAL] = &&do_OP_EQUAL,
+      [OP_GREATER] = &&do_OP_GREATER,
+      [OP_LESS] = &&do_OP_LESS,
+      [OP_GREATER_EQUAL] = &&do_OP_GREATER_EQUAL,
+      [OP_LESS_EQUAL] = &&do_OP_LESS_EQUAL,
+      [OP_NOT] = &&do_OP_NOT,
+      [OP_NOT_EQUAL] = &&do_OP_NOT_EQUAL,
+      [OP_TRUTHY] = &&do_OP_TRUTHY,
+      [OP_DUP] = &&do_OP_DUP,
+      [OP_SWAP] = &&do_OP_SWAP,
+      [OP_DROP] = &&do_OP_DROP,
+      [OP_OVER] = &&do_OP_OVER,
+      [OP_ROT] = &&do_OP_ROT,
+      [OP_PICK] = &&do_OP_PICK,
+      [OP_LET] = &&do_OP_LET,
+      [OP_NOMEMO] = &&do_OP_NOMEMO,
+      [OP_IF] = &&do_OP_IF,
+      [OP_JUMP] = &&do_OP_JUMP,
+      [OP_JUMP_IF_FALSE] = &&do_OP_JUMP_IF_FALSE,
+      [OP_LOOP] = &&do_OP_LOOP,
+      [OP_INVOKE] = &&do_OP_INVOKE,
+      [OP_PUSH_OPERATION] = &&do_OP_PUSH_OPERATION,
+      [OP_VARIABLE] = &&do_OP_VARIABLE,
+      [OP_SET_VARIABLE] = &&do_OP_SET_VARIABLE,
+      [OP_GET_LOCAL] = &&do_OP_GET_LOCAL,
+      [OP_SET_LOCAL] = &&do_OP_SET_LOCAL,
+      [OP_DEFINE_FUNCTION] = &&do_OP_DEFINE_FUNCTION,
+      [OP_APPLY] = &&do_OP_APPLY,
+      [OP_TAIL_APPLY] = &&do_OP_TAIL_APPLY,
+      [OP_TAIL_INVOKE] = &&do_OP_TAIL_INVOKE,
+      [OP_INLINE] = &&do_OP_INLINE,
+      [OP_ADD_CONSTANT] = &&do_OP_ADD_CONSTANT,
+      [OP_SUBTRACT_CONSTANT] = &&do_OP_SUBTRACT_CONSTANT,
+      [OP_MULTIPLY_CONSTANT] = &&do_OP_MULTIPLY_CONSTANT,
+      [OP_DIVIDE_CONSTANT] = &&do_OP_DIVIDE_CONSTANT,
+      [OP_GREATER_CONSTANT] = &&do_OP_GREATER_CONSTANT,
+      [OP_LESS_CONSTANT] = &&do_OP_LESS_CONSTANT,
+      [OP_GREATER_EQUAL_CONSTANT] = &&do_OP_GREATER_EQUAL_CONSTANT,
+      [OP_LESS_EQUAL_CONSTANT] = &&do_OP_LESS_EQUAL_CONSTANT,
+      [OP_ADD_VARIABLE] = &&do_OP_ADD_VARIABLE,
+      [OP_SUBTRACT_VARIABLE] = &&do_OP_SUBTRACT_VARIABLE,
+      [OP_MULTIPLY_VARIABLE] = &&do_OP_MULTIPLY_VARIABLE,
+      [OP_DIVIDE_VARIABLE] = &&do_OP_DIVIDE_VARIABLE,
+      [OP_GREATER_VARIABLE] = &&do_OP_GREATER_VARIABLE,
+      [OP_LESS_VARIABLE] = &&do_OP_LESS_VARIABLE,
+      [OP_GREATER_EQUAL_VARIABLE] = &&do_OP_GREATER_EQUAL_VARIABLE,
+      [OP_LESS_EQUAL_VARIABLE] = &&do_OP_LESS_EQUAL_VARIABLE,
+      [OP_ADD_LOCAL] = &&do_OP_ADD_LOCAL,
+      [OP_SUBTRACT_LOCAL] = &&do_OP_SUBTRACT_LOCAL,
+      [OP_MULTIPLY_LOCAL] = &&do_OP_MULTIPLY_LOCAL,
+      [OP_DIVIDE_LOCAL] = &&do_OP_DIVIDE_LOCAL,
+      [OP_GREATER_LOCAL] = &&do_OP_GREATER_LOCAL,
+      [OP_LESS_LOCAL] = &&do_OP_LESS_LOCAL,
+      [OP_GREATER_EQUAL_LOCAL] = &&do_OP_GREATER_EQUAL_LOCAL,
+      [OP_LESS_EQUAL_LOCAL] = &&do_OP_LESS_EQUAL_LOCAL,
+      [OP_SET_GLOBAL] = &&do_OP_SET_GLOBAL,
+      [OP_ADD_INT] = &&do_OP_ADD_INT,
+      [OP_SUBTRACT_INT] = &&do_OP_SUBTRACT_INT,
+      [OP_MULTIPLY_INT] = &&do_OP_MULTIPLY_INT,
+      [OP_DIVIDE_INT] = &&do_OP_DIVIDE_INT,
+      [OP_GREATER_INT] = &&do_OP_GREATER_INT,
+      [OP_LESS_INT] = &&do_OP_LESS_INT,
+      [OP_GREATER_EQUAL_INT] = &&do_OP_GREATER_EQUAL_INT,
+      [OP_LESS_EQUAL_INT] = &&do_OP_LESS_EQUAL_INT,
+      [OP_ADD_CONSTANT_INT] = &&do_OP_ADD_CONSTANT_INT,
+      [OP_SUBTRACT_CONSTANT_INT] = &&do_OP_SUBTRACT_CONSTANT_INT,
+      [OP_MULTIPLY_CONSTANT_INT] = &&do_OP_MULTIPLY_CONSTANT_INT,
+      [OP_DIVIDE_CONSTANT_INT] = &&do_OP_DIVIDE_CONSTANT_INT,
+      [OP_GREATER_CONSTANT_INT] = &&do_OP_GREATER_CONSTANT_INT,
+      [OP_LESS_CONSTANT_INT] = &&do_OP_LESS_CONSTANT_INT,
+      [OP_GREATER_EQUAL_CONSTANT_INT] = &&do_OP_GREATER_EQUAL_CONSTANT_INT,
+      [OP_LESS_EQUAL_CONSTANT_INT] = &&do_OP_LESS_EQUAL_CONSTANT_INT,
+      [OP_ADD_VARIABLE_INT] = &&do_OP_ADD_VARIABLE_INT,
+      [OP_SUBTRACT_VARIABLE_INT] = &&do_OP_SUBTRACT_VARIABLE_INT,
+      [OP_MULTIPLY_VARIABLE_INT] = &&do_OP_MULTIPLY_VARIABLE_INT,
+      [OP_DIVIDE_VARIABLE_INT] = &&do_OP_DIVIDE_VARIABLE_INT,
+      [OP_GREATER_VARIABLE_INT] = &&do_OP_GREATER_VARIABLE_INT,
+      [OP_LESS_VARIABLE_INT] = &&do_OP_LESS_VARIABLE_INT,
+      [OP_GREATER_EQUAL_VARIABLE_INT] = &&do_OP_GREATER_EQUAL_VARIABLE_INT,
+      [OP_LESS_EQUAL_VARIABLE_INT] = &&do_OP_LESS_EQUAL_VARIABLE_INT,
+      [OP_ADD_LOCAL_INT] = &&do_OP_ADD_LOCAL_INT,
+      [OP_SUBTRACT_LOCAL_INT] = &&do_OP_SUBTRACT_LOCAL_INT,
+      [OP_MULTIPLY_LOCAL_INT] = &&do_OP_MULTIPLY_LOCAL_INT,
+      [OP_DIVIDE_LOCAL_INT] = &&do_OP_DIVIDE_LOCAL_INT,
+      [OP_GREATER_LOCAL_INT] = &&do_OP_GREATER_LOCAL_INT,
+      [OP_LESS_LOCAL_INT] = &&do_OP_LESS_LOCAL_INT,
+      [OP_GREATER_EQUAL_LOCAL_INT] = &&do_OP_GREATER_EQUAL_LOCAL_INT,
+      [OP_LESS_EQUAL_LOCAL_INT] = &&do_OP_LESS_EQUAL_LOCAL_INT,
+      [OP_ADD_DOUBLE] = &&do_OP_ADD_DOUBLE,
+      [OP_SUBTRACT_DOUBLE] = &&do_OP_SUBTRACT_DOUBLE,
+      [OP_MULTIPLY_DOUBLE] = &&do_OP_MULTIPLY_DOUBLE,
+      [OP_DIVIDE_DOUBLE] = &&do_OP_DIVIDE_DOUBLE,
+      [OP_GREATER_DOUBLE] = &&do_OP_GREATER_DOUBLE,
+      [OP_LESS_DOUBLE] = &&do_OP_LESS_DOUBLE,
+      [OP_GREATER_EQUAL_DOUBLE] = &&do_OP_GREATER_EQUAL_DOUBLE,
+      [OP_LESS_EQUAL_DOUBLE] = &&do_OP_LESS_EQUAL_DOUBLE,
+      [OP_ADD_CONSTANT_DOUBLE] = &&do_OP_ADD_CONSTANT_DOUBLE,
+      [OP_SUBTRACT_CONSTANT_DOUBLE] = &&do_OP_SUBTRACT_CONSTANT_DOUBLE,
+      [OP_MULTIPLY_CONSTANT_DOUBLE] = &&do_OP_MULTIPLY_CONSTANT_DOUBLE,
+      [OP_DIVIDE_CONSTANT_DOUBLE] = &&do_OP_DIVIDE_CONSTANT_DOUBLE,
+      [OP_GREATER_CONSTANT_DOUBLE] = &&do_OP_GREATER_CONSTANT_DOUBLE,
+      [OP_LESS_CONSTANT_DOUBLE] = &&do_OP_LESS_CONSTANT_DOUBLE,
+      [OP_GREATER_EQUAL_CONSTANT_DOUBLE] =
+          &&do_OP_GREATER_EQUAL_CONSTANT_DOUBLE,
+      [OP_LESS_EQUAL_CONSTANT_DOUBLE] = &&do_OP_LESS_EQUAL_CONSTANT_DOUBLE,
+      [OP_ADD_VARIABLE_DOUBLE] = &&do_OP_ADD_VARIABLE_DOUBLE,
+      [OP_SUBTRACT_VARIABLE_DOUBLE] = &&do_OP_SUBTRACT_VARIABLE_DOUBLE,
+      [OP_MULTIPLY_VARIABLE_DOUBLE] = &&do_OP_MULTIPLY_VARIABLE_DOUBLE,
+      [OP_DIVIDE_VARIABLE_DOUBLE] = &&do_OP_DIVIDE_VARIABLE_DOUBLE,
+      [OP_GREATER_VARIABLE_DOUBLE] = &&do_OP_GREATER_VARIABLE_DOUBLE,
+      [OP_LESS_VARIABLE_DOUBLE] = &&do_OP_LESS_VARIABLE_DOUBLE,
+      [OP_GREATER_EQUAL_VARIABLE_DOUBLE] =
+          &&do_OP_GREATER_EQUAL_VARIABLE_DOUBLE,
+      [OP_LESS_EQUAL_VARIABLE_DOUBLE] = &&do_OP_LESS_EQUAL_VARIABLE_DOUBLE,
+      [OP_ADD_LOCAL_DOUBLE] = &&do_OP_ADD_LOCAL_DOUBLE,
+      [OP_SUBTRACT_LOCAL_DOUBLE] = &&do_OP_SUBTRACT_LOCAL_DOUBLE,
+      [OP_MULTIPLY_LOCAL_DOUBLE] = &&do_OP_MULTIPLY_LOCAL_DOUBLE,
+      [OP_DIVIDE_LOCAL_DOUBLE] = &&do_OP_DIVIDE_LOCAL_DOUBLE,
+      [OP_GREATER_LOCAL_DOUBLE] = &&do_OP_GREATER_LOCAL_DOUBLE,
+      [OP_LESS_LOCAL_DOUBLE] = &&do_OP_LESS_LOCAL_DOUBLE,
+      [OP_GREATER_EQUAL_LOCAL_DOUBLE] = &&do_OP_GREATER_EQUAL_LOCAL_DOUBLE,
+      [OP_LESS_EQUAL_LOCAL_DOUBLE] = &&do_OP_LESS_EQUAL_LOCAL_DOUBLE,
+      [OP_ADD_NUM] = &&do_OP_ADD_NUM,
+      [OP_SUBTRACT_NUM] = &&do_OP_SUBTRACT_NUM,
+      [OP_MULTIPLY_NUM] = &&do_OP_MULTIPLY_NUM,
+      [OP_DIVIDE_NUM] = &&do_OP_DIVIDE_NUM,
+      [OP_GREATER_NUM] = &&do_OP_GREATER_NUM,
+      [OP_LESS_NUM] = &&do_OP_LESS_NUM,
+      [OP_GREATER_EQUAL_NUM] = &&do_OP_GREATER_EQUAL_NUM,
+      [OP_LESS_EQUAL_NUM] = &&do_OP_LESS_EQUAL_NUM,
+      [OP_ADD_CONSTANT_NUM] = &&do_OP_ADD_CONSTANT_NUM,
+      [OP_SUBTRACT_CONSTANT_NUM] = &&do_OP_SUBTRACT_CONSTANT_NUM,
+      [OP_MULTIPLY_CONSTANT_NUM] = &&do_OP_MULTIPLY_CONSTANT_NUM,
+      [OP_DIVIDE_CONSTANT_NUM] = &&do_OP_DIVIDE_CONSTANT_NUM,
+      [OP_GREATER_CONSTANT_NUM] = &&do_OP_GREATER_CONSTANT_NUM,
+      [OP_LESS_CONSTANT_NUM] = &&do_OP_LESS_CONSTANT_NUM,
+      [OP_GREATER_EQUAL_CONSTANT_NUM] = &&do_OP_GREATER_EQUAL_CONSTANT_NUM,
+      [OP_LESS_EQUAL_CONSTANT_NUM] = &&do_OP_LESS_EQUAL_CONSTANT_NUM,
+      [OP_ADD_VARIABLE_NUM] = &&do_OP_ADD_VARIABLE_NUM,
+      [OP_SUBTRACT_VARIABLE_NUM] = &&do_OP_SUBTRACT_VARIABLE_NUM,
+      [OP_MULTIPLY_VARIABLE_NUM] = &&do_OP_MULTIPLY_VARIABLE_NUM,
+      [OP_DIVIDE_VARIABLE_NUM] = &&do_OP_DIVIDE_VARIABLE_NUM,
+      [OP_GREATER_VARIABLE_NUM] = &&do_OP_GREATER_VARIABLE_NUM,
+      [OP_LESS_VARIABLE_NUM] = &&do_OP_LESS_VARIABLE_NUM,
+      [OP_GREATER_EQUAL_VARIABLE_NUM] = &&do_OP_GREATER_EQUAL_VARIABLE_NUM,
+      [OP_LESS_EQUAL_VARIABLE_NUM] = &&do_OP_LESS_EQUAL_VARIABLE_NUM,
+      [OP_ADD_LOCAL_NUM] = &&do_OP_ADD_LOCAL_NUM,
+      [OP_SUBTRACT_LOCAL_NUM] = &&do_OP_SUBTRACT_LOCAL_NUM,
+      [OP_MULTIPLY_LOCAL_NUM] = &&do_OP_MULTIPLY_LOCAL_NUM,
+      [OP_DIVIDE_LOCAL_NUM] = &&do_OP_DIVIDE_LOCAL_NUM,
+      [OP_GREATER_LOCAL_NUM] = &&do_OP_GREATER_LOCAL_NUM,
+      [OP_LESS_LOCAL_NUM] = &&do_OP_LESS_LOCAL_NUM,
+      [OP_GREATER_EQUAL_LOCAL_NUM] = &&do_OP_GREATER_EQUAL_LOCAL_NUM,
+      [OP_LESS_EQUAL_LOCAL_NUM] = &&do_OP_LESS_EQUAL_LOCAL_NUM,
+      [OP_ADD_STR] = &&do_OP_ADD_STR,
+      [OP_CONSTANT] = &&do_OP_CONSTANT,
+      [OP_RETURN] = &&do_OP_RETURN,
+  };
+  // Every handler ends in its own indirect jump, so the branch predictor
+  // learns the successors of each opcode separately.
+#define CASE(op) do_##op
+#define JUMP_TO(op) goto do_##op
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    TRACE_EXECUTION();                                                         \
+    start = frame->ip;                                                         \
+    instruction = READ_BYTE();                                                 \
+    PROFILE_INSTRUCTION();                                                     \
+    goto *dispatch_table[instruction];                                         \
+  } while (false)
+#define DISPATCH_CODE(code)                                                    \
+  do {                                                                         \
+    start = NULL;                                                              \
+    instruction = (code);                                                      \
+    PROFILE_INSTRUCTION();                                                     \
+    goto *dispatch_table[instruction];                                         \
+  } while (false)
+#else
+#define CASE(op) case op
+#define DISPATCH() break
+#define JUMP_TO(op)                                                            \
+  do {                                                                         \
+    instruction = (op);                                                        \
+    goto dispatch;                                                             \
+  } while (false)
+#define DISPATCH_CODE(code)                                                    \
+  do {                                                                         \
+    start = NULL;                                                              \
+    instruction = (code);                                                      \
+    PROFILE_INSTRUCTION();                                                     \
+    goto dispatch;                                                             \
+  } while (false)
+#endif /* ifdef COMPUTED_GOTO */
+
+  // Where the running instruction starts in the chunk, so generic handlers
+  // can quicken it; NULL when an operation value is being run.
+  uint8_t *start;
+  uint8_t instruction;
+  for (;;) {
+    TRACE_EXECUTION();
+    start = frame->ip;
+    instruction = READ_BYTE();
+    PROFILE_INSTRUCTION();
+#ifdef COMPUTED_GOTO
+    goto *dispatch_table[instruction];
+#else
+  dispatch:
+#endif /* ifdef COMPUTED_GOTO */
+    switch (instruction) {
+    CASE(OP_ADD): {
+      VARS_TO_VALS();
+      QUICKEN();
+      if (IS_STRING(TOP) && IS_STRING(SECOND)) {
+        SYNC();
         concatonate();
-      } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-        double b = AS_NUMBER(pop());
-        double a = AS_NUMBER(pop());
-        push(NUMBER_VAL(a + b));
+        RELOAD();
+      } else if (IS_NUMBER(TOP) && IS_NUMBER(SECOND)) {
+        Value b = TOP;
+        DROP(1);
+        TOP = add_numbers(TOP, b);
       } else {
         runtime_error("Operands must be either two strings or two numbers.");
         return INTERPRET_RUNTIME_ERROR;
       }
-      break;
-    }
-    case OP_SUBTRACT:
-      vars_to_vals();
-      BINARY_OP(NUMBER_VAL, -);
-      break;
-    case OP_MULTIPLY:
-      vars_to_vals();
-      BINARY_OP(NUMBER_VAL, *);
-      break;
-    case OP_DIVIDE:
-      vars_to_vals();
-      BINARY_OP(NUMBER_VAL, /);
-      break;
-    case OP_MOD: {
-      vars_to_vals();
-      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+      DISPATCH();
+    }
+    CASE(OP_SUBTRACT):
+      VARS_TO_VALS();
+      QUICKEN();
+      BINARY_OP(subtract_numbers);
+      DISPATCH();
+    CASE(OP_MULTIPLY):
+      VARS_TO_VALS();
+      QUICKEN();
+      BINARY_OP(multiply_numbers);
+      DISPATCH();
+    CASE(OP_DIVIDE):
+      VARS_TO_VALS();
+      QUICKEN();
+      BINARY_OP(divide_numbers);
+      DISPATCH();
+    CASE(OP_MOD): {
+      VARS_TO_VALS();
+      if (!IS_NUMBER(TOP) || !IS_NUMBER(SECOND)) {
         runtime_error("Operands must be both be numbers");
         return INTERPRET_RUNTIME_ERROR;
       }
+      SYNC();
       modulo();
-      break;
-    }
-    case OP_EQUAL: {
-      vars_to_vals();
-      Value b = peek(0);
-      Value a = peek(1);
-      Value result = BOOL_VAL(values_equal(a, b));
-      pop();
-      pop();
-      push(result);
-      break;
-    }
-    case OP_GREATER:
-      vars_to_vals();
-      BINARY_OP(NUMBER_VAL, >);
-      break;
-    case OP_LESS:
-      vars_to_vals();
-      BINARY_OP(NUMBER_VAL, *);
-      break;
-    case OP_GREATER_EQUAL:
-      vars_to_vals();
-      BINARY_OP(NUMBER_VAL, *);
-      break;
-    case OP_LESS_EQUAL:
-      vars_to_vals();
-      BINARY_OP(NUMBER_VAL, *);
-      break;
-    case OP_NOT: {
-      if (IS_VARIABLE(peek(0))) {
-        Value value = AS_VARIABLE(peek(0))->value;
-        pop();
-        push(value);
-        break;
-      }
-      Value not = BOOL_VAL(is_falsey(peek(0)));
-      pop();
-      push(not );
-
-      break;
-    }
-    case OP_WHILE: {
-      Value while_condition;
-      Value while_body_var;
-      while_body_var = peek(0);
-      if (!IS_VARIABLE(while_body_var)) {
-        runtime_error("body of while must be a variable.");
-      }
-      Value while_body;
-      table_get(&vm.globals, AS_VARIABLE(while_body_var)->name, &while_body);
-      table_get(&vm.globals, copy_string("while_condition", 15, false),
-                &while_condition);
-      if (!IS_PROCEDURE(while_condition) || !IS_PROCEDURE(while_body)) {
-        runtime_error("'while_condition' and 'while_body' must be procedures.");
+      RELOAD();
+      DISPATCH();
+    }
+    CASE(OP_EQUAL): {
+      VARS_TO_VALS();
+      Value b = TOP;
+      DROP(1);
+      TOP = BOOL_VAL(values_equal(TOP, b));
+      DISPATCH();
+    }
+    CASE(OP_GREATER):
+      VARS_TO_VALS();
+      QUICKEN();
+      BINARY_OP(greater_numbers);
+      DISPATCH();
+    CASE(OP_LESS):
+      VARS_TO_VALS();
+      QUICKEN();
+      BINARY_OP(less_numbers);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL):
+      VARS_TO_VALS();
+      QUICKEN();
+      BINARY_OP(greater_equal_numbers);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL):
+      VARS_TO_VALS();
+      QUICKEN();
+      BINARY_OP(less_equal_numbers);
+      DISPATCH();
+    CASE(OP_NOT): {
+      TOP = BOOL_VAL(is_falsey(variable_value(TOP)));
+      DISPATCH();
+    }
+    CASE(OP_NOT_EQUAL): {
+      VARS_TO_VALS();
+      Value b = TOP;
+      DROP(1);
+      TOP = BOOL_VAL(!values_equal(TOP, b));
+      DISPATCH();
+    }
+    CASE(OP_TRUTHY): {
+      TOP = BOOL_VAL(!is_falsey(variable_value(TOP)));
+      DISPATCH();
+    }
+    CASE(OP_DUP):
+      PUSH(TOP);
+      DISPATCH();
+    CASE(OP_SWAP): {
+      Value top = TOP;
+      TOP = SECOND;
+      SECOND = top;
+      DISPATCH();
+    }
+    CASE(OP_DROP):
+      DROP(1);
+      DISPATCH();
+    CASE(OP_OVER):
+      PUSH(SECOND);
+      DISPATCH();
+    CASE(OP_ROT): {
+      Value third = THIRD;
+      THIRD = SECOND;
+      SECOND = TOP;
+      TOP = third;
+      DISPATCH();
+    }
+    CASE(OP_PICK): {
+      // '0 pick' is 'dup', '1 pick' is 'over'.
+      Value index = variable_value(TOP);
+      double depth = (double)(SP - vm.stack - 1);
+      double n = IS_NUMBER(index) ? AS_NUMBER(index) : -1;
+      if (n < 0 || n >= depth || n != (double)(size_t)n) {
+        runtime_error("'pick' needs an index into the stack.");
         return INTERPRET_RUNTIME_ERROR;
       }
-
-      ObjProcedure *while_condition_proc = AS_PROCEDURE(while_condition);
-      ObjProcedure *while_body_proc = AS_PROCEDURE(while_body);
-      pop();
-      do {
-        // Evaluate the condition
-        InterpretResult condition_result = run_function(while_condition_proc);
-        if (condition_result == INTERPRET_RUNTIME_ERROR) {
+      TOP = SP[-2 - (ptrdiff_t)n];
+      DISPATCH();
+    }
+    CASE(OP_IF): {
+      Value path;
+      if (!is_falsey(variable_value(TOP))) {
+        path = variable_value(THIRD);
+      } else {
+        path = variable_value(SECOND);
+      }
+      DROP(3);
+      SYNC();
+      if (IS_PROCEDURE(path)) {
+        if (!call(AS_PROCEDURE(path)->closure, 0)) {
           return INTERPRET_RUNTIME_ERROR;
         }
-
-        // Check if the condition is true
-        Value condition_value = peek(0);
-
-        if (is_falsey(condition_value)) {
-          // Condition is false, break out of the loop
-          if (vm.stack_top > &(vm.stack[1])) {
-            pop();
-          }
-          break;
-        }
-        if (vm.stack_top > &(vm.stack[1])) {
-          pop();
+        frame = &vm.frames[vm.frame_count - 1];
+      } else if (IS_OPERATION(path)) {
+        // Operations run the same handler as their opcode.
+        uint8_t code = AS_OPERATION(path)->code;
+        if (!enter_operation(frame, code)) {
+          return INTERPRET_RUNTIME_ERROR;
         }
-        // Execute the body of the while loop
-        InterpretResult body_result = run_function(while_body_proc);
-        if (body_result == INTERPRET_RUNTIME_ERROR) {
+        RELOAD();
+        DISPATCH_CODE(code);
+      } else {
+        if (!enter_segment(frame, 0, 1)) {
           return INTERPRET_RUNTIME_ERROR;
         }
-        // Repeat the loop as long as the condition is true
-      } while (true);
-
-      break;
+        push(path);
+      }
+      ENTER_NATIVE();
+      RELOAD();
+      DISPATCH();
     }
-    case OP_IF: {
-      Value val = pop();
-      vars_to_vals();
-      push(val);
-      Value boolean = BOOL_VAL(!is_falsey(peek(0)));
-      Value path;
-      if (AS_BOOL(boolean)) {
-        path = peek(2);
-      } else {
-        path = peek(1);
+    CASE(OP_JUMP): {
+      uint16_t offset = READ_SHORT();
+      frame->ip += offset;
+      DISPATCH();
+    }
+    CASE(OP_JUMP_IF_FALSE): {
+      uint16_t offset = READ_SHORT();
+      Value condition = TOP;
+      DROP(1);
+      if (is_falsey(variable_value(condition))) {
+        frame->ip += offset;
       }
-      pop();
-      pop();
-      pop();
-      InterpretResult result = INTERPRET_OK;
+      DISPATCH();
+    }
+    CASE(OP_LOOP): {
+      uint16_t offset = READ_SHORT();
+      frame->ip -= offset;
+      DISPATCH();
+    }
+    CASE(OP_INVOKE): {
+      Value path = READ_GLOBAL();
+      SYNC();
       if (IS_PROCEDURE(path)) {
-        result = run_function(AS_PROCEDURE(path));
+        if (!call(AS_PROCEDURE(path)->closure, 0)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        frame = &vm.frames[vm.frame_count - 1];
       } else if (IS_OPERATION(path)) {
-        result = run_operation(AS_OPERATION(path));
+        uint8_t code = AS_OPERATION(path)->code;
+        if (!enter_operation(frame, code)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        RELOAD();
+        DISPATCH_CODE(code);
       } else {
+        if (!enter_segment(frame, 0, 1)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
         push(path);
       }
-      if (result == INTERPRET_RUNTIME_ERROR) {
-        return INTERPRET_RUNTIME_ERROR;
-      }
-      break;
+      ENTER_NATIVE();
+      RELOAD();
+      DISPATCH();
     }
-    case OP_PRINT: {
-      if (IS_VARIABLE(peek(0))) {
-        print_value(AS_VARIABLE(peek(0))->value);
-        pop();
-        break;
-      }
-      print_value(pop());
-      break;
+    CASE(OP_PRINT): {
+      Value value = TOP;
+      DROP(1);
+      print_value(variable_value(value));
+      DISPATCH();
     }
-    case OP_SCAN: {
+    CASE(OP_SCAN): {
       char buffer[1024];
+      SYNC();
 
       if (fgets(buffer, sizeof(buffer), stdin) != NULL) {
         int status_code = 0;
@@ -662,72 +1278,589 @@ static InterpretResult run() {
         runtime_error("reached end of input.");
         return INTERPRET_RUNTIME_ERROR;
       }
-      break;
-    }
-    case OP_PUSH_OPERATION: {
-      ObjString *op = READ_STRING();
-      ObjOperation *operation = new_operation();
-      operation->type = op;
-      push(OBJ_VAL(operation));
-      break;
-    }
-    case OP_VARIABLE: {
-      ObjString *name = READ_STRING();
-      ObjVariable *variable = new_variable();
-      Value value;
-      table_get(&vm.globals, name, &value);
-      variable->name = name;
-      variable->value = value;
-      push(OBJ_VAL(variable));
-      break;
-    }
-    case OP_SET_VARIABLE: {
-      if (!IS_VARIABLE(peek(0))) {
+      RELOAD();
+      DISPATCH();
+    }
+    CASE(OP_PUSH_OPERATION):
+      PUSH(OBJ_VAL(vm.operations[READ_BYTE()]));
+      DISPATCH();
+    CASE(OP_VARIABLE):
+      PUSH(VARIABLE_VAL(READ_SHORT()));
+      DISPATCH();
+    CASE(OP_GET_LOCAL):
+      PUSH(frame->slots[READ_BYTE()]);
+      DISPATCH();
+    CASE(OP_SET_LOCAL):
+      frame->slots[READ_BYTE()] = variable_value(TOP);
+      DROP(1);
+      DISPATCH();
+    CASE(OP_LET):
+      runtime_error("'let' only binds names inside procedure bodies.");
+      return INTERPRET_RUNTIME_ERROR;
+    CASE(OP_NOMEMO):
+      runtime_error("'nomemo' only marks procedure bodies.");
+      return INTERPRET_RUNTIME_ERROR;
+    CASE(OP_SET_VARIABLE): {
+      if (!IS_VARIABLE(TOP)) {
         runtime_error("Can only asign to variables.");
         return INTERPRET_RUNTIME_ERROR;
       }
-      table_set(&vm.globals, AS_VARIABLE(peek(0))->name, peek(1));
-      pop();
-      pop();
-      break;
-    }
-    case OP_DEFINE_FUNCTION:
-      define_function(READ_STRING());
-      break;
-    case OP_APPLY: {
-      if (!IS_VARIABLE(peek(0))) {
+      vm.global_values.value[AS_VARIABLE(TOP)] = variable_value(SECOND);
+      DROP(2);
+      DISPATCH();
+    }
+    CASE(OP_DEFINE_FUNCTION): {
+      Chunk *chunk = &frame->closure->function->chunk;
+      size_t line = chunk->lines[frame->ip - chunk->code];
+      SYNC();
+      if (!define_function(READ_SHORT(), line) ||
+          !enter_segment(frame, 0, 0)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      RELOAD();
+      DISPATCH();
+    }
+    CASE(OP_APPLY): {
+      // Locals hold procedures themselves rather than names for them.
+      Value value = variable_value(TOP);
+      if (!IS_PROCEDURE(value)) {
+        if (IS_VARIABLE(TOP)) {
+          vm.global_values.value[AS_VARIABLE(TOP)] = NIL_VAL;
+        }
+        runtime_error("can not run a non procedure.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      DROP(1);
+      SYNC();
+      if (!call(AS_PROCEDURE(value)->closure, 0)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
+      ENTER_NATIVE();
+      RELOAD();
+      DISPATCH();
+    }
+    CASE(OP_TAIL_APPLY): {
+      Value value = variable_value(TOP);
+      if (!IS_PROCEDURE(value)) {
+        if (IS_VARIABLE(TOP)) {
+          vm.global_values.value[AS_VARIABLE(TOP)] = NIL_VAL;
+        }
         runtime_error("can not run a non procedure.");
         return INTERPRET_RUNTIME_ERROR;
       }
-      Value value;
-      table_get(&vm.globals, AS_VARIABLE(peek(0))->name, &value);
+      DROP(1);
+      SYNC();
+      if (!tail_call(frame, AS_PROCEDURE(value)->closure)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ENTER_NATIVE();
+      RELOAD();
+      DISPATCH();
+    }
+    CASE(OP_TAIL_INVOKE): {
+      Value path = READ_GLOBAL();
+      SYNC();
+      if (IS_PROCEDURE(path)) {
+        if (!tail_call(frame, AS_PROCEDURE(path)->closure)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+      } else if (IS_OPERATION(path)) {
+        uint8_t code = AS_OPERATION(path)->code;
+        if (!enter_operation(frame, code)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        RELOAD();
+        DISPATCH_CODE(code);
+      } else {
+        if (!enter_segment(frame, 0, 1)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        push(path);
+      }
+      ENTER_NATIVE();
+      RELOAD();
+      DISPATCH();
+    }
+    CASE(OP_INLINE): {
+      uint16_t slot = READ_SHORT();
+      Value callee = READ_CONSTANT();
+      uint16_t length = READ_SHORT();
+      Value value = vm.global_values.value[slot];
+      if (values_equal(value, callee)) {
+        DISPATCH();
+      }
+      // Stale: apply what the slot holds now and resume after the copy.
       if (!IS_PROCEDURE(value)) {
-        table_delete(&vm.globals, AS_VARIABLE(peek(0))->name);
+        vm.global_values.value[slot] = NIL_VAL;
         runtime_error("can not run a non procedure.");
         return INTERPRET_RUNTIME_ERROR;
       }
-      pop();
-      InterpretResult result = run_function(AS_PROCEDURE(value));
-      if (result == INTERPRET_RUNTIME_ERROR) {
+      frame->ip += length;
+      SYNC();
+      if (!call(AS_PROCEDURE(value)->closure, 0)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      break;
+      frame = &vm.frames[vm.frame_count - 1];
+      ENTER_NATIVE();
+      RELOAD();
+      DISPATCH();
     }
-    case OP_RETURN:
-      return INTERPRET_OK;
-    case OP_CONSTANT: {
+    CASE(OP_ADD_CONSTANT):
+      PUSH(READ_CONSTANT());
+      JUMP_TO(OP_ADD);
+    CASE(OP_SUBTRACT_CONSTANT):
+      PUSH(READ_CONSTANT());
+      JUMP_TO(OP_SUBTRACT);
+    CASE(OP_MULTIPLY_CONSTANT):
+      PUSH(READ_CONSTANT());
+      JUMP_TO(OP_MULTIPLY);
+    CASE(OP_DIVIDE_CONSTANT):
+      PUSH(READ_CONSTANT());
+      JUMP_TO(OP_DIVIDE);
+    CASE(OP_GREATER_CONSTANT):
+      PUSH(READ_CONSTANT());
+      JUMP_TO(OP_GREATER);
+    CASE(OP_LESS_CONSTANT):
+      PUSH(READ_CONSTANT());
+      JUMP_TO(OP_LESS);
+    CASE(OP_GREATER_EQUAL_CONSTANT):
+      PUSH(READ_CONSTANT());
+      JUMP_TO(OP_GREATER_EQUAL);
+    CASE(OP_LESS_EQUAL_CONSTANT):
+      PUSH(READ_CONSTANT());
+      JUMP_TO(OP_LESS_EQUAL);
+    CASE(OP_ADD_VARIABLE):
+      PUSH(READ_GLOBAL());
+      JUMP_TO(OP_ADD);
+    CASE(OP_SUBTRACT_VARIABLE):
+      PUSH(READ_GLOBAL());
+      JUMP_TO(OP_SUBTRACT);
+    CASE(OP_MULTIPLY_VARIABLE):
+      PUSH(READ_GLOBAL());
+      JUMP_TO(OP_MULTIPLY);
+    CASE(OP_DIVIDE_VARIABLE):
+      PUSH(READ_GLOBAL());
+      JUMP_TO(OP_DIVIDE);
+    CASE(OP_GREATER_VARIABLE):
+      PUSH(READ_GLOBAL());
+      JUMP_TO(OP_GREATER);
+    CASE(OP_LESS_VARIABLE):
+      PUSH(READ_GLOBAL());
+      JUMP_TO(OP_LESS);
+    CASE(OP_GREATER_EQUAL_VARIABLE):
+      PUSH(READ_GLOBAL());
+      JUMP_TO(OP_GREATER_EQUAL);
+    CASE(OP_LESS_EQUAL_VARIABLE):
+      PUSH(READ_GLOBAL());
+      JUMP_TO(OP_LESS_EQUAL);
+    CASE(OP_ADD_LOCAL):
+      PUSH(READ_LOCAL());
+      JUMP_TO(OP_ADD);
+    CASE(OP_SUBTRACT_LOCAL):
+      PUSH(READ_LOCAL());
+      JUMP_TO(OP_SUBTRACT);
+    CASE(OP_MULTIPLY_LOCAL):
+      PUSH(READ_LOCAL());
+      JUMP_TO(OP_MULTIPLY);
+    CASE(OP_DIVIDE_LOCAL):
+      PUSH(READ_LOCAL());
+      JUMP_TO(OP_DIVIDE);
+    CASE(OP_GREATER_LOCAL):
+      PUSH(READ_LOCAL());
+      JUMP_TO(OP_GREATER);
+    CASE(OP_LESS_LOCAL):
+      PUSH(READ_LOCAL());
+      JUMP_TO(OP_LESS);
+    CASE(OP_GREATER_EQUAL_LOCAL):
+      PUSH(READ_LOCAL());
+      JUMP_TO(OP_GREATER_EQUAL);
+    CASE(OP_LESS_EQUAL_LOCAL):
+      PUSH(READ_LOCAL());
+      JUMP_TO(OP_LESS_EQUAL);
+    CASE(OP_SET_GLOBAL):
+      READ_GLOBAL() = variable_value(TOP);
+      DROP(1);
+      DISPATCH();
+    CASE(OP_ADD_INT):
+      INT_OP(add, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_INT):
+      INT_OP(subtract, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_INT):
+      INT_OP(multiply, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_INT):
+      INT_OP(divide, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_INT):
+      INT_OP(greater, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_INT):
+      INT_OP(less, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_INT):
+      INT_OP(greater_equal, OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_INT):
+      INT_OP(less_equal, OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_CONSTANT_INT):
+      INT_CONSTANT_OP(add, OP_ADD_CONSTANT, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_CONSTANT_INT):
+      INT_CONSTANT_OP(subtract, OP_SUBTRACT_CONSTANT, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_CONSTANT_INT):
+      INT_CONSTANT_OP(multiply, OP_MULTIPLY_CONSTANT, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_CONSTANT_INT):
+      INT_CONSTANT_OP(divide, OP_DIVIDE_CONSTANT, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_CONSTANT_INT):
+      INT_CONSTANT_OP(greater, OP_GREATER_CONSTANT, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_CONSTANT_INT):
+      INT_CONSTANT_OP(less, OP_LESS_CONSTANT, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_CONSTANT_INT):
+      INT_CONSTANT_OP(greater_equal, OP_GREATER_EQUAL_CONSTANT,
+                      OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_CONSTANT_INT):
+      INT_CONSTANT_OP(less_equal, OP_LESS_EQUAL_CONSTANT, OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_VARIABLE_INT):
+      INT_OPERAND_OP(READ_GLOBAL(), add, OP_ADD_VARIABLE, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_VARIABLE_INT):
+      INT_OPERAND_OP(READ_GLOBAL(), subtract, OP_SUBTRACT_VARIABLE,
+                     OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_VARIABLE_INT):
+      INT_OPERAND_OP(READ_GLOBAL(), multiply, OP_MULTIPLY_VARIABLE,
+                     OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_VARIABLE_INT):
+      INT_OPERAND_OP(READ_GLOBAL(), divide, OP_DIVIDE_VARIABLE, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_VARIABLE_INT):
+      INT_OPERAND_OP(READ_GLOBAL(), greater, OP_GREATER_VARIABLE, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_VARIABLE_INT):
+      INT_OPERAND_OP(READ_GLOBAL(), less, OP_LESS_VARIABLE, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_VARIABLE_INT):
+      INT_OPERAND_OP(READ_GLOBAL(), greater_equal, OP_GREATER_EQUAL_VARIABLE,
+                     OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_VARIABLE_INT):
+      INT_OPERAND_OP(READ_GLOBAL(), less_equal, OP_LESS_EQUAL_VARIABLE,
+                     OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_LOCAL_INT):
+      INT_OPERAND_OP(READ_LOCAL(), add, OP_ADD_LOCAL, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_LOCAL_INT):
+      INT_OPERAND_OP(READ_LOCAL(), subtract, OP_SUBTRACT_LOCAL, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_LOCAL_INT):
+      INT_OPERAND_OP(READ_LOCAL(), multiply, OP_MULTIPLY_LOCAL, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_LOCAL_INT):
+      INT_OPERAND_OP(READ_LOCAL(), divide, OP_DIVIDE_LOCAL, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_LOCAL_INT):
+      INT_OPERAND_OP(READ_LOCAL(), greater, OP_GREATER_LOCAL, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_LOCAL_INT):
+      INT_OPERAND_OP(READ_LOCAL(), less, OP_LESS_LOCAL, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_LOCAL_INT):
+      INT_OPERAND_OP(READ_LOCAL(), greater_equal, OP_GREATER_EQUAL_LOCAL,
+                     OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_LOCAL_INT):
+      INT_OPERAND_OP(READ_LOCAL(), less_equal, OP_LESS_EQUAL_LOCAL,
+                     OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_DOUBLE):
+      DOUBLE_OP(add, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_DOUBLE):
+      DOUBLE_OP(subtract, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_DOUBLE):
+      DOUBLE_OP(multiply, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_DOUBLE):
+      DOUBLE_OP(divide, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_DOUBLE):
+      DOUBLE_OP(greater, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_DOUBLE):
+      DOUBLE_OP(less, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_DOUBLE):
+      DOUBLE_OP(greater_equal, OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_DOUBLE):
+      DOUBLE_OP(less_equal, OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_CONSTANT_DOUBLE):
+      DOUBLE_CONSTANT_OP(add, OP_ADD_CONSTANT, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_CONSTANT_DOUBLE):
+      DOUBLE_CONSTANT_OP(subtract, OP_SUBTRACT_CONSTANT, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_CONSTANT_DOUBLE):
+      DOUBLE_CONSTANT_OP(multiply, OP_MULTIPLY_CONSTANT, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_CONSTANT_DOUBLE):
+      DOUBLE_CONSTANT_OP(divide, OP_DIVIDE_CONSTANT, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_CONSTANT_DOUBLE):
+      DOUBLE_CONSTANT_OP(greater, OP_GREATER_CONSTANT, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_CONSTANT_DOUBLE):
+      DOUBLE_CONSTANT_OP(less, OP_LESS_CONSTANT, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_CONSTANT_DOUBLE):
+      DOUBLE_CONSTANT_OP(greater_equal, OP_GREATER_EQUAL_CONSTANT,
+                         OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_CONSTANT_DOUBLE):
+      DOUBLE_CONSTANT_OP(less_equal, OP_LESS_EQUAL_CONSTANT, OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_VARIABLE_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_GLOBAL(), add, OP_ADD_VARIABLE, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_VARIABLE_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_GLOBAL(), subtract, OP_SUBTRACT_VARIABLE,
+                        OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_VARIABLE_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_GLOBAL(), multiply, OP_MULTIPLY_VARIABLE,
+                        OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_VARIABLE_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_GLOBAL(), divide, OP_DIVIDE_VARIABLE, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_VARIABLE_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_GLOBAL(), greater, OP_GREATER_VARIABLE,
+                        OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_VARIABLE_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_GLOBAL(), less, OP_LESS_VARIABLE, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_VARIABLE_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_GLOBAL(), greater_equal, OP_GREATER_EQUAL_VARIABLE,
+                        OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_VARIABLE_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_GLOBAL(), less_equal, OP_LESS_EQUAL_VARIABLE,
+                        OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_LOCAL_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_LOCAL(), add, OP_ADD_LOCAL, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_LOCAL_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_LOCAL(), subtract, OP_SUBTRACT_LOCAL, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_LOCAL_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_LOCAL(), multiply, OP_MULTIPLY_LOCAL, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_LOCAL_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_LOCAL(), divide, OP_DIVIDE_LOCAL, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_LOCAL_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_LOCAL(), greater, OP_GREATER_LOCAL, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_LOCAL_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_LOCAL(), less, OP_LESS_LOCAL, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_LOCAL_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_LOCAL(), greater_equal, OP_GREATER_EQUAL_LOCAL,
+                        OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_LOCAL_DOUBLE):
+      DOUBLE_OPERAND_OP(READ_LOCAL(), less_equal, OP_LESS_EQUAL_LOCAL,
+                        OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_NUM):
+      NUMBER_OP(add, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_NUM):
+      NUMBER_OP(subtract, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_NUM):
+      NUMBER_OP(multiply, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_NUM):
+      NUMBER_OP(divide, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_NUM):
+      NUMBER_OP(greater, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_NUM):
+      NUMBER_OP(less, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_NUM):
+      NUMBER_OP(greater_equal, OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_NUM):
+      NUMBER_OP(less_equal, OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_CONSTANT_NUM):
+      NUMBER_CONSTANT_OP(add, OP_ADD_CONSTANT, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_CONSTANT_NUM):
+      NUMBER_CONSTANT_OP(subtract, OP_SUBTRACT_CONSTANT, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_CONSTANT_NUM):
+      NUMBER_CONSTANT_OP(multiply, OP_MULTIPLY_CONSTANT, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_CONSTANT_NUM):
+      NUMBER_CONSTANT_OP(divide, OP_DIVIDE_CONSTANT, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_CONSTANT_NUM):
+      NUMBER_CONSTANT_OP(greater, OP_GREATER_CONSTANT, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_CONSTANT_NUM):
+      NUMBER_CONSTANT_OP(less, OP_LESS_CONSTANT, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_CONSTANT_NUM):
+      NUMBER_CONSTANT_OP(greater_equal, OP_GREATER_EQUAL_CONSTANT,
+                         OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_CONSTANT_NUM):
+      NUMBER_CONSTANT_OP(less_equal, OP_LESS_EQUAL_CONSTANT, OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_VARIABLE_NUM):
+      NUMBER_OPERAND_OP(READ_GLOBAL(), add, OP_ADD_VARIABLE, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_VARIABLE_NUM):
+      NUMBER_OPERAND_OP(READ_GLOBAL(), subtract, OP_SUBTRACT_VARIABLE,
+                        OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_VARIABLE_NUM):
+      NUMBER_OPERAND_OP(READ_GLOBAL(), multiply, OP_MULTIPLY_VARIABLE,
+                        OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_VARIABLE_NUM):
+      NUMBER_OPERAND_OP(READ_GLOBAL(), divide, OP_DIVIDE_VARIABLE, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_VARIABLE_NUM):
+      NUMBER_OPERAND_OP(READ_GLOBAL(), greater, OP_GREATER_VARIABLE,
+                        OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_VARIABLE_NUM):
+      NUMBER_OPERAND_OP(READ_GLOBAL(), less, OP_LESS_VARIABLE, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_VARIABLE_NUM):
+      NUMBER_OPERAND_OP(READ_GLOBAL(), greater_equal, OP_GREATER_EQUAL_VARIABLE,
+                        OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_VARIABLE_NUM):
+      NUMBER_OPERAND_OP(READ_GLOBAL(), less_equal, OP_LESS_EQUAL_VARIABLE,
+                        OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_LOCAL_NUM):
+      NUMBER_OPERAND_OP(READ_LOCAL(), add, OP_ADD_LOCAL, OP_ADD);
+      DISPATCH();
+    CASE(OP_SUBTRACT_LOCAL_NUM):
+      NUMBER_OPERAND_OP(READ_LOCAL(), subtract, OP_SUBTRACT_LOCAL, OP_SUBTRACT);
+      DISPATCH();
+    CASE(OP_MULTIPLY_LOCAL_NUM):
+      NUMBER_OPERAND_OP(READ_LOCAL(), multiply, OP_MULTIPLY_LOCAL, OP_MULTIPLY);
+      DISPATCH();
+    CASE(OP_DIVIDE_LOCAL_NUM):
+      NUMBER_OPERAND_OP(READ_LOCAL(), divide, OP_DIVIDE_LOCAL, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_GREATER_LOCAL_NUM):
+      NUMBER_OPERAND_OP(READ_LOCAL(), greater, OP_GREATER_LOCAL, OP_GREATER);
+      DISPATCH();
+    CASE(OP_LESS_LOCAL_NUM):
+      NUMBER_OPERAND_OP(READ_LOCAL(), less, OP_LESS_LOCAL, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_EQUAL_LOCAL_NUM):
+      NUMBER_OPERAND_OP(READ_LOCAL(), greater_equal, OP_GREATER_EQUAL_LOCAL,
+                        OP_GREATER_EQUAL);
+      DISPATCH();
+    CASE(OP_LESS_EQUAL_LOCAL_NUM):
+      NUMBER_OPERAND_OP(READ_LOCAL(), less_equal, OP_LESS_EQUAL_LOCAL,
+                        OP_LESS_EQUAL);
+      DISPATCH();
+    CASE(OP_ADD_STR):
+      VARS_TO_VALS();
+      if (!IS_STRING(TOP) || !IS_STRING(SECOND)) {
+        *start = OP_ADD;
+        JUMP_TO(OP_ADD);
+      }
+      SYNC();
+      concatonate();
+      RELOAD();
+      DISPATCH();
+    CASE(OP_RETURN):
+      SYNC();
+      vm.locals_top = frame->slots;
+      if (frame->memo != NULL) {
+        finish_memo(frame);
+      }
+      vm.frame_count--;
+      if (vm.frame_count == 0) {
+        return INTERPRET_OK;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
+      if (!enter_segment(frame, 0, 0)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ENTER_NATIVE();
+      RELOAD();
+      DISPATCH();
+    CASE(OP_CONSTANT): {
       Value constant = READ_CONSTANT();
-      push(constant);
-      break;
+      PUSH(constant);
+      DISPATCH();
     }
     }
   }
 
+#undef TRACE_EXECUTION
+#undef PROFILE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
+#undef DISPATCH_CODE
+#undef JUMP_TO
 #undef READ_CONSTANT
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_STRING
+#undef READ_GLOBAL
+#undef READ_LOCAL
 #undef BINARY_OP
+#undef VARS_TO_VALS
+#undef TOP
+#undef SP
+#undef SECOND
+#undef THIRD
+#undef PUSH
+#undef DROP
+#undef SYNC
+#undef RELOAD
+#undef ENTER_NATIVE
+#undef INT_OP
+#undef DOUBLE_OP
+#undef NUMBER_OP
+#undef INT_CONSTANT_OP
+#undef DOUBLE_CONSTANT_OP
+#undef NUMBER_CONSTANT_OP
+#undef INT_OPERAND_OP
+#undef DOUBLE_OPERAND_OP
+#undef NUMBER_OPERAND_OP
+#undef QUICKEN
 }
 
 InterpretResult interpret(const char *source) {
@@ -735,12 +1868,15 @@ InterpretResult interpret(const char *source) {
   if (function == NULL) {
     return INTERPRET_COMPILE_ERROR;
   }
+  function->aot = aot_find(NULL, function);
 
   push(OBJ_VAL(function));
   ObjClosure *closure = new_closure(function);
   pop();
   push(OBJ_VAL(closure));
-  call(closure, 0);
+  if (!call(closure, 0)) {
+    return INTERPRET_RUNTIME_ERROR;
+  }
 
   return run();
 }
@@ -8,30 +8,78 @@
 #include "value.h"
 #include <stdint.h>
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// Frames grow on demand; the cap only turns runaway recursion into an error.
+#define FRAMES_MAX (1024 * 1024)
+// The value stack grows as verified segments ask for room, up to STACK_MAX.
+// STACK_SLACK more slots are always free for values C code pushes.
+#define STACK_MAX (1024 * 1024)
+#define STACK_SLACK 16
 
 typedef struct CallFrame {
   ObjClosure *closure;
   uint8_t *ip;
+  // The frame's locals in vm.locals, one per name its code binds with 'let'.
   Value *slots;
+  // While the frame records its result for a memo table: the function that
+  // owns the table, which tail calls may have replaced in closure, where
+  // its inputs were copied to in vm.memo_keys, the stack depth it was
+  // called at and the enclosing recording's vm.stack_low. memo is NULL
+  // otherwise.
+  ObjFunction *memo;
+  size_t memo_keys;
+  size_t memo_entry;
+  size_t memo_low;
 } CallFrame;
 
 typedef struct VM {
-  CallFrame frames[FRAMES_MAX];
+  CallFrame *frames;
   size_t frame_count;
-  Value stack[STACK_MAX];
+  size_t frame_capacity;
+  Value *stack;
+  size_t stack_capacity;
   Value *stack_top;
+  // Procedures work on the shared value stack, so their locals live apart.
+  Value *locals;
+  size_t locals_capacity;
+  Value *locals_top;
+  // How many frames are recording memo results, the lowest stack depth
+  // code has reached since the innermost of them was called, and the keys
+  // they were called with.
+  size_t memo_frames;
+  size_t stack_low;
+  Value_Array memo_keys;
+  // Bumped by memo_flush(); tables from an older epoch are stale.
+  size_t memo_epoch;
   Table globals;
+  Value_Array global_names;
+  Value_Array global_values;
   Table strings;
+  ObjOperation *operations[UINT8_COUNT];
   ObjString *init_string;
   ObjUpvalue *open_upvalues;
   size_t bytes_allocated;
   size_t next_gc;
-  Obj *objects;
+  // Bytes allocated since the last collection.
+  size_t young_bytes;
+  // Objects allocated since the last collection; the old generation is
+  // whatever else the arenas hold.
+  Obj **young;
+  size_t young_count;
+  size_t young_capacity;
+  // An incremental collection is marking; the young objects from
+  // young_traced on were allocated since they were last traced.
+  bool marking;
+  size_t young_traced;
+  // A major collection has marked and left freeing the rest of its arenas
+  // to allocation.
+  bool sweeping;
   size_t gray_count;
   size_t gray_capacity;
   Obj **gray_stack;
+  // Old objects stored into since the last collection.
+  size_t remembered_count;
+  size_t remembered_capacity;
+  Obj **remembered;
 } VM;
 
 typedef enum InterpretResult {
@@ -45,5 +93,6 @@ extern VM vm;
 void init_VM();
 void free_VM();
 InterpretResult interpret(const char *source);
+size_t resolve_global(ObjString *name);
 void push(Value value);
 Value pop();